@@ -0,0 +1,390 @@
+#pragma once
+
+// Coroutine asset loading. A Task<T> is a lazily started coroutine that
+// produces a T; awaiting it runs it and resumes the awaiter when it is done,
+// and whenAll() starts several tasks at once and resumes the awaiter on the
+// thread that finishes the last of them. Loads return Expected values, so a
+// missing or corrupt file becomes an error message instead of an exit.
+// Where a coroutine runs is explicit:
+//   co_await ioPool.read(path)    blocking file reads on a small I/O pool,
+//                                 resuming on a job system worker (also
+//                                 ranges: read(path, offset, size))
+//   co_await resumeOnJobs()       move to a job system worker
+//   co_await renderThread.resume() GL work, run by renderThread.pump() on the
+//                                 thread that owns the context
+// runUntilDone() drives a root task from the render thread, pumping both.
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "jobs.h"
+
+#define ASSET_IO_THREADS 2
+
+struct AssetError
+{
+    std::string message;
+};
+
+// A value or the reason it could not be produced
+template <class T>
+class Expected
+{
+    std::optional<T> value;
+    std::string message;
+
+public:
+    Expected(T _value) : value(std::move(_value)) {}
+    Expected(AssetError _error) : message(std::move(_error.message)) {}
+
+    explicit operator bool() const { return value.has_value(); }
+    T& operator*() { return *value; }
+    const T& operator*() const { return *value; }
+    T* operator->() { return &*value; }
+    const T* operator->() const { return &*value; }
+    const std::string& error() const { return message; }
+};
+
+// State shared by every task, whatever it returns
+struct TaskPromiseBase
+{
+    std::coroutine_handle<> continuation;
+    std::atomic<int>* join = nullptr; // whenAll countdown
+    std::atomic<bool> finished{ false };
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        void await_resume() noexcept {}
+
+        template <class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            TaskPromiseBase& promise = handle.promise();
+            std::coroutine_handle<> next = promise.continuation ? promise.continuation : std::noop_coroutine();
+            std::atomic<int>* join = promise.join;
+            // Whoever polls finished, or the whenAll sibling that finishes
+            // last, may destroy the frame from here on: nothing below touches
+            // the promise
+            promise.finished.store(true, std::memory_order_release);
+            if (join && join->fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return std::noop_coroutine();
+            return next;
+        }
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <class T>
+class Task
+{
+public:
+    struct promise_type : TaskPromiseBase
+    {
+        std::optional<T> value;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        template <class U>
+        void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> _handle) : handle(_handle) {}
+
+    template <class... Tasks>
+    friend class WhenAll;
+
+public:
+    Task() = default;
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    // Runs the coroutine on the calling thread up to its first suspension;
+    // done() tells when it has finished
+    void start() { handle.resume(); }
+    bool done() const { return handle && handle.promise().finished.load(std::memory_order_acquire); }
+
+    // The finished task's value; rethrows what escaped the coroutine
+    T result()
+    {
+        if (handle.promise().exception)
+            std::rethrow_exception(handle.promise().exception);
+        return std::move(*handle.promise().value);
+    }
+
+    auto operator co_await() noexcept
+    {
+        struct Awaiter
+        {
+            Task& task;
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                task.handle.promise().continuation = awaiting;
+                return task.handle;
+            }
+            T await_resume() { return task.result(); }
+        };
+        return Awaiter{ *this };
+    }
+};
+
+// Starts every task, then resumes the awaiting coroutine once all finished;
+// their values are read afterwards with result()
+template <class... Tasks>
+class WhenAll
+{
+    std::vector<std::pair<std::coroutine_handle<>, TaskPromiseBase*>> tasks;
+    std::atomic<int> remaining{ 0 };
+
+public:
+    explicit WhenAll(Tasks&... _tasks) { (tasks.push_back({ _tasks.handle, &_tasks.handle.promise() }), ...); }
+
+    bool await_ready() noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        // One extra count so no task can resume us before all are started
+        remaining.store(int(tasks.size()) + 1, std::memory_order_relaxed);
+        for (auto& task : tasks)
+        {
+            task.second->continuation = awaiting;
+            task.second->join = &remaining;
+        }
+        for (auto& task : tasks)
+            task.first.resume();
+        return remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void await_resume() noexcept {}
+};
+
+template <class... Tasks>
+WhenAll<Tasks...> whenAll(Tasks&... tasks)
+{
+    return WhenAll<Tasks...>(tasks...);
+}
+
+inline auto resumeOnJobs()
+{
+    struct Awaiter
+    {
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { jobSystem.post([handle]() { handle.resume(); }); }
+        void await_resume() noexcept {}
+    };
+    return Awaiter{};
+}
+
+// Coroutines waiting for the thread that owns the GL context
+class RenderThread
+{
+    std::mutex lock;
+    std::vector<std::coroutine_handle<>> waiting;
+
+public:
+    auto resume()
+    {
+        struct Awaiter
+        {
+            RenderThread& thread;
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                std::lock_guard<std::mutex> guard(thread.lock);
+                thread.waiting.push_back(handle);
+            }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{ *this };
+    }
+
+    // Called by the render thread; false if nothing was waiting
+    bool pump()
+    {
+        std::vector<std::coroutine_handle<>> ready;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ready.swap(waiting);
+        }
+        for (std::coroutine_handle<> handle : ready)
+            handle.resume();
+        return !ready.empty();
+    }
+};
+
+inline RenderThread renderThread;
+
+// Whole-file and ranged reads on dedicated threads, so blocking I/O never
+// holds a job system worker
+class IoPool
+{
+    typedef std::vector<unsigned char> Bytes;
+
+    struct Request
+    {
+        std::string path;
+        uint64_t offset;
+        size_t size; // SIZE_MAX: to the end of the file
+        std::optional<Expected<Bytes>>* result;
+        std::coroutine_handle<> handle;
+    };
+
+    std::vector<std::thread> threads;
+    std::deque<Request> requests;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::once_flag started;
+    bool stopping = false;
+
+    // 64-bit offsets: long is 32 bits on Windows, and packs and virtual
+    // textures can be larger than 2 GB
+    static bool seek(FILE* file, uint64_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    static Expected<Bytes> readFile(const std::string& path, uint64_t offset, size_t size)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return AssetError{ "Error al abrir el archivo: " + path };
+        Bytes bytes;
+        bool failed = offset > 0 && !seek(file, offset);
+        if (size != SIZE_MAX && !failed)
+        {
+            bytes.resize(size);
+            failed = std::fread(bytes.data(), 1, size, file) != size;
+        }
+        else if (!failed)
+        {
+            unsigned char buffer[1 << 16];
+            size_t read;
+            while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+                bytes.insert(bytes.end(), buffer, buffer + read);
+        }
+        failed = failed || std::ferror(file) != 0;
+        std::fclose(file);
+        if (failed)
+            return AssetError{ "Error al leer el archivo: " + path };
+        return bytes;
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            Request request;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                ready.wait(guard, [&]() { return stopping || !requests.empty(); });
+                if (requests.empty())
+                    return;
+                request = std::move(requests.front());
+                requests.pop_front();
+            }
+            request.result->emplace(readFile(request.path, request.offset, request.size));
+            std::coroutine_handle<> handle = request.handle;
+            jobSystem.post([handle]() { handle.resume(); });
+        }
+    }
+
+public:
+    IoPool() = default;
+    IoPool(const IoPool&) = delete;
+    IoPool& operator=(const IoPool&) = delete;
+    ~IoPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    // co_await ioPool.read(path) yields Expected<std::vector<unsigned char>>;
+    // with a size, only that many bytes from offset on
+    auto read(std::string path, uint64_t offset = 0, size_t size = SIZE_MAX)
+    {
+        struct Awaiter
+        {
+            IoPool& pool;
+            std::string path;
+            uint64_t offset;
+            size_t size;
+            std::optional<Expected<Bytes>> result;
+
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                IoPool* owner = &pool;
+                std::call_once(pool.started, [owner]() {
+                    for (int i = 0; i < ASSET_IO_THREADS; i++)
+                        owner->threads.emplace_back([owner]() { owner->run(); });
+                });
+                {
+                    std::lock_guard<std::mutex> guard(pool.lock);
+                    pool.requests.push_back({ path, offset, size, &result, handle });
+                }
+                pool.ready.notify_one();
+            }
+            Expected<Bytes> await_resume() { return std::move(*result); }
+        };
+        return Awaiter{ *this, std::move(path), offset, size, std::nullopt };
+    }
+};
+
+inline IoPool ioPool;
+
+// Starts a root task and runs render-thread continuations and jobs on the
+// calling (render) thread until it has finished
+template <class T>
+T runUntilDone(Task<T>& task)
+{
+    task.start();
+    while (!task.done())
+        if (!renderThread.pump() && !jobSystem.help())
+            std::this_thread::yield();
+    return task.result();
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+// Runtime side of the assets written by tools/asset_baker.cpp. The viewer
+// reads only these; parsing OBJ files and decoding PNG/JPG happens offline.
+//
+// .mesh: BakedMeshHeader | BakedLod[lodCount] | BakedVertex[vertexCount] |
+//        indices (indexSize bytes each)
+//   Vertices are welded and ordered by first use, positions quantized to 16
+//   bits over the bounding box and texture coordinates over their range.
+//   Triangles are ordered for the post-transform vertex cache; every LOD is
+//   a range of the index buffer over the same vertices, LOD 0 the full mesh.
+// .tex:  BakedTextureHeader | BakedLevel[levels] | level data
+//   A full mip chain of BC1 (opaque) or BC3 blocks, rows bottom-up as GL
+//   expects them.
+// .vtex: VirtualTextureHeader | VirtualTile[tileCount] | tile data
+//   A virtual texture (virtual_texture.h): a square power-of-two mip chain
+//   cut into pages of VIRTUAL_PAGE_SIZE texels, down to the level one page
+//   covers. Each tile is a page plus a border of VIRTUAL_PAGE_BORDER texels
+//   copied from its neighbours (wrapping), so it filters on its own, as
+//   BC1/BC3 blocks, LZ4-compressed when that pays. Tiles are listed level by
+//   level, rows of pages bottom-up; a page is read on its own, with a ranged
+//   read.
+// All headers start with the hash of the source file, so the baker can skip
+// outputs that are up to date.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "assets.h"
+
+#define BAKED_MESH_MAGIC 0x4853454Du // "MESH"
+#define BAKED_TEXTURE_MAGIC 0x33584554u // "TEX3"
+#define BAKED_VERSION 1
+#define BAKED_MAX_LODS 4
+#define VIRTUAL_TEXTURE_MAGIC 0x58455456u // "VTEX"
+#define VIRTUAL_PAGE_SIZE 128 // texels of a page along each side, border excluded
+#define VIRTUAL_PAGE_BORDER 4 // texels on each side; a multiple of the block size
+#define VIRTUAL_MAX_PAGES 256 // along each side of level 0: page table entries are 8 bits
+
+enum BakedTextureFormat : uint32_t
+{
+    BAKED_BC1 = 1,
+    BAKED_BC3 = 2
+};
+
+struct BakedMeshHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t lodCount;
+    uint32_t indexSize; // 2 or 4
+    float low[3], high[3]; // position quantization box
+    float uvLow[2], uvHigh[2];
+    float sphere[4]; // center, radius of the dequantized positions
+};
+
+struct BakedLod
+{
+    uint32_t first, count; // index range
+    float error; // largest vertex displacement, in model units
+    uint32_t reserved;
+};
+
+struct BakedVertex
+{
+    uint16_t position[3];
+    uint16_t uv[2];
+    uint16_t pad;
+};
+
+struct BakedTextureHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t width, height;
+    uint32_t levels;
+    uint32_t format;
+};
+
+struct BakedLevel
+{
+    uint32_t width, height;
+    uint64_t offset, size; // from the start of the file
+};
+
+struct VirtualTextureHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t size; // texels along each side of level 0
+    uint32_t levels;
+    uint32_t format;
+    uint32_t pageSize, border;
+    uint32_t tileCount;
+};
+
+struct VirtualTile
+{
+    uint64_t offset; // from the start of the file
+    uint32_t size; // stored bytes
+    uint32_t compressed; // 1: LZ4 block, else the blocks as they are
+};
+
+static_assert(sizeof(BakedMeshHeader) == 88 && sizeof(BakedLod) == 16 && sizeof(BakedVertex) == 12 &&
+              sizeof(BakedTextureHeader) == 32 && sizeof(BakedLevel) == 24 && sizeof(VirtualTextureHeader) == 40 &&
+              sizeof(VirtualTile) == 16, "baked layout");
+
+struct MeshLod
+{
+    uint32_t first, count;
+    float error;
+};
+
+// CPU side of a model: interleaved x, y, z, u, v, indices and their LODs
+struct MeshData
+{
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<MeshLod> lods;
+    float sphere[4];
+    uint64_t sourceHash; // identifies the content
+};
+
+struct TextureLevel
+{
+    uint32_t width, height;
+    std::vector<unsigned char> data;
+};
+
+struct TextureData
+{
+    uint32_t format; // BakedTextureFormat, or 0 once decoded to RGBA8
+    std::vector<TextureLevel> levels;
+    uint64_t sourceHash; // identifies the content
+};
+
+inline float dequantize(uint16_t value, float low, float high)
+{
+    return low + (high - low) * (float(value) * (1.0f / 65535.0f));
+}
+
+// Header of a baked file, if it is one, for the up-to-date check
+inline bool readBakedHash(const std::vector<unsigned char>& bytes, uint32_t magic, uint64_t& hash)
+{
+    uint32_t fields[2];
+    if (bytes.size() < 16)
+        return false;
+    std::memcpy(fields, bytes.data(), 8);
+    std::memcpy(&hash, bytes.data() + 8, 8);
+    return fields[0] == magic && fields[1] == BAKED_VERSION;
+}
+
+inline Expected<MeshData> readBakedMesh(const std::vector<unsigned char>& bytes, const std::string& name)
+{
+    AssetError invalid{ "Malla precompilada no valida: " + name };
+    BakedMeshHeader header;
+    if (bytes.size() < sizeof(header))
+        return invalid;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    size_t lodsAt = sizeof(header), verticesAt = lodsAt + size_t(header.lodCount) * sizeof(BakedLod);
+    size_t indicesAt = verticesAt + size_t(header.vertexCount) * sizeof(BakedVertex);
+    if (header.magic != BAKED_MESH_MAGIC || header.version != BAKED_VERSION || (header.indexSize != 2 && header.indexSize != 4) ||
+        header.lodCount == 0 || header.lodCount > BAKED_MAX_LODS || indicesAt > bytes.size() ||
+        (bytes.size() - indicesAt) / header.indexSize < header.indexCount)
+        return invalid;
+
+    MeshData mesh;
+    std::memcpy(mesh.sphere, header.sphere, sizeof(mesh.sphere));
+    mesh.sourceHash = header.sourceHash;
+    for (uint32_t l = 0; l < header.lodCount; l++)
+    {
+        BakedLod lod;
+        std::memcpy(&lod, &bytes[lodsAt + l * sizeof(BakedLod)], sizeof(lod));
+        if (lod.first > header.indexCount || lod.count > header.indexCount - lod.first)
+            return invalid;
+        // LOD 0 first, each coarser one after the finer: the element buffer
+        // drops the finest from the front when demoted
+        if (l == 0 ? lod.first != 0 : lod.first < mesh.lods.back().first + mesh.lods.back().count)
+            return invalid;
+        mesh.lods.push_back({ lod.first, lod.count, lod.error });
+    }
+
+    mesh.vertices.resize(size_t(header.vertexCount) * 5);
+    for (uint32_t v = 0; v < header.vertexCount; v++)
+    {
+        BakedVertex vertex;
+        std::memcpy(&vertex, &bytes[verticesAt + v * sizeof(BakedVertex)], sizeof(vertex));
+        float* out = &mesh.vertices[size_t(v) * 5];
+        for (int a = 0; a < 3; a++)
+            out[a] = dequantize(vertex.position[a], header.low[a], header.high[a]);
+        for (int a = 0; a < 2; a++)
+            out[3 + a] = dequantize(vertex.uv[a], header.uvLow[a], header.uvHigh[a]);
+    }
+
+    mesh.indices.resize(header.indexCount);
+    const unsigned char* indices = &bytes[indicesAt];
+    for (uint32_t i = 0; i < header.indexCount; i++)
+    {
+        uint32_t index = 0;
+        std::memcpy(&index, indices + size_t(i) * header.indexSize, header.indexSize);
+        if (index >= header.vertexCount)
+            return invalid;
+        mesh.indices[i] = index;
+    }
+    return mesh;
+}
+
+inline Expected<TextureData> readBakedTexture(const std::vector<unsigned char>& bytes, const std::string& name)
+{
+    AssetError invalid{ "Textura precompilada no valida: " + name };
+    BakedTextureHeader header;
+    if (bytes.size() < sizeof(header))
+        return invalid;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != BAKED_TEXTURE_MAGIC || header.version != BAKED_VERSION || (header.format != BAKED_BC1 && header.format != BAKED_BC3) ||
+        header.levels == 0 || header.levels > 32 || (bytes.size() - sizeof(header)) / sizeof(BakedLevel) < header.levels)
+        return invalid;
+
+    TextureData texture;
+    texture.format = header.format;
+    texture.sourceHash = header.sourceHash;
+    size_t blockBytes = header.format == BAKED_BC1 ? 8 : 16;
+    for (uint32_t l = 0; l < header.levels; l++)
+    {
+        BakedLevel level;
+        std::memcpy(&level, &bytes[sizeof(header) + l * sizeof(BakedLevel)], sizeof(level));
+        size_t expected = size_t((level.width + 3) / 4) * ((level.height + 3) / 4) * blockBytes;
+        if (level.size != expected || level.offset > bytes.size() || level.size > bytes.size() - level.offset)
+            return invalid;
+        texture.levels.push_back({ level.width, level.height, std::vector<unsigned char>(bytes.begin() + ptrdiff_t(level.offset),
+                                                                                           bytes.begin() + ptrdiff_t(level.offset + level.size)) });
+    }
+    return texture;
+}
+
+// Pages along each side of a level of a virtual texture
+inline uint32_t virtualPages(const VirtualTextureHeader& header, uint32_t level)
+{
+    return std::max(1u, (header.size / header.pageSize) >> level);
+}
+
+// Bytes of one tile once decompressed: the page and its border in blocks
+inline size_t virtualTileBytes(const VirtualTextureHeader& header)
+{
+    size_t blocks = (header.pageSize + 2 * header.border) / 4;
+    return blocks * blocks * (header.format == BAKED_BC1 ? 8 : 16);
+}
+
+// Checks a virtual texture header against the layout this build reads
+inline Expected<VirtualTextureHeader> readVirtualTextureHeader(const std::vector<unsigned char>& bytes, const std::string& name)
+{
+    AssetError invalid{ "Textura virtual no valida: " + name };
+    VirtualTextureHeader header;
+    if (bytes.size() < sizeof(header))
+        return invalid;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != VIRTUAL_TEXTURE_MAGIC || header.version != BAKED_VERSION || (header.format != BAKED_BC1 && header.format != BAKED_BC3) ||
+        header.pageSize != VIRTUAL_PAGE_SIZE || header.border != VIRTUAL_PAGE_BORDER || header.size < header.pageSize ||
+        (header.size & (header.size - 1)) != 0 || header.size / header.pageSize > VIRTUAL_MAX_PAGES || header.levels == 0 ||
+        virtualPages(header, header.levels - 1) != 1 || (header.levels > 1 && virtualPages(header, header.levels - 2) == 1))
+        return invalid;
+    uint32_t tiles = 0;
+    for (uint32_t l = 0; l < header.levels; l++)
+        tiles += virtualPages(header, l) * virtualPages(header, l);
+    if (tiles != header.tileCount)
+        return invalid;
+    return header;
+}
+
+// 5:6:5 to 8 bits per channel
+inline void expand565(uint16_t color, unsigned char* rgb)
+{
+    unsigned r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+    rgb[0] = (unsigned char)(r << 3 | r >> 2);
+    rgb[1] = (unsigned char)(g << 2 | g >> 4);
+    rgb[2] = (unsigned char)(b << 3 | b >> 2);
+}
+
+// One BC1/BC3 block to 4x4 RGBA8 texels, rows of stride bytes
+inline void decodeBlock(uint32_t format, const unsigned char* block, unsigned char* out, size_t stride, int columns, int rows)
+{
+    unsigned char alpha[16];
+    std::fill(alpha, alpha + 16, (unsigned char)255);
+    if (format == BAKED_BC3)
+    {
+        unsigned a0 = block[0], a1 = block[1];
+        unsigned char palette[8] = { (unsigned char)a0, (unsigned char)a1 };
+        for (int k = 1; k < 7 && a0 > a1; k++)
+            palette[k + 1] = (unsigned char)(((7 - k) * a0 + k * a1) / 7);
+        for (int k = 1; k < 5 && a0 <= a1; k++)
+            palette[k + 1] = (unsigned char)(((5 - k) * a0 + k * a1) / 5);
+        if (a0 <= a1)
+        {
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        uint64_t bits = 0;
+        std::memcpy(&bits, block + 2, 6);
+        for (int p = 0; p < 16; p++)
+            alpha[p] = palette[bits >> (3 * p) & 7];
+        block += 8;
+    }
+
+    uint16_t c0, c1;
+    uint32_t bits;
+    std::memcpy(&c0, block, 2);
+    std::memcpy(&c1, block + 2, 2);
+    std::memcpy(&bits, block + 4, 4);
+    unsigned char palette[4][4];
+    expand565(c0, palette[0]);
+    expand565(c1, palette[1]);
+    bool fourColors = c0 > c1 || format == BAKED_BC3;
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (unsigned char)(fourColors ? (2 * palette[0][c] + palette[1][c]) / 3 : (palette[0][c] + palette[1][c]) / 2);
+        palette[3][c] = (unsigned char)(fourColors ? (palette[0][c] + 2 * palette[1][c]) / 3 : 0);
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = fourColors ? 255 : 0;
+
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < columns; x++)
+        {
+            int p = y * 4 + x;
+            unsigned char* texel = out + y * stride + x * 4;
+            std::memcpy(texel, palette[bits >> (2 * p) & 3], 4);
+            if (format == BAKED_BC3)
+                texel[3] = alpha[p];
+        }
+}
+
+// RGBA8 copy of every level, for drivers without S3TC and for the CPU
+// renderers
+inline void decodeTexture(TextureData& texture)
+{
+    if (texture.format == 0)
+        return;
+    size_t blockBytes = texture.format == BAKED_BC1 ? 8 : 16;
+    for (TextureLevel& level : texture.levels)
+    {
+        std::vector<unsigned char> rgba(size_t(level.width) * level.height * 4);
+        uint32_t blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+        for (uint32_t by = 0; by < blocksHigh; by++)
+            for (uint32_t bx = 0; bx < blocksWide; bx++)
+                decodeBlock(texture.format, &level.data[(size_t(by) * blocksWide + bx) * blockBytes],
+                            &rgba[(size_t(by) * 4 * level.width + bx * 4) * 4], size_t(level.width) * 4,
+                            int(std::min<uint32_t>(4, level.width - bx * 4)), int(std::min<uint32_t>(4, level.height - by * 4)));
+        level.data = std::move(rgba);
+    }
+    texture.format = 0;
+}
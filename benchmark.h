@@ -0,0 +1,287 @@
+#pragma once
+
+// Deterministic camera-path benchmark. A path is a list of keyframes (geometry
+// mode + camera position/center); the runner interpolates it over a fixed
+// number of frames so two runs of the same build see exactly the same views.
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+
+#define BENCHMARK_SCHEMA 2
+#define BENCHMARK_WARMUP_FRAMES 16
+
+struct CameraKeyframe
+{
+    int mode;
+    glm::vec3 position;
+    glm::vec3 center;
+};
+
+struct RenderStats
+{
+    size_t draws = 0;
+    size_t triangles = 0;
+    size_t cells = 0; // honeycomb cells, torus copies or portal views drawn
+};
+
+// Per-frame counters, filled by Model::draw and the scene traversal
+inline RenderStats renderStats;
+
+class CameraPath
+{
+    std::vector<CameraKeyframe> keyframes;
+    std::string name;
+
+public:
+    // Orbit around the house in Euclidean space, then walk away from it in S3
+    // until the antipodal copy fills the view, repeat that walk in elliptic
+    // space, walk through the H3 honeycomb, fly diagonally across the 3-torus
+    // box copies, then walk up to the portal corridor.
+    static CameraPath defaultPath()
+    {
+        CameraPath path;
+        path.name = "default";
+        const int orbitSteps = 8;
+        for (int i = 0; i <= orbitSteps; i++)
+        {
+            float angle = 2.0f * 3.14159265f * i / orbitSteps;
+            path.keyframes.push_back({ 0, glm::vec3(std::sin(angle) * 60.0f, 10.0f, std::cos(angle) * 60.0f), glm::vec3(0.0f) });
+        }
+        for (int i = 0; i <= orbitSteps; i++)
+        {
+            float z = 5.0f + 70.0f * i;
+            path.keyframes.push_back({ 1, glm::vec3(0.0f, 0.0f, z), glm::vec3(0.0f, 0.0f, z - 5.0f) });
+        }
+        for (int i = 0; i <= orbitSteps; i++)
+        {
+            float z = 5.0f + 70.0f * i;
+            path.keyframes.push_back({ 3, glm::vec3(0.0f, 0.0f, z), glm::vec3(0.0f, 0.0f, z - 5.0f) });
+        }
+        for (int i = 0; i <= orbitSteps; i++)
+        {
+            float z = 5.0f + 40.0f * i;
+            path.keyframes.push_back({ 2, glm::vec3(0.0f, 0.0f, z), glm::vec3(0.0f, 0.0f, z - 5.0f) });
+        }
+        for (int i = 0; i <= orbitSteps; i++)
+        {
+            glm::vec3 position = glm::vec3(30.0f, 20.0f, 60.0f) * float(i);
+            path.keyframes.push_back({ 4, position, position - glm::vec3(3.0f, 2.0f, 6.0f) });
+        }
+        for (int i = 0; i <= orbitSteps; i++)
+        {
+            float z = 80.0f - 7.0f * i;
+            glm::vec3 position(4.0f * std::sin(0.5f * i), 1.0f, z);
+            path.keyframes.push_back({ 5, position, position - glm::vec3(0.0f, 0.0f, 5.0f) });
+        }
+        return path;
+    }
+
+    // One keyframe per line: "mode px py pz cx cy cz", '#' starts a comment;
+    // false for a mode that is not a SpaceMode
+    static bool load(const std::string& fileName, CameraPath& path)
+    {
+        std::ifstream file(fileName);
+        if (!file)
+            return false;
+
+        path.name = fileName;
+        path.keyframes.clear();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream in(line);
+            CameraKeyframe key;
+            if (!(in >> key.mode >> key.position.x >> key.position.y >> key.position.z >> key.center.x >> key.center.y >> key.center.z))
+                continue;
+            if (key.mode < 0 || key.mode >= SPACE_MODE_COUNT)
+            {
+                std::cerr << "Modo de geometria no valido en el recorrido: " << line << std::endl;
+                return false;
+            }
+            path.keyframes.push_back(key);
+        }
+        return path.keyframes.size() >= 2;
+    }
+
+    // t in [0, 1] across the whole path; the mode is held for each segment
+    CameraKeyframe sample(float t) const
+    {
+        float f = std::clamp(t, 0.0f, 1.0f) * (keyframes.size() - 1);
+        size_t i = std::min(size_t(f), keyframes.size() - 2);
+        float local = f - i;
+        const CameraKeyframe& a = keyframes[i];
+        const CameraKeyframe& b = keyframes[i + 1];
+        return { a.mode, glm::mix(a.position, b.position, local), glm::mix(a.center, b.center, local) };
+    }
+
+    const std::string& getName() const
+    {
+        return name;
+    }
+};
+
+struct FrameSample
+{
+    int mode;
+    double cpuMs;
+    double gpuMs;
+    size_t draws;
+    size_t triangles;
+    size_t cells;
+};
+
+// Text as a quoted JSON string: scene paths and driver strings may hold
+// quotes, backslashes or control characters
+inline std::string jsonString(const char* text)
+{
+    std::string quoted = "\"";
+    for (const char* c = text ? text : ""; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            quoted += '\\';
+        if ((unsigned char)*c < 0x20)
+        {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", (unsigned char)*c);
+            quoted += code;
+        }
+        else
+            quoted += *c;
+    }
+    return quoted + '"';
+}
+
+class Benchmark
+{
+    CameraPath path;
+    int frames;
+    std::vector<FrameSample> samples;
+
+    static void writeTimes(std::ostream& os, std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (double v : values)
+            sum += v;
+        // nearest-rank percentile
+        auto percentile = [&](double p) {
+            size_t rank = size_t(std::ceil(p * values.size()));
+            return values[std::clamp(rank, size_t(1), values.size()) - 1];
+        };
+        os << "{ \"min\": " << values.front()
+           << ", \"avg\": " << sum / values.size()
+           << ", \"p50\": " << percentile(0.50)
+           << ", \"p95\": " << percentile(0.95)
+           << ", \"p99\": " << percentile(0.99)
+           << ", \"max\": " << values.back() << " }";
+    }
+
+    void writeGroup(std::ostream& os, const char* label, int mode) const
+    {
+        std::vector<double> cpu, gpu;
+        double draws = 0.0, triangles = 0.0, cells = 0.0;
+        for (const FrameSample& s : samples)
+        {
+            if (mode >= 0 && s.mode != mode)
+                continue;
+            cpu.push_back(s.cpuMs);
+            gpu.push_back(s.gpuMs);
+            draws += s.draws;
+            triangles += s.triangles;
+            cells += s.cells;
+        }
+        if (cpu.empty())
+            return;
+
+        os << ",\n  \"" << label << "\": {\n    \"frames\": " << cpu.size() << ",\n    \"cpu_frame_ms\": ";
+        writeTimes(os, cpu);
+        os << ",\n    \"gpu_frame_ms\": ";
+        writeTimes(os, gpu);
+        os << ",\n    \"draws_per_frame\": " << draws / cpu.size()
+           << ",\n    \"triangles_per_frame\": " << triangles / cpu.size()
+           << ",\n    \"cells_per_frame\": " << cells / cpu.size() << "\n  }";
+    }
+
+public:
+    Benchmark(const CameraPath& _path, int _frames) :
+        path(_path), frames(std::max(_frames, 2))
+    {
+    }
+
+    // applyCamera sets mode and camera for a keyframe, renderFrame submits one
+    // frame and present swaps it. GPU times come from one GL_TIME_ELAPSED query
+    // per frame, read back only after the run so the loop never waits on them.
+    void run(const std::function<void(const CameraKeyframe&)>& applyCamera, const std::function<void()>& renderFrame, const std::function<void()>& present)
+    {
+        // Warm up over the whole path so every program and mode is hot
+        for (int i = 0; i < BENCHMARK_WARMUP_FRAMES; i++)
+        {
+            applyCamera(path.sample(float(i) / (BENCHMARK_WARMUP_FRAMES - 1)));
+            renderFrame();
+            present();
+        }
+        glFinish();
+
+        std::vector<GLuint> queries(frames);
+        glGenQueries(frames, queries.data());
+        samples.assign(frames, FrameSample());
+
+        for (int i = 0; i < frames; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            CameraKeyframe key = path.sample(float(i) / (frames - 1));
+            renderStats = RenderStats();
+
+            glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+            applyCamera(key);
+            renderFrame();
+            glEndQuery(GL_TIME_ELAPSED);
+            present();
+
+            samples[i].mode = key.mode;
+            samples[i].draws = renderStats.draws;
+            samples[i].triangles = renderStats.triangles;
+            samples[i].cells = renderStats.cells;
+            samples[i].cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        for (int i = 0; i < frames; i++)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+            samples[i].gpuMs = elapsed / 1.0e6;
+        }
+        glDeleteQueries(frames, queries.data());
+    }
+
+    void writeJson(std::ostream& os) const
+    {
+        os << "{\n  \"schema\": " << BENCHMARK_SCHEMA
+           << ",\n  \"path\": " << jsonString(path.getName().c_str())
+           << ",\n  \"frames\": " << frames
+           << ",\n  \"renderer\": " << jsonString((const char*)glGetString(GL_RENDERER))
+           << ",\n  \"gl_version\": " << jsonString((const char*)glGetString(GL_VERSION));
+        writeGroup(os, "all", -1);
+        writeGroup(os, "euclidean", 0);
+        writeGroup(os, "spherical", 1);
+        writeGroup(os, "hyperbolic", 2);
+        writeGroup(os, "elliptic", 3);
+        writeGroup(os, "torus", 4);
+        writeGroup(os, "portals", 5);
+        os << "\n}\n";
+    }
+};
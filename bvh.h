@@ -0,0 +1,712 @@
+#pragma once
+
+// Bounding volume hierarchy over axis-aligned boxes (the scene's objects),
+// built top-down with the binned surface area heuristic. Nodes are 32 bytes,
+// stored depth first so a node's left child is the next node and only the
+// right child's index is kept; every node's items are a contiguous range of
+// the item order. Moving items refit their path to the root instead of
+// rebuilding.
+//
+// Queries take a batch: sphere and ray queries go down the tree together
+// with a bit mask of the ones still active in each node, so the upper levels
+// are fetched once per batch of 64 instead of once per query.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <istream>
+#include <random>
+#include <vector>
+
+#include "frustum.h"
+#include "jobs.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF 8
+#define BVH_BATCH 64 // queries per traversal (bits in the active mask)
+#define BVH_SAH_DEPTH 48 // deeper nodes split at the median, so depth stays under BVH_STACK
+#define BVH_STACK 128
+#define BVH_PARALLEL_ITEMS 8192 // smallest range split into two jobs
+
+class Bvh
+{
+public:
+    struct Box
+    {
+        glm::vec3 low, high;
+
+        static Box fromSphere(const glm::vec4& sphere)
+        {
+            return { glm::vec3(sphere) - sphere.w, glm::vec3(sphere) + sphere.w };
+        }
+
+        void grow(const Box& b)
+        {
+            low = glm::min(low, b.low);
+            high = glm::max(high, b.high);
+        }
+
+        float area() const
+        {
+            glm::vec3 d = glm::max(high - low, glm::vec3(0.0f));
+            return d.x * d.y + d.y * d.z + d.z * d.x;
+        }
+    };
+
+    struct Ray
+    {
+        glm::vec3 origin, direction;
+        float tMax;
+    };
+
+    struct Hit
+    {
+        float t; // tMax if nothing was hit
+        uint32_t item; // UINT32_MAX if nothing was hit
+    };
+
+private:
+    struct Node
+    {
+        glm::vec3 low;
+        uint32_t start; // leaf: first entry in order; interior: right child
+        glm::vec3 high;
+        uint16_t count; // items in a leaf, 0 for interior nodes
+        uint16_t axis; // split axis, for front-to-back ray traversal
+    };
+
+    // Nodes of one subtree, with indices relative to its root while it is
+    // built by its own job
+    struct Tree
+    {
+        std::vector<Node> nodes;
+        std::vector<uint32_t> parents;
+        size_t depth = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order; // items, grouped by leaf
+    std::vector<Box> boxes; // by item
+    std::vector<uint32_t> parents; // by node
+    std::vector<uint32_t> leafOf; // by item
+    size_t depth = 0;
+
+    static int lowestBit(uint64_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return int(index);
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+
+    static Box empty()
+    {
+        float inf = std::numeric_limits<float>::infinity();
+        return { glm::vec3(inf), glm::vec3(-inf) };
+    }
+
+    void makeLeaf(Tree& tree, uint32_t index, uint32_t begin, uint32_t end)
+    {
+        tree.nodes[index].start = begin;
+        tree.nodes[index].count = uint16_t(end - begin);
+        for (uint32_t i = begin; i < end; i++)
+            leafOf[order[i]] = index;
+    }
+
+    // Appends a subtree built on its own below parent, fixing its indices
+    void splice(Tree& tree, uint32_t parent, const Tree& sub, uint32_t begin, uint32_t end)
+    {
+        uint32_t offset = uint32_t(tree.nodes.size());
+        for (Node node : sub.nodes)
+        {
+            if (!node.count)
+                node.start += offset;
+            tree.nodes.push_back(node);
+        }
+        for (uint32_t p : sub.parents)
+            tree.parents.push_back(p == UINT32_MAX ? parent : p + offset);
+        for (uint32_t i = begin; i < end; i++)
+            leafOf[order[i]] += offset;
+        tree.depth = std::max(tree.depth, sub.depth);
+    }
+
+    // Splits items [begin, end) under node index of tree. While
+    // parallelLevels > 0 the two halves of large ranges are built as two
+    // jobs; they touch disjoint parts of order and leafOf.
+    void subdivide(Tree& tree, uint32_t index, uint32_t begin, uint32_t end, size_t level, int parallelLevels)
+    {
+        tree.depth = std::max(tree.depth, level);
+        Box bounds = empty(), centroids = empty();
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const Box& box = boxes[order[i]];
+            bounds.grow(box);
+            glm::vec3 c = (box.low + box.high) * 0.5f;
+            centroids.grow({ c, c });
+        }
+        tree.nodes[index].low = bounds.low;
+        tree.nodes[index].high = bounds.high;
+        tree.nodes[index].axis = 0;
+
+        uint32_t count = end - begin;
+        if (count <= 2)
+        {
+            makeLeaf(tree, index, begin, end);
+            return;
+        }
+
+        // Binned SAH: cost of each split plane between bins, per axis
+        float bestCost = std::numeric_limits<float>::infinity();
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float low = centroids.low[axis], extent = centroids.high[axis] - low;
+            if (extent <= 0.0f)
+                continue;
+            Box binBounds[BVH_BINS];
+            uint32_t binCount[BVH_BINS] = {};
+            for (Box& b : binBounds)
+                b = empty();
+            float toBin = BVH_BINS / extent;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const Box& box = boxes[order[i]];
+                int bin = std::min(BVH_BINS - 1, int(((box.low[axis] + box.high[axis]) * 0.5f - low) * toBin));
+                binBounds[bin].grow(box);
+                binCount[bin]++;
+            }
+
+            float rightArea[BVH_BINS];
+            uint32_t rightCount[BVH_BINS];
+            Box right = empty();
+            uint32_t n = 0;
+            for (int bin = BVH_BINS - 1; bin > 0; bin--)
+            {
+                right.grow(binBounds[bin]);
+                n += binCount[bin];
+                rightArea[bin] = right.area();
+                rightCount[bin] = n;
+            }
+            Box left = empty();
+            n = 0;
+            for (int bin = 1; bin < BVH_BINS; bin++)
+            {
+                left.grow(binBounds[bin - 1]);
+                n += binCount[bin - 1];
+                if (n == 0 || rightCount[bin] == 0)
+                    continue;
+                float cost = left.area() * n + rightArea[bin] * rightCount[bin];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = bin;
+                }
+            }
+        }
+
+        // Leaf when splitting costs more than intersecting everything here
+        // (traversal cost ~ one item test)
+        if (count <= BVH_MAX_LEAF && (bestAxis < 0 || bestCost + bounds.area() >= bounds.area() * count))
+        {
+            makeLeaf(tree, index, begin, end);
+            return;
+        }
+
+        uint32_t middle;
+        if (level >= BVH_SAH_DEPTH || bestAxis < 0)
+        {
+            // Median of the widest centroid axis (or any halving if all
+            // centroids coincide)
+            glm::vec3 extent = centroids.high - centroids.low;
+            bestAxis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+            middle = begin + count / 2;
+            std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) {
+                return boxes[a].low[bestAxis] + boxes[a].high[bestAxis] < boxes[b].low[bestAxis] + boxes[b].high[bestAxis];
+            });
+        }
+        else
+        {
+            float low = centroids.low[bestAxis], toBin = BVH_BINS / (centroids.high[bestAxis] - low);
+            middle = uint32_t(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t item) {
+                const Box& box = boxes[item];
+                int bin = std::min(BVH_BINS - 1, int(((box.low[bestAxis] + box.high[bestAxis]) * 0.5f - low) * toBin));
+                return bin < bestBin;
+            }) - order.begin());
+        }
+
+        tree.nodes[index].axis = uint16_t(bestAxis);
+        tree.nodes[index].count = 0;
+        if (parallelLevels > 0 && count >= BVH_PARALLEL_ITEMS)
+        {
+            Tree left, right;
+            left.nodes.push_back(Node());
+            left.parents.push_back(UINT32_MAX);
+            right.nodes.push_back(Node());
+            right.parents.push_back(UINT32_MAX);
+            JobSystem::Counter done;
+            jobSystem.spawn([&]() { subdivide(right, 0, middle, end, level + 1, parallelLevels - 1); }, &done);
+            subdivide(left, 0, begin, middle, level + 1, parallelLevels - 1);
+            jobSystem.wait(done);
+            splice(tree, index, left, begin, middle);
+            tree.nodes[index].start = uint32_t(tree.nodes.size());
+            splice(tree, index, right, middle, end);
+            return;
+        }
+        uint32_t leftChild = uint32_t(tree.nodes.size());
+        tree.nodes.push_back(Node());
+        tree.parents.push_back(index);
+        subdivide(tree, leftChild, begin, middle, level + 1, 0);
+        uint32_t rightChild = uint32_t(tree.nodes.size());
+        tree.nodes[index].start = rightChild;
+        tree.nodes.push_back(Node());
+        tree.parents.push_back(index);
+        subdivide(tree, rightChild, middle, end, level + 1, 0);
+    }
+
+    // Recomputes one node from its children or items; false if unchanged
+    bool refitNode(uint32_t index)
+    {
+        Node& node = nodes[index];
+        Box bounds = empty();
+        if (node.count)
+        {
+            for (uint32_t i = node.start; i < node.start + node.count; i++)
+                bounds.grow(boxes[order[i]]);
+        }
+        else
+        {
+            bounds = { nodes[index + 1].low, nodes[index + 1].high };
+            bounds.grow({ nodes[node.start].low, nodes[node.start].high });
+        }
+        if (bounds.low == node.low && bounds.high == node.high)
+            return false;
+        node.low = bounds.low;
+        node.high = bounds.high;
+        return true;
+    }
+
+    static float sphereBoxDistance2(const glm::vec4& sphere, const glm::vec3& low, const glm::vec3& high)
+    {
+        glm::vec3 c(sphere);
+        glm::vec3 d = glm::max(glm::max(low - c, c - high), glm::vec3(0.0f));
+        return glm::dot(d, d);
+    }
+
+    // Entry distance of a ray into a box, or +inf if it misses before tMax
+    static float slab(const glm::vec3& origin, const glm::vec3& inverse, float tMax, const glm::vec3& low, const glm::vec3& high)
+    {
+        float t0 = 0.0f, t1 = tMax;
+        for (int a = 0; a < 3; a++)
+        {
+            float near = (low[a] - origin[a]) * inverse[a];
+            float far = (high[a] - origin[a]) * inverse[a];
+            if (near > far)
+                std::swap(near, far);
+            t0 = std::max(t0, near);
+            t1 = std::min(t1, far);
+        }
+        return t0 <= t1 ? t0 : std::numeric_limits<float>::infinity();
+    }
+
+public:
+    // parallel: build the top levels' subtrees as jobs, about one per core
+    void build(const std::vector<Box>& items, bool parallel = true)
+    {
+        boxes = items;
+        order.resize(boxes.size());
+        leafOf.assign(boxes.size(), 0);
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+
+        Tree tree;
+        int parallelLevels = 0;
+        for (size_t threads = parallel ? jobSystem.size() : 1; threads > 1; threads /= 2)
+            parallelLevels++;
+        if (!boxes.empty())
+        {
+            tree.nodes.reserve(2 * boxes.size());
+            tree.parents.reserve(2 * boxes.size());
+            tree.nodes.push_back(Node());
+            tree.parents.push_back(UINT32_MAX);
+            subdivide(tree, 0, 0, uint32_t(boxes.size()), 1, parallelLevels);
+        }
+        nodes = std::move(tree.nodes);
+        parents = std::move(tree.parents);
+        depth = tree.depth;
+    }
+
+    // Binary image of the built tree, for caching it on disk
+    void write(std::ostream& os) const
+    {
+        uint64_t sizes[3] = { nodes.size(), boxes.size(), depth };
+        os.write((const char*)sizes, sizeof(sizes));
+        os.write((const char*)nodes.data(), nodes.size() * sizeof(Node));
+        os.write((const char*)order.data(), order.size() * sizeof(uint32_t));
+        os.write((const char*)boxes.data(), boxes.size() * sizeof(Box));
+        os.write((const char*)parents.data(), parents.size() * sizeof(uint32_t));
+        os.write((const char*)leafOf.data(), leafOf.size() * sizeof(uint32_t));
+    }
+
+    bool read(std::istream& is)
+    {
+        uint64_t sizes[3];
+        if (!is.read((char*)sizes, sizeof(sizes)) || sizes[0] > 2 * sizes[1] + 1)
+            return false;
+        nodes.resize(sizes[0]);
+        parents.resize(sizes[0]);
+        order.resize(sizes[1]);
+        boxes.resize(sizes[1]);
+        leafOf.resize(sizes[1]);
+        depth = sizes[2];
+        is.read((char*)nodes.data(), nodes.size() * sizeof(Node));
+        is.read((char*)order.data(), order.size() * sizeof(uint32_t));
+        is.read((char*)boxes.data(), boxes.size() * sizeof(Box));
+        is.read((char*)parents.data(), parents.size() * sizeof(uint32_t));
+        is.read((char*)leafOf.data(), leafOf.size() * sizeof(uint32_t));
+        return bool(is);
+    }
+
+    // Moves one item, growing or shrinking its ancestors as far as needed
+    void update(uint32_t item, const Box& box)
+    {
+        boxes[item] = box;
+        for (uint32_t node = leafOf[item]; node != UINT32_MAX && refitNode(node); node = parents[node])
+            ;
+    }
+
+    // Refits every node after many items moved (children follow parents)
+    void refit()
+    {
+        for (size_t i = nodes.size(); i-- > 0;)
+            refitNode(uint32_t(i));
+    }
+
+    size_t size() const
+    {
+        return boxes.size();
+    }
+
+    size_t nodeCount() const
+    {
+        return nodes.size();
+    }
+
+    size_t getDepth() const
+    {
+        return depth;
+    }
+
+    // Items whose box intersects the frustum, in tree order
+    void frustum(const Frustum& frustum, std::vector<uint32_t>& out) const
+    {
+        out.clear();
+        if (nodes.empty())
+            return;
+        struct Entry
+        {
+            uint32_t node;
+            unsigned planes;
+        };
+        Entry stack[BVH_STACK];
+        int top = 0;
+        stack[top++] = { 0, 0x3Fu };
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node& node = nodes[entry.node];
+            if (entry.planes && !frustum.intersects(node.low, node.high, entry.planes))
+                continue;
+            if (node.count)
+            {
+                for (uint32_t i = node.start; i < node.start + node.count; i++)
+                {
+                    unsigned planes = entry.planes;
+                    const Box& box = boxes[order[i]];
+                    if (!planes || frustum.intersects(box.low, box.high, planes))
+                        out.push_back(order[i]);
+                }
+                continue;
+            }
+            stack[top++] = { node.start, entry.planes };
+            stack[top++] = { entry.node + 1, entry.planes };
+        }
+    }
+
+    // visit(query, item) for every item whose box a sphere (center xyz,
+    // radius w) touches
+    template <class Visit>
+    void spheres(const glm::vec4* queries, size_t count, const Visit& visit) const
+    {
+        if (nodes.empty())
+            return;
+        struct Entry
+        {
+            uint32_t node;
+            uint64_t active;
+        };
+        Entry stack[BVH_STACK];
+        for (size_t first = 0; first < count; first += BVH_BATCH)
+        {
+            size_t batch = std::min<size_t>(BVH_BATCH, count - first);
+            const glm::vec4* q = queries + first;
+            int top = 0;
+            stack[top++] = { 0, batch == 64 ? ~uint64_t(0) : (uint64_t(1) << batch) - 1 };
+            while (top > 0)
+            {
+                Entry entry = stack[--top];
+                const Node& node = nodes[entry.node];
+                uint64_t active = 0;
+                for (uint64_t bits = entry.active; bits; bits &= bits - 1)
+                {
+                    int k = lowestBit(bits);
+                    if (sphereBoxDistance2(q[k], node.low, node.high) <= q[k].w * q[k].w)
+                        active |= uint64_t(1) << k;
+                }
+                if (!active)
+                    continue;
+                if (node.count)
+                {
+                    for (uint32_t i = node.start; i < node.start + node.count; i++)
+                    {
+                        const Box& box = boxes[order[i]];
+                        for (uint64_t bits = active; bits; bits &= bits - 1)
+                        {
+                            int k = lowestBit(bits);
+                            if (sphereBoxDistance2(q[k], box.low, box.high) <= q[k].w * q[k].w)
+                                visit(first + k, order[i]);
+                        }
+                    }
+                    continue;
+                }
+                stack[top++] = { node.start, active };
+                stack[top++] = { entry.node + 1, active };
+            }
+        }
+    }
+
+    // Closest hit per ray. test(ray, item) returns the hit distance along the
+    // ray, or anything >= ray.tMax for a miss; boxes only prune.
+    template <class Test>
+    void rays(const Ray* queries, size_t count, Hit* hits, const Test& test) const
+    {
+        for (size_t i = 0; i < count; i++)
+            hits[i] = { queries[i].tMax, UINT32_MAX };
+        if (nodes.empty())
+            return;
+        struct Entry
+        {
+            uint32_t node;
+            uint64_t active;
+        };
+        Entry stack[BVH_STACK];
+        glm::vec3 inverse[BVH_BATCH];
+        for (size_t first = 0; first < count; first += BVH_BATCH)
+        {
+            size_t batch = std::min<size_t>(BVH_BATCH, count - first);
+            const Ray* r = queries + first;
+            Hit* h = hits + first;
+            for (size_t k = 0; k < batch; k++)
+                inverse[k] = 1.0f / r[k].direction;
+            int top = 0;
+            stack[top++] = { 0, batch == 64 ? ~uint64_t(0) : (uint64_t(1) << batch) - 1 };
+            while (top > 0)
+            {
+                Entry entry = stack[--top];
+                const Node& node = nodes[entry.node];
+                uint64_t active = 0;
+                for (uint64_t bits = entry.active; bits; bits &= bits - 1)
+                {
+                    int k = lowestBit(bits);
+                    if (slab(r[k].origin, inverse[k], h[k].t, node.low, node.high) < h[k].t)
+                        active |= uint64_t(1) << k;
+                }
+                if (!active)
+                    continue;
+                if (node.count)
+                {
+                    for (uint32_t i = node.start; i < node.start + node.count; i++)
+                        for (uint64_t bits = active; bits; bits &= bits - 1)
+                        {
+                            int k = lowestBit(bits);
+                            float t = test(r[k], order[i]);
+                            if (t < h[k].t)
+                                h[k] = { t, order[i] };
+                        }
+                    continue;
+                }
+                // Near child last so it is popped first, judged by the first
+                // active ray's direction on the split axis
+                int lead = lowestBit(active);
+                bool leftFirst = r[lead].direction[node.axis] >= 0.0f;
+                uint32_t left = entry.node + 1, right = node.start;
+                stack[top++] = { leftFirst ? right : left, active };
+                stack[top++] = { leftFirst ? left : right, active };
+            }
+        }
+    }
+};
+
+// Ray against a sphere (center xyz, radius w): entry distance, or +inf
+inline float raySphere(const Bvh::Ray& ray, const glm::vec4& sphere)
+{
+    glm::vec3 oc = ray.origin - glm::vec3(sphere);
+    float a = glm::dot(ray.direction, ray.direction);
+    float b = glm::dot(oc, ray.direction);
+    float c = glm::dot(oc, oc) - sphere.w * sphere.w;
+    float disc = b * b - a * c;
+    if (disc < 0.0f)
+        return std::numeric_limits<float>::infinity();
+    float t = (-b - std::sqrt(disc)) / a;
+    if (t < 0.0f)
+        t = (-b + std::sqrt(disc)) / a;
+    return t >= 0.0f ? t : std::numeric_limits<float>::infinity();
+}
+
+// CPU-only: build, refit and batched frustum, sphere and ray queries over
+// objects random spheres, against a linear scan on a sample (--bench-bvh)
+inline void benchmarkBvh(std::ostream& os, size_t objects)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto ms = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const float world = 2000.0f;
+    std::vector<glm::vec4> spheres(objects);
+    std::vector<Bvh::Box> boxes(objects);
+    for (size_t i = 0; i < objects; i++)
+    {
+        spheres[i] = glm::vec4(unit(random) * world, unit(random) * world, unit(random) * world, 0.5f + 4.5f * unit(random));
+        boxes[i] = Bvh::Box::fromSphere(spheres[i]);
+    }
+
+    Bvh bvh;
+    auto start = Clock::now();
+    bvh.build(boxes);
+    os << "BVH over " << objects << " objects: " << bvh.nodeCount() << " nodes, depth " << bvh.getDepth() << ", built in " << ms(start) << " ms\n";
+
+    // Move 1% of the objects a little, one path refit each
+    start = Clock::now();
+    size_t moved = objects / 100;
+    for (size_t i = 0; i < moved; i++)
+    {
+        size_t item = (i * 7919) % objects;
+        spheres[item] += glm::vec4(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f, 0.0f) * 10.0f;
+        bvh.update(uint32_t(item), Bvh::Box::fromSphere(spheres[item]));
+    }
+    os << "update " << moved << " objects: " << ms(start) << " ms";
+    start = Clock::now();
+    bvh.refit();
+    os << ", full refit: " << ms(start) << " ms\n";
+
+    size_t mismatches = 0;
+    const size_t sample = 16; // queries also answered by a linear scan
+
+    // Frustum: random views, 45 degrees, 300 units deep
+    const size_t views = 256;
+    std::vector<Frustum> frusta;
+    for (size_t i = 0; i < views; i++)
+    {
+        glm::vec3 eye(unit(random) * world, unit(random) * world, unit(random) * world);
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f));
+        frusta.push_back(Frustum(glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 300.0f) *
+                                 glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f))));
+    }
+    std::vector<uint32_t> visible;
+    size_t found = 0;
+    start = Clock::now();
+    for (const Frustum& frustum : frusta)
+    {
+        bvh.frustum(frustum, visible);
+        found += visible.size();
+    }
+    double bvhUs = ms(start) * 1000.0 / views;
+    start = Clock::now();
+    for (size_t i = 0; i < sample; i++)
+    {
+        size_t linear = 0;
+        for (size_t item = 0; item < objects; item++)
+        {
+            unsigned planes = 0x3Fu;
+            Bvh::Box box = Bvh::Box::fromSphere(spheres[item]);
+            linear += frusta[i].intersects(box.low, box.high, planes);
+        }
+        bvh.frustum(frusta[i], visible);
+        mismatches += linear != visible.size();
+    }
+    double linearUs = ms(start) * 1000.0 / sample;
+    os << "frustum: " << double(found) / views << " visible, " << bvhUs << " us/query (linear " << linearUs << " us)\n";
+
+    // Spheres: 4096 queries of radius 20, in batches
+    std::vector<glm::vec4> queries(4096);
+    for (glm::vec4& q : queries)
+        q = glm::vec4(unit(random) * world, unit(random) * world, unit(random) * world, 20.0f);
+    std::vector<size_t> overlaps(queries.size(), 0);
+    start = Clock::now();
+    bvh.spheres(queries.data(), queries.size(), [&](size_t query, uint32_t) { overlaps[query]++; });
+    bvhUs = ms(start) * 1000.0 / queries.size();
+    found = 0;
+    for (size_t n : overlaps)
+        found += n;
+    start = Clock::now();
+    for (size_t i = 0; i < sample; i++)
+    {
+        size_t linear = 0;
+        for (size_t item = 0; item < objects; item++)
+        {
+            Bvh::Box box = Bvh::Box::fromSphere(spheres[item]);
+            glm::vec3 c(queries[i]);
+            glm::vec3 d = glm::max(glm::max(box.low - c, c - box.high), glm::vec3(0.0f));
+            linear += glm::dot(d, d) <= queries[i].w * queries[i].w;
+        }
+        mismatches += linear != overlaps[i];
+    }
+    linearUs = ms(start) * 1000.0 / sample;
+    os << "spheres: " << double(found) / queries.size() << " overlaps, " << bvhUs << " us/query (linear " << linearUs << " us)\n";
+
+    // Rays: 4096 rays across the world, closest sphere
+    std::vector<Bvh::Ray> rays(4096);
+    for (Bvh::Ray& ray : rays)
+    {
+        glm::vec3 origin(unit(random) * world, unit(random) * world, unit(random) * world);
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f));
+        ray = { origin, direction, world };
+    }
+    std::vector<Bvh::Hit> hits(rays.size());
+    start = Clock::now();
+    bvh.rays(rays.data(), rays.size(), hits.data(), [&](const Bvh::Ray& ray, uint32_t item) { return raySphere(ray, spheres[item]); });
+    bvhUs = ms(start) * 1000.0 / rays.size();
+    found = 0;
+    for (const Bvh::Hit& hit : hits)
+        found += hit.item != UINT32_MAX;
+    start = Clock::now();
+    for (size_t i = 0; i < sample; i++)
+    {
+        Bvh::Hit linear = { rays[i].tMax, UINT32_MAX };
+        for (size_t item = 0; item < objects; item++)
+        {
+            float t = raySphere(rays[i], spheres[item]);
+            if (t < linear.t)
+                linear = { t, uint32_t(item) };
+        }
+        mismatches += linear.item != hits[i].item;
+    }
+    linearUs = ms(start) * 1000.0 / sample;
+    os << "rays: " << double(found) / rays.size() << " hit, " << bvhUs << " us/ray (linear " << linearUs << " us)\n";
+    os << (mismatches ? "MISMATCHES against the linear scan: " : "linear scan agrees on ") << (mismatches ? mismatches : 3 * sample)
+       << (mismatches ? "\n" : " queries\n");
+}
@@ -0,0 +1,561 @@
+#pragma once
+
+// Batch math for the curved models: port Euclidean points into S3/H3,
+// translate them, and measure geodesic distances to points or spheres. Data is
+// SoA (one array per coordinate) so each kernel processes a whole SIMD register
+// of points at a time. The kernels are written once against a small "pack"
+// interface (scalar, SSE2 x4, AVX2 x8); sin/cos, exp, log and acos use
+// Cephes-style polynomials so they vectorize.
+//
+// validateCurvedMath() compares every compiled kernel with a double-precision
+// reference and reports throughput (--validate-math).
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CURVED_MATH_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define CURVED_MATH_AVX2 1
+#include <immintrin.h>
+#endif
+
+enum CurvedGeometry
+{
+    CURVED_SPHERICAL,
+    CURVED_HYPERBOLIC
+};
+
+// Points of S3 (x^2+y^2+z^2+w^2 = 1) or H3 (x^2+y^2+z^2-w^2 = -1)
+struct CurvedPoints
+{
+    std::vector<float> x, y, z, w;
+
+    void resize(size_t n)
+    {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        w.resize(n);
+    }
+
+    size_t size() const
+    {
+        return x.size();
+    }
+};
+
+struct ScalarPack
+{
+    static const int width = 1;
+    typedef bool Mask;
+    float v;
+
+    static ScalarPack load(const float* p) { return { *p }; }
+    static ScalarPack set1(float s) { return { s }; }
+    static ScalarPack gather(const float* p, size_t) { return { *p }; }
+    void store(float* p) const { *p = v; }
+
+    friend ScalarPack operator+(ScalarPack a, ScalarPack b) { return { a.v + b.v }; }
+    friend ScalarPack operator-(ScalarPack a, ScalarPack b) { return { a.v - b.v }; }
+    friend ScalarPack operator*(ScalarPack a, ScalarPack b) { return { a.v * b.v }; }
+    friend ScalarPack operator/(ScalarPack a, ScalarPack b) { return { a.v / b.v }; }
+    friend Mask operator<(ScalarPack a, ScalarPack b) { return a.v < b.v; }
+    friend Mask operator>(ScalarPack a, ScalarPack b) { return a.v > b.v; }
+    friend Mask operator>=(ScalarPack a, ScalarPack b) { return a.v >= b.v; }
+    static int bits(Mask m) { return m ? 1 : 0; } // lane i -> bit i
+
+    static ScalarPack sqrt(ScalarPack a) { return { std::sqrt(a.v) }; }
+    static ScalarPack min(ScalarPack a, ScalarPack b) { return { std::min(a.v, b.v) }; }
+    static ScalarPack max(ScalarPack a, ScalarPack b) { return { std::max(a.v, b.v) }; }
+    static ScalarPack abs(ScalarPack a) { return { std::fabs(a.v) }; }
+    static ScalarPack select(Mask m, ScalarPack a, ScalarPack b) { return m ? a : b; }
+    static ScalarPack truncPositive(ScalarPack a) { return { float(int32_t(a.v)) }; }
+    static ScalarPack pow2(ScalarPack n) { return { std::ldexp(1.0f, int(n.v)) }; }
+
+    // x = m * 2^e with m in [0.5, 1), x > 0
+    static void frexp(ScalarPack x, ScalarPack& m, ScalarPack& e)
+    {
+        int exponent;
+        m.v = std::frexp(x.v, &exponent);
+        e.v = float(exponent);
+    }
+};
+
+#ifdef CURVED_MATH_SSE2
+struct Sse4Pack
+{
+    static const int width = 4;
+    typedef Sse4Pack Mask;
+    __m128 v;
+
+    static Sse4Pack load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static Sse4Pack set1(float s) { return { _mm_set1_ps(s) }; }
+    static Sse4Pack gather(const float* p, size_t stride) { return { _mm_set_ps(p[3 * stride], p[2 * stride], p[stride], p[0]) }; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    friend Sse4Pack operator+(Sse4Pack a, Sse4Pack b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend Sse4Pack operator-(Sse4Pack a, Sse4Pack b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend Sse4Pack operator*(Sse4Pack a, Sse4Pack b) { return { _mm_mul_ps(a.v, b.v) }; }
+    friend Sse4Pack operator/(Sse4Pack a, Sse4Pack b) { return { _mm_div_ps(a.v, b.v) }; }
+    friend Mask operator<(Sse4Pack a, Sse4Pack b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    friend Mask operator>(Sse4Pack a, Sse4Pack b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    friend Mask operator>=(Sse4Pack a, Sse4Pack b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+    friend Mask operator&(Sse4Pack a, Sse4Pack b) { return { _mm_and_ps(a.v, b.v) }; }
+    static int bits(Mask m) { return _mm_movemask_ps(m.v); }
+
+    static Sse4Pack sqrt(Sse4Pack a) { return { _mm_sqrt_ps(a.v) }; }
+    static Sse4Pack min(Sse4Pack a, Sse4Pack b) { return { _mm_min_ps(a.v, b.v) }; }
+    static Sse4Pack max(Sse4Pack a, Sse4Pack b) { return { _mm_max_ps(a.v, b.v) }; }
+    static Sse4Pack abs(Sse4Pack a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+    static Sse4Pack select(Mask m, Sse4Pack a, Sse4Pack b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+    static Sse4Pack truncPositive(Sse4Pack a) { return { _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v)) }; }
+
+    static Sse4Pack pow2(Sse4Pack n)
+    {
+        __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127)), 23);
+        return { _mm_castsi128_ps(bits) };
+    }
+
+    static void frexp(Sse4Pack x, Sse4Pack& m, Sse4Pack& e)
+    {
+        __m128i bits = _mm_castps_si128(x.v);
+        e.v = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+        m.v = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x807FFFFF)), _mm_set1_epi32(0x3F000000)));
+    }
+};
+#endif
+
+#ifdef CURVED_MATH_AVX2
+struct Avx8Pack
+{
+    static const int width = 8;
+    typedef Avx8Pack Mask;
+    __m256 v;
+
+    static Avx8Pack load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static Avx8Pack set1(float s) { return { _mm256_set1_ps(s) }; }
+    static Avx8Pack gather(const float* p, size_t stride)
+    {
+        return { _mm256_set_ps(p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride], p[3 * stride], p[2 * stride], p[stride], p[0]) };
+    }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    friend Avx8Pack operator+(Avx8Pack a, Avx8Pack b) { return { _mm256_add_ps(a.v, b.v) }; }
+    friend Avx8Pack operator-(Avx8Pack a, Avx8Pack b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    friend Avx8Pack operator*(Avx8Pack a, Avx8Pack b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    friend Avx8Pack operator/(Avx8Pack a, Avx8Pack b) { return { _mm256_div_ps(a.v, b.v) }; }
+    friend Mask operator<(Avx8Pack a, Avx8Pack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    friend Mask operator>(Avx8Pack a, Avx8Pack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    friend Mask operator>=(Avx8Pack a, Avx8Pack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    friend Mask operator&(Avx8Pack a, Avx8Pack b) { return { _mm256_and_ps(a.v, b.v) }; }
+    static int bits(Mask m) { return _mm256_movemask_ps(m.v); }
+
+    static Avx8Pack sqrt(Avx8Pack a) { return { _mm256_sqrt_ps(a.v) }; }
+    static Avx8Pack min(Avx8Pack a, Avx8Pack b) { return { _mm256_min_ps(a.v, b.v) }; }
+    static Avx8Pack max(Avx8Pack a, Avx8Pack b) { return { _mm256_max_ps(a.v, b.v) }; }
+    static Avx8Pack abs(Avx8Pack a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+    static Avx8Pack select(Mask m, Avx8Pack a, Avx8Pack b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+    static Avx8Pack truncPositive(Avx8Pack a) { return { _mm256_cvtepi32_ps(_mm256_cvttps_epi32(a.v)) }; }
+
+    static Avx8Pack pow2(Avx8Pack n)
+    {
+        __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127)), 23);
+        return { _mm256_castsi256_ps(bits) };
+    }
+
+    static void frexp(Avx8Pack x, Avx8Pack& m, Avx8Pack& e)
+    {
+        __m256i bits = _mm256_castps_si256(x.v);
+        e.v = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        m.v = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807FFFFF)), _mm256_set1_epi32(0x3F000000)));
+    }
+};
+#endif
+
+#if defined(CURVED_MATH_AVX2)
+typedef Avx8Pack BestPack;
+#elif defined(CURVED_MATH_SSE2)
+typedef Sse4Pack BestPack;
+#else
+typedef ScalarPack BestPack;
+#endif
+
+// Packed transcendental functions, valid for the ranges the kernels use
+
+template <class P>
+void packSinCosPositive(P x, P& s, P& c) // x >= 0
+{
+    const P half = P::set1(0.5f), one = P::set1(1.0f), two = P::set1(2.0f);
+    P j = P::truncPositive(x * P::set1(1.27323954473516f)); // 4/pi
+    j = j + (j - two * P::truncPositive(j * half)); // round up to even
+    P quadrant = j * half - P::set1(4.0f) * P::truncPositive(j * P::set1(0.125f));
+
+    x = ((x - j * P::set1(0.78515625f)) - j * P::set1(2.4187564849853515625e-4f)) - j * P::set1(3.77489497744594108e-8f);
+    P z = x * x;
+    P ps = ((P::set1(-1.9515295891e-4f) * z + P::set1(8.3321608736e-3f)) * z - P::set1(1.6666654611e-1f)) * z * x + x;
+    P pc = ((P::set1(2.443315711809948e-5f) * z - P::set1(1.388731625493765e-3f)) * z + P::set1(4.166664568298827e-2f)) * z * z - half * z + one;
+
+    typename P::Mask swap = (quadrant - two * P::truncPositive(quadrant * half)) > half;
+    P s0 = P::select(swap, pc, ps);
+    P c0 = P::select(swap, ps, pc);
+    P zero = P::set1(0.0f);
+    s = P::select(quadrant > P::set1(1.5f), zero - s0, s0);
+    P cosNeg = P::select(quadrant > half, one, zero) * P::select(quadrant < P::set1(2.5f), one, zero);
+    c = P::select(cosNeg > half, zero - c0, c0);
+}
+
+template <class P>
+P packExpPositive(P x) // 0 <= x <= 88
+{
+    x = P::min(x, P::set1(88.0f));
+    P n = P::truncPositive(x * P::set1(1.44269504088896341f) + P::set1(0.5f));
+    P r = x - n * P::set1(0.693359375f) - n * P::set1(-2.12194440e-4f);
+    P z = r * r;
+    P y = (((((P::set1(1.9875691500e-4f) * r + P::set1(1.3981999507e-3f)) * r + P::set1(8.3334519073e-3f)) * r +
+             P::set1(4.1665795894e-2f)) * r + P::set1(1.6666665459e-1f)) * r + P::set1(5.0000001201e-1f)) * z + r + P::set1(1.0f);
+    return y * P::pow2(n);
+}
+
+template <class P>
+void packSinhCoshPositive(P x, P& s, P& c) // x >= 0
+{
+    P e = packExpPositive(x);
+    P ie = P::set1(1.0f) / e;
+    c = P::set1(0.5f) * (e + ie);
+    // e - 1/e cancels for small x: use the Taylor series there
+    P z = x * x;
+    P series = x + x * z * (P::set1(1.0f / 6.0f) + z * (P::set1(1.0f / 120.0f) + z * P::set1(1.0f / 5040.0f)));
+    s = P::select(x < P::set1(0.5f), series, P::set1(0.5f) * (e - ie));
+}
+
+template <class P>
+P packLogPositive(P x) // x > 0
+{
+    P m, e;
+    P::frexp(x, m, e);
+    typename P::Mask low = m < P::set1(0.707106781186547524f);
+    e = P::select(low, e - P::set1(1.0f), e);
+    m = P::select(low, m + m, m) - P::set1(1.0f);
+    P z = m * m;
+    P y = ((((((((P::set1(7.0376836292e-2f) * m - P::set1(1.1514610310e-1f)) * m + P::set1(1.1676998740e-1f)) * m -
+                P::set1(1.2420140846e-1f)) * m + P::set1(1.4249322787e-1f)) * m - P::set1(1.6668057665e-1f)) * m +
+             P::set1(2.0000714765e-1f)) * m - P::set1(2.4999993993e-1f)) * m + P::set1(3.3333331174e-1f)) * m * z;
+    y = y + e * P::set1(-2.12194440e-4f) - P::set1(0.5f) * z;
+    return m + y + e * P::set1(0.693359375f);
+}
+
+template <class P>
+P packAsinUnit(P x) // 0 <= x <= 1
+{
+    typename P::Mask big = x > P::set1(0.5f);
+    P t = P::select(big, P::sqrt(P::set1(0.5f) * (P::set1(1.0f) - x)), x);
+    P z = t * t;
+    P p = ((((P::set1(4.2163199048e-2f) * z + P::set1(2.4181311049e-2f)) * z + P::set1(4.5470025998e-2f)) * z +
+            P::set1(7.4953002686e-2f)) * z + P::set1(1.6666752422e-1f)) * z * t + t;
+    return P::select(big, P::set1(1.57079632679489662f) - P::set1(2.0f) * p, p);
+}
+
+template <class P>
+P packAsinhPositive(P x) // x >= 0
+{
+    // log(x + sqrt(x^2 + 1)) cancels for small x: use the series there
+    P z = x * x;
+    P series = x * (P::set1(1.0f) - z * (P::set1(1.0f / 6.0f) - z * P::set1(3.0f / 40.0f)));
+    P full = packLogPositive(x + P::sqrt(z + P::set1(1.0f)));
+    return P::select(x < P::set1(0.01f), series, full);
+}
+
+// Kernels: process [begin, end) in whole packs and return where they stopped
+
+template <class P, CurvedGeometry G>
+void packPort(P x, P y, P z, P scale, P& ox, P& oy, P& oz, P& ow)
+{
+    x = x * scale;
+    y = y * scale;
+    z = z * scale;
+    P d = P::sqrt(x * x + y * y + z * z);
+    P s, c;
+    if (G == CURVED_SPHERICAL)
+        packSinCosPositive(d, s, c);
+    else
+        packSinhCoshPositive(d, s, c);
+
+    typename P::Mask small = d < P::set1(0.0001f);
+    P one = P::set1(1.0f);
+    P f = P::select(small, one, s / P::max(d, P::set1(0.0001f)));
+    ox = x * f;
+    oy = y * f;
+    oz = z * f;
+    ow = P::select(small, one, c);
+}
+
+template <class P, CurvedGeometry G>
+size_t portKernel(const float* x, const float* y, const float* z, size_t begin, size_t end, float scale, CurvedPoints& out)
+{
+    P s = P::set1(scale);
+    size_t i = begin;
+    for (; i + P::width <= end; i += P::width)
+    {
+        P ox, oy, oz, ow;
+        packPort<P, G>(P::load(x + i), P::load(y + i), P::load(z + i), s, ox, oy, oz, ow);
+        ox.store(&out.x[i]);
+        oy.store(&out.y[i]);
+        oz.store(&out.z[i]);
+        ow.store(&out.w[i]);
+    }
+    return i;
+}
+
+// Reads positions with a stride (interleaved vertex data), applies the model
+// matrix, ports, and writes interleaved vec4s
+template <class P, CurvedGeometry G>
+size_t transformPortKernel(const float* vertices, size_t stride, size_t begin, size_t end, const glm::mat4x4& m, float scale, float* out)
+{
+    P s = P::set1(scale);
+    size_t i = begin;
+    for (; i + P::width <= end; i += P::width)
+    {
+        const float* v = vertices + i * stride;
+        P vx = P::gather(v, stride), vy = P::gather(v + 1, stride), vz = P::gather(v + 2, stride);
+        P x = P::set1(m[0][0]) * vx + P::set1(m[1][0]) * vy + P::set1(m[2][0]) * vz + P::set1(m[3][0]);
+        P y = P::set1(m[0][1]) * vx + P::set1(m[1][1]) * vy + P::set1(m[2][1]) * vz + P::set1(m[3][1]);
+        P z = P::set1(m[0][2]) * vx + P::set1(m[1][2]) * vy + P::set1(m[2][2]) * vz + P::set1(m[3][2]);
+
+        P ox, oy, oz, ow;
+        packPort<P, G>(x, y, z, s, ox, oy, oz, ow);
+        float tx[P::width], ty[P::width], tz[P::width], tw[P::width];
+        ox.store(tx);
+        oy.store(ty);
+        oz.store(tz);
+        ow.store(tw);
+        for (int k = 0; k < P::width; k++)
+        {
+            float* o = out + (i + k) * 4;
+            o[0] = tx[k];
+            o[1] = ty[k];
+            o[2] = tz[k];
+            o[3] = tw[k];
+        }
+    }
+    return i;
+}
+
+template <class P>
+size_t translateKernel(const glm::mat4x4& m, size_t begin, size_t end, CurvedPoints& points)
+{
+    size_t i = begin;
+    for (; i + P::width <= end; i += P::width)
+    {
+        P x = P::load(&points.x[i]), y = P::load(&points.y[i]), z = P::load(&points.z[i]), w = P::load(&points.w[i]);
+        for (int r = 0; r < 4; r++)
+        {
+            P o = P::set1(m[0][r]) * x + P::set1(m[1][r]) * y + P::set1(m[2][r]) * z + P::set1(m[3][r]) * w;
+            float* row = r == 0 ? &points.x[i] : r == 1 ? &points.y[i] : r == 2 ? &points.z[i] : &points.w[i];
+            o.store(row);
+        }
+    }
+    return i;
+}
+
+// Geodesic distance from q to each point, minus radius (clamped at 0) when
+// radii are given. Uses the chord |p - q| (Lorentzian in H3) rather than
+// acos/acosh of the dot product, which loses half the digits near q (and, in
+// S3, near -q).
+template <class P, CurvedGeometry G>
+size_t distanceKernel(const CurvedPoints& points, const float* radii, const glm::vec4& q, size_t begin, size_t end, float* out)
+{
+    size_t i = begin;
+    P qx = P::set1(q.x), qy = P::set1(q.y), qz = P::set1(q.z), qw = P::set1(q.w);
+    P half = P::set1(0.5f), zero = P::set1(0.0f);
+    for (; i + P::width <= end; i += P::width)
+    {
+        P dx = P::load(&points.x[i]) - qx, dy = P::load(&points.y[i]) - qy;
+        P dz = P::load(&points.z[i]) - qz, dw = P::load(&points.w[i]) - qw;
+        P d;
+        if (G == CURVED_SPHERICAL)
+        {
+            // Near the antipode measure from -q instead
+            P sx = dx + qx + qx, sy = dy + qy + qy, sz = dz + qz + qz, sw = dw + qw + qw;
+            P chord = P::sqrt(dx * dx + dy * dy + dz * dz + dw * dw);
+            P antiChord = P::sqrt(sx * sx + sy * sy + sz * sz + sw * sw);
+            typename P::Mask near = chord < antiChord;
+            P a = P::set1(2.0f) * packAsinUnit(P::min(P::set1(1.0f), half * P::select(near, chord, antiChord)));
+            d = P::select(near, a, P::set1(3.14159265358979324f) - a);
+        }
+        else
+        {
+            P chord = P::sqrt(P::max(zero, dx * dx + dy * dy + dz * dz - dw * dw));
+            d = P::set1(2.0f) * packAsinhPositive(half * chord);
+        }
+        if (radii)
+            d = P::max(zero, d - P::load(radii + i));
+        d.store(out + i);
+    }
+    return i;
+}
+
+// Public batch API: best compiled kernel for full packs, scalar for the tail
+
+template <CurvedGeometry G>
+void batchPort(const float* x, const float* y, const float* z, size_t n, float scale, CurvedPoints& out)
+{
+    out.resize(n);
+    size_t i = portKernel<BestPack, G>(x, y, z, 0, n, scale, out);
+    portKernel<ScalarPack, G>(x, y, z, i, n, scale, out);
+}
+
+template <CurvedGeometry G>
+void batchTransformPort(const float* vertices, size_t stride, size_t n, const glm::mat4x4& model, float scale, float* out)
+{
+    size_t i = transformPortKernel<BestPack, G>(vertices, stride, 0, n, model, scale, out);
+    transformPortKernel<ScalarPack, G>(vertices, stride, i, n, model, scale, out);
+}
+
+// points = m * points, e.g. with m from Spherical::translate
+inline void batchTranslate(const glm::mat4x4& m, CurvedPoints& points)
+{
+    size_t i = translateKernel<BestPack>(m, 0, points.size(), points);
+    translateKernel<ScalarPack>(m, i, points.size(), points);
+}
+
+template <CurvedGeometry G>
+void batchDistance(const CurvedPoints& points, const glm::vec4& q, float* out)
+{
+    size_t i = distanceKernel<BestPack, G>(points, nullptr, q, 0, points.size(), out);
+    distanceKernel<ScalarPack, G>(points, nullptr, q, i, points.size(), out);
+}
+
+template <CurvedGeometry G>
+void batchSphereDistance(const CurvedPoints& centers, const float* radii, const glm::vec4& q, float* out)
+{
+    size_t i = distanceKernel<BestPack, G>(centers, radii, q, 0, centers.size(), out);
+    distanceKernel<ScalarPack, G>(centers, radii, q, i, centers.size(), out);
+}
+
+// Validation against a double-precision reference
+
+struct CurvedMathReport
+{
+    double portError[2] = {};
+    double distanceError[2] = {};
+    double pointsPerSecond = 0.0;
+};
+
+template <class P>
+CurvedMathReport checkCurvedKernels(const std::vector<float>& x, const std::vector<float>& y, const std::vector<float>& z, float scale)
+{
+    CurvedMathReport report;
+    size_t n = x.size() / P::width * P::width;
+    CurvedPoints ported;
+    ported.resize(n);
+    std::vector<float> distances(n);
+
+    for (int g = 0; g < 2; g++)
+    {
+        bool spherical = g == CURVED_SPHERICAL;
+        if (spherical)
+            portKernel<P, CURVED_SPHERICAL>(x.data(), y.data(), z.data(), 0, n, scale, ported);
+        else
+            portKernel<P, CURVED_HYPERBOLIC>(x.data(), y.data(), z.data(), 0, n, scale, ported);
+
+        // Distances from the first ported point to all the others
+        glm::vec4 q(ported.x[0], ported.y[0], ported.z[0], ported.w[0]);
+        if (spherical)
+            distanceKernel<P, CURVED_SPHERICAL>(ported, nullptr, q, 0, n, distances.data());
+        else
+            distanceKernel<P, CURVED_HYPERBOLIC>(ported, nullptr, q, 0, n, distances.data());
+
+        for (size_t i = 0; i < n; i++)
+        {
+            double px = double(x[i]) * scale, py = double(y[i]) * scale, pz = double(z[i]) * scale;
+            double d = std::sqrt(px * px + py * py + pz * pz);
+            double f = d < 0.0001 ? 1.0 : (spherical ? std::sin(d) : std::sinh(d)) / d;
+            double w = d < 0.0001 ? 1.0 : (spherical ? std::cos(d) : std::cosh(d));
+            double ref[4] = { px * f, py * f, pz * f, w };
+            double got[4] = { ported.x[i], ported.y[i], ported.z[i], ported.w[i] };
+            for (int k = 0; k < 4; k++)
+            {
+                // relative for H3, whose coordinates grow like e^d
+                double error = std::fabs(got[k] - ref[k]) / (spherical ? 1.0 : std::max(1.0, std::fabs(ref[k])));
+                report.portError[g] = std::max(report.portError[g], error);
+            }
+
+            // Reference distance on the kernel's own (float) points
+            double dx = double(ported.x[i]) - q.x, dy = double(ported.y[i]) - q.y;
+            double dz = double(ported.z[i]) - q.z, dw = double(ported.w[i]) - q.w;
+            double refDistance;
+            if (spherical)
+            {
+                double sx = dx + 2.0 * q.x, sy = dy + 2.0 * q.y, sz = dz + 2.0 * q.z, sw = dw + 2.0 * q.w;
+                refDistance = 2.0 * std::atan2(std::sqrt(dx * dx + dy * dy + dz * dz + dw * dw), std::sqrt(sx * sx + sy * sy + sz * sz + sw * sw));
+            }
+            else
+                refDistance = 2.0 * std::asinh(0.5 * std::sqrt(std::max(0.0, dx * dx + dy * dy + dz * dz - dw * dw)));
+            double error = std::fabs(distances[i] - refDistance) / std::max(1.0, refDistance);
+            report.distanceError[g] = std::max(report.distanceError[g], error);
+        }
+    }
+
+    const int rounds = 20;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        portKernel<P, CURVED_SPHERICAL>(x.data(), y.data(), z.data(), 0, n, scale, ported);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report.pointsPerSecond = rounds * n / seconds;
+    return report;
+}
+
+// Errors above tolerance fail; S3 port error is absolute, H3 relative
+inline bool validateCurvedMath(std::ostream& os)
+{
+    const size_t n = 1 << 20;
+    const float scale = 0.005f;
+    std::vector<float> x(n), y(n), z(n);
+    uint32_t state = 12345;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / float(1 << 24) * 2.0f - 1.0f;
+    };
+    for (size_t i = 0; i < n; i++)
+    {
+        // Up to ~3.5 units of curved distance, plus a cluster near the origin
+        float radius = (i % 8 == 0) ? 0.05f : 400.0f;
+        x[i] = random() * radius;
+        y[i] = random() * radius;
+        z[i] = random() * radius;
+    }
+
+    bool passed = true;
+    auto row = [&](const char* name, const CurvedMathReport& r) {
+        os << std::left << std::setw(8) << name << std::right << std::scientific << std::setprecision(2)
+           << std::setw(12) << r.portError[0] << std::setw(12) << r.portError[1]
+           << std::setw(12) << r.distanceError[0] << std::setw(12) << r.distanceError[1]
+           << std::fixed << std::setprecision(1) << std::setw(12) << r.pointsPerSecond / 1.0e6 << '\n';
+        passed = passed && r.portError[0] < 2e-6 && r.portError[1] < 2e-5 && r.distanceError[0] < 1e-5 && r.distanceError[1] < 1e-5;
+    };
+
+    os << "Curved math vs double reference (" << n << " points)\n";
+    os << std::left << std::setw(8) << "kernel" << std::right << std::setw(12) << "port S3" << std::setw(12) << "port H3"
+       << std::setw(12) << "dist S3" << std::setw(12) << "dist H3" << std::setw(12) << "Mpts/s" << '\n';
+    row("scalar", checkCurvedKernels<ScalarPack>(x, y, z, scale));
+#ifdef CURVED_MATH_SSE2
+    row("sse2", checkCurvedKernels<Sse4Pack>(x, y, z, scale));
+#endif
+#ifdef CURVED_MATH_AVX2
+    row("avx2", checkCurvedKernels<Avx8Pack>(x, y, z, scale));
+#endif
+    os.unsetf(std::ios::floatfield);
+    os << (passed ? "PASSED" : "FAILED") << '\n';
+    return passed;
+}
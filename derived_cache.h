@@ -0,0 +1,339 @@
+#pragma once
+
+// Content-addressed store for everything derived from other data: mesh BVHs,
+// program binaries, baked meshes and textures. An entry is named by a key
+// hashing the product kind, the version of the code producing it, its
+// processing parameters and its source bytes, so a changed input or tool
+// simply misses and stale entries age out.
+//
+// Entries are written to a temporary file and renamed into place, so readers
+// (other threads, other processes such as asset_baker) see a whole entry or
+// none; each also carries a checksum of its payload. When the directory grows
+// past its limit the least recently used entries are deleted; use is tracked
+// in memory and through the files' modification times across runs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DERIVED_CACHE_MAGIC 0x56524544u // "DERV"
+#define DERIVED_CACHE_VERSION 1
+#define DERIVED_CACHE_LIMIT (256ull << 20) // bytes on disk before eviction
+
+inline uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = 1469598103934665603ull)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Key of one derived product, e.g.
+//   DerivedKey("bvh", MESH_BVH_VERSION).add(vertices).add(indices)
+class DerivedKey
+{
+    std::string product;
+    uint64_t hash = 0;
+
+public:
+    DerivedKey() = default;
+
+    // product: kind of output, also the entry's file extension
+    DerivedKey(const std::string& _product, uint32_t version) : product(_product)
+    {
+        hash = fnv1a64(product.data(), product.size());
+        hash = fnv1a64(&version, sizeof(version), hash);
+    }
+
+    // Each field is hashed with its length, so "ab" + "c" differs from "a" + "bc"
+    DerivedKey& add(const void* data, size_t size)
+    {
+        uint64_t length = size;
+        hash = fnv1a64(&length, sizeof(length), hash);
+        hash = fnv1a64(data, size, hash);
+        return *this;
+    }
+
+    DerivedKey& add(const std::string& text)
+    {
+        return add(text.data(), text.size());
+    }
+
+    template <class T>
+    DerivedKey& add(const std::vector<T>& values)
+    {
+        return add(values.data(), values.size() * sizeof(T));
+    }
+
+    uint64_t value() const
+    {
+        return hash;
+    }
+
+    std::string fileName() const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.", (unsigned long long)hash);
+        return name + product;
+    }
+};
+
+class DerivedCache
+{
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t size;
+        uint64_t checksum;
+    };
+
+    struct Entry
+    {
+        uint64_t size; // on disk, header included
+        uint64_t lastUse; // tick
+    };
+
+public:
+    struct Stats
+    {
+        size_t hits = 0, misses = 0, stores = 0, evictions = 0, corrupt = 0;
+        uint64_t bytesRead = 0, bytesWritten = 0;
+        size_t entries = 0;
+        uint64_t size = 0, limit = 0;
+    };
+
+private:
+    std::filesystem::path directory;
+    uint64_t limit = 0;
+    std::unordered_map<std::string, Entry> entries; // by file name
+    uint64_t total = 0, tick = 0, temporaries = 0, session = 0;
+    Stats stats;
+    mutable std::mutex lock;
+
+    // Caller holds lock
+    void touch(const std::string& name, uint64_t size)
+    {
+        auto found = entries.find(name);
+        if (found == entries.end())
+        {
+            entries.emplace(name, Entry{ size, ++tick });
+            total += size;
+            return;
+        }
+        total += size - found->second.size;
+        found->second = { size, ++tick };
+    }
+
+    // Caller holds lock; keeps the entry named keep
+    void evict(const std::string& keep)
+    {
+        while (total > limit && entries.size() > 1)
+        {
+            auto oldest = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+                if (it->first != keep && (oldest == entries.end() || it->second.lastUse < oldest->second.lastUse))
+                    oldest = it;
+            if (oldest == entries.end())
+                return;
+            std::error_code error;
+            std::filesystem::remove(directory / oldest->first, error);
+            total -= oldest->second.size;
+            entries.erase(oldest);
+            stats.evictions++;
+        }
+    }
+
+public:
+    DerivedCache() = default;
+    DerivedCache(const DerivedCache&) = delete;
+    DerivedCache& operator=(const DerivedCache&) = delete;
+
+    // Indexes what is already in directory, oldest use first. directory
+    // empty: disabled, every get() misses and put() does nothing.
+    void open(const std::filesystem::path& _directory, uint64_t _limit = DERIVED_CACHE_LIMIT)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        directory = _directory;
+        limit = _limit;
+        entries.clear();
+        total = 0;
+        stats = Stats();
+        session = std::random_device()();
+        if (directory.empty())
+            return;
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        struct Found
+        {
+            std::string name;
+            uint64_t size;
+            std::filesystem::file_time_type time;
+        };
+        std::vector<Found> found;
+        auto now = std::filesystem::file_time_type::clock::now();
+        for (const auto& item : std::filesystem::directory_iterator(directory, error))
+        {
+            std::error_code itemError;
+            std::string name = item.path().filename().string();
+            std::filesystem::file_time_type time = item.last_write_time(itemError);
+            if (itemError || !item.is_regular_file(itemError))
+                continue;
+            // Left behind by a writer that died; recent ones may still be in use
+            if (name.find(".tmp") != std::string::npos)
+            {
+                if (now - time > std::chrono::hours(1))
+                    std::filesystem::remove(item.path(), itemError);
+                continue;
+            }
+            found.push_back({ name, uint64_t(item.file_size(itemError)), time });
+        }
+        std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.time < b.time; });
+        for (const Found& entry : found)
+            touch(entry.name, entry.size);
+        evict("");
+    }
+
+    bool isEnabled() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return !directory.empty();
+    }
+
+    // Payload stored under key, if present and intact
+    bool get(const DerivedKey& key, std::vector<unsigned char>& bytes)
+    {
+        std::filesystem::path path;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (directory.empty())
+                return false;
+            path = directory / key.fileName();
+        }
+
+        Header header;
+        std::ifstream file(path, std::ios::binary);
+        bool found = bool(file);
+        std::error_code sizeError;
+        uint64_t fileSize = found ? uint64_t(std::filesystem::file_size(path, sizeError)) : 0;
+        // A damaged size must not allocate more than the file can hold
+        bool valid = found && !sizeError && fileSize >= sizeof(header) && file.read((char*)&header, sizeof(header)) &&
+                     header.magic == DERIVED_CACHE_MAGIC && header.version == DERIVED_CACHE_VERSION && header.key == key.value() &&
+                     header.size <= fileSize - sizeof(header);
+        if (valid)
+        {
+            bytes.resize(size_t(header.size));
+            valid = file.read((char*)bytes.data(), std::streamsize(bytes.size())) && fnv1a64(bytes.data(), bytes.size()) == header.checksum;
+        }
+        file.close();
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (!valid)
+        {
+            stats.misses++;
+            if (found)
+            {
+                // Truncated or damaged: drop it so the next put() replaces it
+                stats.corrupt++;
+                std::error_code error;
+                std::filesystem::remove(path, error);
+                auto entry = entries.find(key.fileName());
+                if (entry != entries.end())
+                {
+                    total -= entry->second.size;
+                    entries.erase(entry);
+                }
+            }
+            bytes.clear();
+            return false;
+        }
+        stats.hits++;
+        stats.bytesRead += bytes.size();
+        touch(key.fileName(), sizeof(header) + bytes.size());
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        return true;
+    }
+
+    // Stores a payload under key, replacing any previous one
+    void put(const DerivedKey& key, const void* data, size_t size)
+    {
+        std::filesystem::path path, temporary;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (directory.empty())
+                return;
+            path = directory / key.fileName();
+            char suffix[48];
+            std::snprintf(suffix, sizeof(suffix), ".tmp%08llx.%llu", (unsigned long long)session, (unsigned long long)temporaries++);
+            temporary = directory / (key.fileName() + suffix);
+        }
+
+        Header header = { DERIVED_CACHE_MAGIC, DERIVED_CACHE_VERSION, key.value(), size, fnv1a64(data, size) };
+        std::error_code error;
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)data, std::streamsize(size));
+            if (!file)
+            {
+                file.close();
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+        }
+        std::filesystem::rename(temporary, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        stats.stores++;
+        stats.bytesWritten += size;
+        touch(key.fileName(), sizeof(header) + size);
+        evict(key.fileName());
+    }
+
+    void put(const DerivedKey& key, const std::vector<unsigned char>& bytes)
+    {
+        put(key, bytes.data(), bytes.size());
+    }
+
+    Stats getStats() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Stats current = stats;
+        current.entries = entries.size();
+        current.size = total;
+        current.limit = limit;
+        return current;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const DerivedCache::Stats& stats)
+{
+    os << stats.hits << " hits, " << stats.misses << " misses";
+    if (stats.corrupt)
+        os << " (" << stats.corrupt << " damaged)";
+    return os << ", " << stats.stores << " stores, " << stats.evictions << " evictions; read " << stats.bytesRead << " B, wrote "
+              << stats.bytesWritten << " B; " << stats.entries << " entries, " << stats.size / 1024 << " / " << stats.limit / 1024 << " KiB";
+}
+
+// Shared by the viewer's loaders; asset_baker opens its own on the same directory
+inline DerivedCache derivedCache;
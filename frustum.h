@@ -0,0 +1,57 @@
+#pragma once
+
+// View frustum as six planes extracted from a world -> clip matrix, optionally
+// narrowed to a screen rectangle (NDC x0, y0, x1, y1). Planes are normalized
+// with the inside at dot(normal, p) + w >= 0.
+
+#include <glm/glm.hpp>
+
+class Frustum
+{
+    glm::vec4 planes[6];
+
+public:
+    Frustum(const glm::mat4x4& clip, const glm::vec4& rect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f))
+    {
+        glm::vec4 row[4];
+        for (int r = 0; r < 4; r++)
+            row[r] = glm::vec4(clip[0][r], clip[1][r], clip[2][r], clip[3][r]);
+        planes[0] = row[0] - rect.x * row[3];
+        planes[1] = rect.z * row[3] - row[0];
+        planes[2] = row[1] - rect.y * row[3];
+        planes[3] = rect.w * row[3] - row[1];
+        planes[4] = row[3] + row[2];
+        planes[5] = row[3] - row[2];
+        for (glm::vec4& plane : planes)
+            plane *= 1.0f / glm::length(glm::vec3(plane));
+    }
+
+    // sphere: center xyz, radius w
+    bool intersects(const glm::vec4& sphere) const
+    {
+        for (const glm::vec4& plane : planes)
+            if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w)
+                return false;
+        return true;
+    }
+
+    // Axis-aligned box against the planes set in planeMask (bit i = plane i).
+    // Planes the box is entirely inside are cleared from the mask, so
+    // children of a box need not test them again.
+    bool intersects(const glm::vec3& low, const glm::vec3& high, unsigned& planeMask) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (!(planeMask & (1u << i)))
+                continue;
+            const glm::vec4& plane = planes[i];
+            glm::vec3 far(plane.x >= 0.0f ? high.x : low.x, plane.y >= 0.0f ? high.y : low.y, plane.z >= 0.0f ? high.z : low.z);
+            if (glm::dot(glm::vec3(plane), far) + plane.w < 0.0f)
+                return false;
+            glm::vec3 near(plane.x >= 0.0f ? low.x : high.x, plane.y >= 0.0f ? low.y : high.y, plane.z >= 0.0f ? low.z : high.z);
+            if (glm::dot(glm::vec3(plane), near) + plane.w >= 0.0f)
+                planeMask &= ~(1u << i);
+        }
+        return true;
+    }
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+// Geometry policies. Euclidean, Spherical and Hyperbolic are stateless types
+// with a constexpr curvature sign and the model's port, translate, view and
+// projection math. The camera and the scene traversal take them as template
+// parameters, so the per-geometry branch happens once (dispatchGeometry) and
+// not inside the loops.
+//
+// port() is written once in the common subset of C++ and GLSL
+// (GEOMETRY_PORT); the C++ member and the shader snippet returned by glsl()
+// are expansions of the same macro, so CPU and GPU cannot drift apart.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+enum ShaderGeometry
+{
+    SHADER_EUCLIDEAN,
+    SHADER_SPHERICAL,
+    SHADER_HYPERBOLIC,
+    SHADER_ELLIPTIC,
+    SHADER_GEOMETRY_COUNT
+};
+
+// What the viewer shows: a geometry and how its space is connected
+enum SpaceMode
+{
+    SPACE_EUCLIDEAN,
+    SPACE_SPHERICAL,
+    SPACE_HYPERBOLIC,
+    SPACE_ELLIPTIC,
+    SPACE_TORUS,
+    SPACE_PORTALS,
+    SPACE_MODE_COUNT
+};
+
+#define GEOMETRY_STRINGIFY(...) #__VA_ARGS__
+#define GEOMETRY_GLSL(...) GEOMETRY_STRINGIFY(__VA_ARGS__)
+
+// SIN and COS are the curvature's trigonometric functions
+#define GEOMETRY_PORT(SIN, COS) \
+    vec4 port(vec3 ePoint, float scale) \
+    { \
+        vec3 p = ePoint * scale; \
+        float d = length(p); \
+        if (d < 0.0001f) return vec4(p, 1.0f); \
+        return vec4(p / d * SIN(d), COS(d)); \
+    }
+
+// The GLSL built-ins GEOMETRY_PORT uses, so it also compiles as C++
+struct GlslBuiltins
+{
+    typedef glm::vec3 vec3;
+    typedef glm::vec4 vec4;
+
+    static float length(const vec3& v) { return glm::length(v); }
+    static float sin(float x) { return std::sin(x); }
+    static float cos(float x) { return std::cos(x); }
+    static float sinh(float x) { return std::sinh(x); }
+    static float cosh(float x) { return std::cosh(x); }
+};
+
+template <int Curvature>
+struct GeometryPolicy : GlslBuiltins
+{
+    static constexpr int curvature = Curvature;
+    // p and -p are the same point (elliptic space)
+    static constexpr bool identifiesAntipodes = false;
+    // The scene repeats in a lattice of boxes (flat 3-torus)
+    static constexpr bool periodic = false;
+    // Flat space cut and reconnected by portals
+    static constexpr bool portals = false;
+
+    // sin, identity or sinh: distances along a geodesic map through it
+    static float sinK(float x)
+    {
+        return curvature > 0 ? std::sin(x) : curvature < 0 ? std::sinh(x) : x;
+    }
+
+    // Geodesic distance between two model points
+    static float distance(const glm::vec4& a, const glm::vec4& b)
+    {
+        if (curvature == 0)
+            return glm::length(glm::vec3(a) / a.w - glm::vec3(b) / b.w);
+        float c = a.w * b.w + curvature * (a.x * b.x + a.y * b.y + a.z * b.z);
+        return curvature > 0 ? std::acos(std::clamp(c, -1.0f, 1.0f)) : std::acosh(std::max(c, 1.0f));
+    }
+
+    // Isometry that takes the model point `to` to the origin (0, 0, 0, 1).
+    // For curvature 0 and to = (t, 1) this is the translation by -t.
+    static glm::mat4x4 translate(const glm::vec4& to)
+    {
+        float denom = 1.0f + to.w;
+        glm::mat4x4 out(1.0f);
+        for (int c = 0; c < 3; c++)
+        {
+            for (int r = 0; r < 3; r++)
+                out[c][r] = (r == c ? 1.0f : 0.0f) - curvature * to[r] * to[c] / denom;
+            out[c][3] = curvature * to[c];
+            out[3][c] = -to[c];
+        }
+        out[3][3] = to.w;
+        return out;
+    }
+
+    // Eye at port(position), oriented like lookAt(position, center, up)
+    template <class Geometry>
+    static glm::mat4x4 view(const glm::vec3& position, const glm::vec3& center, const glm::vec3& up, float scale)
+    {
+        glm::mat4x4 rotation = glm::lookAt(position, center, up);
+        rotation[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return rotation * translate(Geometry::port(position, scale));
+    }
+
+    // Perspective whose near/far planes are geodesic distances; with
+    // curvature 0 it is glm::perspective. Curved models measure them in
+    // scaled units.
+    static glm::mat4x4 projection(float fovy, float aspect, float near, float far, float scale)
+    {
+        if (curvature != 0)
+        {
+            near *= scale;
+            far *= scale;
+        }
+        float tanHalfFovy = std::tan(fovy / 2.0f);
+        float div = sinK(far - near);
+        glm::mat4x4 out(0.0f);
+        out[0][0] = 1.0f / (aspect * tanHalfFovy);
+        out[1][1] = 1.0f / tanHalfFovy;
+        out[2][2] = -sinK(near + far) / div;
+        out[2][3] = -1.0f;
+        out[3][2] = -2.0f * sinK(near) * sinK(far) / div;
+        return out;
+    }
+};
+
+struct Euclidean : GeometryPolicy<0>
+{
+    static constexpr ShaderGeometry shaderGeometry = SHADER_EUCLIDEAN;
+
+    static vec4 port(vec3 ePoint, float)
+    {
+        return vec4(ePoint, 1.0f);
+    }
+
+    static glm::mat4x4 view(const glm::vec3& position, const glm::vec3& center, const glm::vec3& up, float scale)
+    {
+        return GeometryPolicy::view<Euclidean>(position, center, up, scale);
+    }
+
+    static const char* glsl()
+    {
+        return "";
+    }
+};
+
+struct Spherical : GeometryPolicy<1>
+{
+    static constexpr ShaderGeometry shaderGeometry = SHADER_SPHERICAL;
+
+    static GEOMETRY_PORT(sin, cos)
+
+    static glm::mat4x4 view(const glm::vec3& position, const glm::vec3& center, const glm::vec3& up, float scale)
+    {
+        return GeometryPolicy::view<Spherical>(position, center, up, scale);
+    }
+
+    static const char* glsl()
+    {
+        return GEOMETRY_GLSL(GEOMETRY_PORT(sin, cos));
+    }
+};
+
+struct Hyperbolic : GeometryPolicy<-1>
+{
+    static constexpr ShaderGeometry shaderGeometry = SHADER_HYPERBOLIC;
+
+    static GEOMETRY_PORT(sinh, cosh)
+
+    static glm::mat4x4 view(const glm::vec3& position, const glm::vec3& center, const glm::vec3& up, float scale)
+    {
+        return GeometryPolicy::view<Hyperbolic>(position, center, up, scale);
+    }
+
+    static const char* glsl()
+    {
+        return GEOMETRY_GLSL(GEOMETRY_PORT(sinh, cosh));
+    }
+};
+
+// S3 with antipodes identified. Same port and view; each object is drawn
+// once, as whichever of p and -p is in front of the camera. A geodesic closes
+// after pi instead of 2 pi, so depth spans (near, pi).
+struct Elliptic : Spherical
+{
+    static constexpr ShaderGeometry shaderGeometry = SHADER_ELLIPTIC;
+    static constexpr bool identifiesAntipodes = true;
+
+    static glm::mat4x4 projection(float fovy, float aspect, float near, float /*far*/, float scale)
+    {
+        return Spherical::projection(fovy, aspect, near, 3.14159265f / scale - near, scale);
+    }
+};
+
+// Flat space with x, y and z each identified modulo the box size: the
+// Euclidean math, drawn once per visible copy of the box
+struct Torus : Euclidean
+{
+    static constexpr bool periodic = true;
+};
+
+// Flat space whose portals show other places of it (portals.h)
+struct Portals : Euclidean
+{
+    static constexpr bool portals = true;
+};
+
+// Calls function with a value of the policy type for the mode
+template <class Function>
+void dispatchGeometry(SpaceMode mode, const Function& function)
+{
+    switch (mode)
+    {
+    case SPACE_SPHERICAL:
+        function(Spherical());
+        break;
+    case SPACE_HYPERBOLIC:
+        function(Hyperbolic());
+        break;
+    case SPACE_ELLIPTIC:
+        function(Elliptic());
+        break;
+    case SPACE_TORUS:
+        function(Torus());
+        break;
+    case SPACE_PORTALS:
+        function(Portals());
+        break;
+    default:
+        function(Euclidean());
+        break;
+    }
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+// The {4,3,5} honeycomb of H3: cubes with 72 degree dihedral angles, five
+// around each edge. Cells are generated once by reflecting the base cube (the
+// one centered at the origin) across its faces, breadth first out to a radius,
+// with transforms kept in double so far cells do not drift. Each cell stores
+// its six face neighbours, so a frame only walks the graph from the camera's
+// cell and stops at a distance and count budget: the number of cells in a
+// ball grows like e^(2r), so nothing here is proportional to the whole
+// honeycomb.
+//
+// Cells are reached through reflections, so half of them are mirror images
+// of the base cell; those draw with the reflection composed with a mirror
+// symmetry of the base cube (x -> -x), so every cell's isometry preserves
+// orientation and no cell shows the scene mirrored.
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "geometry.h"
+
+#define HONEYCOMB_FACES 6
+
+class Honeycomb
+{
+public:
+    struct Cell
+    {
+        glm::mat4x4 transform; // base cell -> this cell, orientation preserving
+        glm::vec4 center;
+        int neighbors[HONEYCOMB_FACES]; // -1 outside the generated region
+    };
+
+private:
+    struct Matrix
+    {
+        double m[4][4]; // m[row][column]
+
+        Matrix operator*(const Matrix& b) const
+        {
+            Matrix out;
+            for (int r = 0; r < 4; r++)
+                for (int c = 0; c < 4; c++)
+                    out.m[r][c] = m[r][0] * b.m[0][c] + m[r][1] * b.m[1][c] + m[r][2] * b.m[2][c] + m[r][3] * b.m[3][c];
+            return out;
+        }
+    };
+
+    std::vector<Cell> cells;
+    std::vector<Matrix> exact; // products of reflections, which the faces follow
+    std::vector<char> odd; // per cell: an odd number of reflections
+    Matrix reflections[HONEYCOMB_FACES];
+    std::unordered_map<uint64_t, std::vector<int>> buckets; // centers on a 0.5 grid
+
+    // Traversal state, reused between frames
+    std::vector<uint32_t> marks;
+    uint32_t mark = 0;
+    std::vector<int> visible;
+    int cameraCell = 0;
+    size_t tested = 0;
+
+    static uint64_t bucketKey(int x, int y, int z)
+    {
+        return (uint64_t(x + (1 << 20)) << 42) | (uint64_t(y + (1 << 20)) << 21) | uint64_t(z + (1 << 20));
+    }
+
+    static double lorentzDistance(const double* a, const double* b)
+    {
+        return std::acosh(std::max(1.0, a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2]));
+    }
+
+    int find(const double* center) const
+    {
+        int x = int(std::floor(center[0] * 2.0)), y = int(std::floor(center[1] * 2.0)), z = int(std::floor(center[2] * 2.0));
+        for (int dx = -1; dx <= 1; dx++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dz = -1; dz <= 1; dz++)
+                {
+                    auto bucket = buckets.find(bucketKey(x + dx, y + dy, z + dz));
+                    if (bucket == buckets.end())
+                        continue;
+                    for (int i : bucket->second)
+                    {
+                        double other[4] = { exact[i].m[0][3], exact[i].m[1][3], exact[i].m[2][3], exact[i].m[3][3] };
+                        // centers are 2 * inradius (~1.06) apart
+                        if (lorentzDistance(center, other) < 0.1)
+                            return i;
+                    }
+                }
+        return -1;
+    }
+
+    int add(const Matrix& transform, bool mirrored)
+    {
+        // x -> -x maps the base cube to itself and fixes its center
+        Matrix drawn = transform;
+        if (mirrored)
+            for (int r = 0; r < 4; r++)
+                drawn.m[r][0] = -drawn.m[r][0];
+        Cell cell;
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                cell.transform[c][r] = float(drawn.m[r][c]);
+        cell.center = cell.transform[3];
+        for (int f = 0; f < HONEYCOMB_FACES; f++)
+            cell.neighbors[f] = -1;
+
+        int index = int(cells.size());
+        cells.push_back(cell);
+        exact.push_back(transform);
+        odd.push_back(char(mirrored));
+        buckets[bucketKey(int(std::floor(transform.m[0][3] * 2.0)), int(std::floor(transform.m[1][3] * 2.0)),
+                          int(std::floor(transform.m[2][3] * 2.0)))].push_back(index);
+        return index;
+    }
+
+public:
+    // Half-width of the base cube in the Klein model: faces are x = +-a w
+    static double halfWidth()
+    {
+        double c = std::cos(2.0 * 3.14159265358979324 / 5.0);
+        return std::sqrt(c / (1.0 + c));
+    }
+
+    static double inradius()
+    {
+        return std::atanh(halfWidth());
+    }
+
+    static double circumradius()
+    {
+        return std::atanh(halfWidth() * std::sqrt(3.0));
+    }
+
+    Honeycomb()
+    {
+        // Reflection across the face with normal n: v - 2 <v,n> n / <n,n>,
+        // <,> the Lorentz product (+,+,+,-)
+        double a = halfWidth();
+        for (int f = 0; f < HONEYCOMB_FACES; f++)
+        {
+            double n[4] = { 0.0, 0.0, 0.0, a };
+            n[f / 2] = (f % 2) ? -1.0 : 1.0;
+            double jn[4] = { n[0], n[1], n[2], -n[3] };
+            double nn = 1.0 - a * a;
+            for (int r = 0; r < 4; r++)
+                for (int c = 0; c < 4; c++)
+                    reflections[f].m[r][c] = (r == c ? 1.0 : 0.0) - 2.0 * n[r] * jn[c] / nn;
+        }
+    }
+
+    // All cells whose center is within radius of the origin, at most maxCells
+    void build(double radius, size_t maxCells)
+    {
+        cells.clear();
+        exact.clear();
+        odd.clear();
+        buckets.clear();
+        Matrix identity = {};
+        for (int i = 0; i < 4; i++)
+            identity.m[i][i] = 1.0;
+        add(identity, false);
+
+        const double origin[4] = { 0.0, 0.0, 0.0, 1.0 };
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            for (int f = 0; f < HONEYCOMB_FACES; f++)
+            {
+                Matrix transform = exact[i] * reflections[f];
+                double center[4] = { transform.m[0][3], transform.m[1][3], transform.m[2][3], transform.m[3][3] };
+                int j = find(center);
+                if (j < 0)
+                {
+                    if (lorentzDistance(center, origin) > radius || cells.size() >= maxCells)
+                        continue;
+                    j = add(transform, !odd[i]);
+                }
+                cells[i].neighbors[f] = j;
+            }
+        }
+
+        marks.assign(cells.size(), 0);
+        mark = 0;
+        cameraCell = 0;
+    }
+
+    // Cell containing point: greedy walk towards the nearest center from hint
+    // (cells are the Voronoi regions of their centers)
+    int locate(const glm::vec4& point, int hint) const
+    {
+        int cell = (hint >= 0 && hint < int(cells.size())) ? hint : 0;
+        float best = Hyperbolic::distance(point, cells[cell].center);
+        bool improved = true;
+        while (improved)
+        {
+            improved = false;
+            for (int neighbor : cells[cell].neighbors)
+            {
+                if (neighbor < 0)
+                    continue;
+                float d = Hyperbolic::distance(point, cells[neighbor].center);
+                if (d < best - 1e-6f)
+                {
+                    best = d;
+                    cell = neighbor;
+                    improved = true;
+                }
+            }
+        }
+        return cell;
+    }
+
+    // Breadth-first from the camera's cell through cells that reach within
+    // radius of point, stopping after maxCells. The camera's cell comes first.
+    const std::vector<int>& visit(const glm::vec4& point, float radius, size_t maxCells)
+    {
+        visible.clear();
+        tested = 0;
+        if (cells.empty())
+            return visible;
+
+        cameraCell = locate(point, cameraCell);
+        if (++mark == 0)
+        {
+            std::fill(marks.begin(), marks.end(), 0);
+            mark = 1;
+        }
+        float reach = radius + float(circumradius());
+        marks[cameraCell] = mark;
+        visible.push_back(cameraCell);
+        for (size_t k = 0; k < visible.size() && visible.size() < maxCells; k++)
+        {
+            for (int neighbor : cells[visible[k]].neighbors)
+            {
+                if (neighbor < 0 || marks[neighbor] == mark)
+                    continue;
+                marks[neighbor] = mark;
+                tested++;
+                if (Hyperbolic::distance(point, cells[neighbor].center) <= reach && visible.size() < maxCells)
+                    visible.push_back(neighbor);
+            }
+        }
+        return visible;
+    }
+
+    // Neighbours examined by the last visit()
+    size_t getTested() const
+    {
+        return tested;
+    }
+
+    const Cell& getCell(int index) const
+    {
+        return cells[index];
+    }
+
+    size_t size() const
+    {
+        return cells.size();
+    }
+};
+
+inline Honeycomb honeycomb;
+
+// CPU-only: cells visited per frame and traversal time for a camera walking
+// out of the base cell, for several radii (--bench-honeycomb)
+inline void benchmarkHoneycomb(std::ostream& os, float scale)
+{
+    auto start = std::chrono::steady_clock::now();
+    Honeycomb cells;
+    cells.build(5.0, 1000000);
+    os << "{4,3,5} honeycomb: " << cells.size() << " cells within 5.0 (inradius " << Honeycomb::inradius()
+       << ", circumradius " << Honeycomb::circumradius() << ") built in "
+       << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+    os << "radius\tcells/frame\ttested/frame\tus/frame\n";
+
+    // Stays inside the generated region: walk + radius + circumradius < 5
+    const int frames = 200;
+    const float walk = 0.75f;
+    glm::vec3 direction = glm::normalize(glm::vec3(0.6f, 0.3f, 1.0f));
+    for (float radius = 1.0f; radius <= 3.0f; radius += 0.5f)
+    {
+        size_t visited = 0, tested = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++)
+        {
+            glm::vec3 position = direction * (walk / scale * i / frames);
+            visited += cells.visit(Hyperbolic::port(position, scale), radius, 1000000).size();
+            tested += cells.getTested();
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / frames;
+        os << radius << "\t" << double(visited) / frames << "\t\t" << double(tested) / frames << "\t\t" << us << "\n";
+    }
+}
@@ -0,0 +1,560 @@
+#pragma once
+
+// Fixed-size work-stealing job system. start() creates one worker per extra
+// core; the thread that started it owns deque 0 and runs jobs only while it
+// waits. Every worker owns a Chase-Lev deque: the owner pushes and pops at
+// the bottom (LIFO, cache-warm), idle workers steal from the top (FIFO, the
+// biggest pieces of a split range). Jobs live in per-worker rings of
+// preallocated slots with their closure stored inline, so spawning does not
+// allocate. A Counter tracks outstanding jobs; wait() runs other jobs until it
+// reaches zero, and a job spawned "after" a counter is parked on it and
+// released by the job that brings it to zero.
+// Threads that are not part of the system (e.g. the ray tracer's own
+// workers) run what they spawn inline, so every call site stays correct;
+// post() is the thread-safe way in for them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define JOB_DEQUE_SIZE 4096 // power of two; a full deque runs the job inline
+#define JOB_POOL_SIZE 4096 // job slots per worker, reused round robin
+#define JOB_STORAGE 64 // inline closure bytes; bigger closures are boxed
+#define JOB_SPIN_ROUNDS 64 // failed steal rounds before a worker sleeps
+
+class JobSystem
+{
+    struct Job;
+
+public:
+    class Counter
+    {
+    public:
+        // Also waits out the last finisher, so a done counter may be destroyed
+        bool done() const
+        {
+            return pending.load(std::memory_order_seq_cst) == 0 && finishing.load(std::memory_order_seq_cst) == 0;
+        }
+
+    private:
+        friend class JobSystem;
+        std::atomic<int> pending{ 0 };
+        std::atomic<int> finishing{ 0 };
+        std::mutex lock;
+        std::vector<Job*> parked; // jobs spawned after this counter
+    };
+
+private:
+    struct Job
+    {
+        void (*invoke)(Job&) = nullptr;
+        void (*destroy)(Job&) = nullptr;
+        Counter* counter = nullptr;
+        std::atomic<bool> busy{ false };
+        bool heap = false;
+        alignas(std::max_align_t) unsigned char storage[JOB_STORAGE];
+    };
+
+    class Deque
+    {
+        std::atomic<int64_t> top{ 0 };
+        std::atomic<int64_t> bottom{ 0 };
+        std::unique_ptr<std::atomic<Job*>[]> slots{ new std::atomic<Job*>[JOB_DEQUE_SIZE] };
+
+    public:
+        // Owner only; false when full
+        bool push(Job* job)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            if (b - t >= JOB_DEQUE_SIZE)
+                return false;
+            slots[b & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Owner only
+        Job* pop()
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            Job* job = slots[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // Last job: race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    job = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        // Any thread
+        Job* steal()
+        {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+            Job* job = slots[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return job;
+        }
+    };
+
+    struct Worker
+    {
+        Deque deque;
+        std::unique_ptr<Job[]> pool{ new Job[JOB_POOL_SIZE] };
+        size_t next = 0;
+        uint32_t random = 0;
+        std::thread thread;
+    };
+
+    struct Binding
+    {
+        const JobSystem* system = nullptr;
+        size_t index = 0;
+    };
+
+    static Binding& binding()
+    {
+        static thread_local Binding current;
+        return current;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::thread::id owner;
+    std::once_flag started;
+    std::atomic<bool> stopping{ false };
+    std::atomic<uint64_t> epoch{ 0 };
+    std::atomic<int> sleeping{ 0 };
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::mutex injectLock;
+    std::deque<Job*> injected; // posted from threads outside the system
+    std::atomic<size_t> injectedCount{ 0 };
+
+    // Worker slot of the calling thread, or -1 if it is not part of the system
+    ptrdiff_t self() const
+    {
+        const Binding& current = binding();
+        if (current.system == this)
+            return ptrdiff_t(current.index);
+        return std::this_thread::get_id() == owner ? 0 : -1;
+    }
+
+    template <class Function>
+    static void bind(Job& job, Function&& function)
+    {
+        typedef typename std::decay<Function>::type Closure;
+        if constexpr (sizeof(Closure) <= JOB_STORAGE && alignof(Closure) <= alignof(std::max_align_t))
+        {
+            new (job.storage) Closure(std::forward<Function>(function));
+            job.invoke = [](Job& j) { (*reinterpret_cast<Closure*>(j.storage))(); };
+            job.destroy = [](Job& j) { reinterpret_cast<Closure*>(j.storage)->~Closure(); };
+        }
+        else
+        {
+            Closure* boxed = new Closure(std::forward<Function>(function));
+            new (job.storage) Closure*(boxed);
+            job.invoke = [](Job& j) { (**reinterpret_cast<Closure**>(j.storage))(); };
+            job.destroy = [](Job& j) { delete *reinterpret_cast<Closure**>(j.storage); };
+        }
+    }
+
+    Job* allocate(Worker& worker)
+    {
+        Job* job = &worker.pool[worker.next++ & (JOB_POOL_SIZE - 1)];
+        if (job->busy.load(std::memory_order_acquire))
+        {
+            // The ring wrapped onto a job still in flight
+            job = new Job();
+            job->heap = true;
+        }
+        job->busy.store(true, std::memory_order_relaxed);
+        return job;
+    }
+
+    void execute(Job* job)
+    {
+        job->invoke(*job);
+        job->destroy(*job);
+        Counter* counter = job->counter;
+        if (job->heap)
+            delete job;
+        else
+            job->busy.store(false, std::memory_order_release);
+        if (counter)
+            finish(*counter);
+    }
+
+    void finish(Counter& counter)
+    {
+        counter.finishing.fetch_add(1, std::memory_order_seq_cst);
+        if (counter.pending.fetch_sub(1, std::memory_order_seq_cst) == 1)
+        {
+            std::vector<Job*> released;
+            {
+                std::lock_guard<std::mutex> guard(counter.lock);
+                released.swap(counter.parked);
+            }
+            for (Job* job : released)
+                submit(job);
+        }
+        counter.finishing.fetch_sub(1, std::memory_order_seq_cst); // last touch
+    }
+
+    void submit(Job* job)
+    {
+        ptrdiff_t index = self();
+        if (index < 0 || !workers[size_t(index)]->deque.push(job))
+        {
+            execute(job);
+            return;
+        }
+        notify();
+    }
+
+    void notify()
+    {
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_seq_cst) > 0)
+        {
+            { std::lock_guard<std::mutex> guard(sleepLock); }
+            wake.notify_one();
+        }
+    }
+
+    // Own deque first, then the others starting at a random victim
+    Job* find(size_t index)
+    {
+        Worker& worker = *workers[index];
+        if (Job* job = worker.deque.pop())
+            return job;
+        if (injectedCount.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> guard(injectLock);
+            if (!injected.empty())
+            {
+                Job* job = injected.front();
+                injected.pop_front();
+                injectedCount.fetch_sub(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        worker.random ^= worker.random << 13;
+        worker.random ^= worker.random >> 17;
+        worker.random ^= worker.random << 5;
+        size_t count = workers.size();
+        for (size_t i = 0, victim = worker.random % count; i < count; i++, victim = (victim + 1) % count)
+            if (victim != index)
+                if (Job* job = workers[victim]->deque.steal())
+                    return job;
+        return nullptr;
+    }
+
+    void run(size_t index)
+    {
+        binding() = { this, index };
+        int idle = 0;
+        while (!stopping.load(std::memory_order_acquire))
+        {
+            uint64_t seen = epoch.load(std::memory_order_seq_cst);
+            if (Job* job = find(index))
+            {
+                execute(job);
+                idle = 0;
+                continue;
+            }
+            if (++idle < JOB_SPIN_ROUNDS)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            wake.wait(guard, [&]() { return epoch.load(std::memory_order_seq_cst) != seen || stopping.load(); });
+            sleeping.fetch_sub(1, std::memory_order_seq_cst);
+            idle = 0;
+        }
+        binding() = Binding();
+    }
+
+    template <class Function>
+    void split(size_t begin, size_t end, size_t grain, const Function& function, Counter& counter)
+    {
+        // Hand the upper halves to the deque, where thieves find the largest first
+        while (end - begin > grain)
+        {
+            size_t middle = begin + (end - begin) / 2;
+            spawn([this, middle, end, grain, &function, &counter]() { split(middle, end, grain, function, counter); }, &counter);
+            end = middle;
+        }
+        function(begin, end);
+    }
+
+public:
+    JobSystem() = default;
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    ~JobSystem() { stop(); }
+
+    // threads: taking part, the caller included; 0 means one per core.
+    // Called implicitly by the first spawn; later calls are ignored.
+    void start(unsigned threads = 0)
+    {
+        std::call_once(started, [&]() {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            owner = std::this_thread::get_id();
+            for (unsigned i = 0; i < threads; i++)
+            {
+                workers.push_back(std::make_unique<Worker>());
+                workers.back()->random = 2463534242u + i * 7919u;
+            }
+            for (size_t i = 1; i < workers.size(); i++)
+                workers[i]->thread = std::thread([this, i]() { run(i); });
+        });
+    }
+
+    void stop()
+    {
+        stopping.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+        }
+        wake.notify_all();
+        for (std::unique_ptr<Worker>& worker : workers)
+            if (worker->thread.joinable())
+                worker->thread.join();
+        std::lock_guard<std::mutex> guard(injectLock);
+        for (Job* job : injected)
+        {
+            job->destroy(*job);
+            delete job;
+        }
+        injected.clear();
+        injectedCount = 0;
+    }
+
+    // Threads taking part, the owner included
+    size_t size() { start(); return workers.size(); }
+
+    // Runs function() on some worker. counter (optional) counts it until it
+    // finishes; after (optional) holds it back until that counter is zero.
+    template <class Function>
+    void spawn(Function&& function, Counter* counter = nullptr, Counter* after = nullptr)
+    {
+        start();
+        ptrdiff_t index = self();
+        if (index < 0)
+        {
+            if (after)
+                wait(*after);
+            function();
+            return;
+        }
+        Job* job = allocate(*workers[size_t(index)]);
+        bind(*job, std::forward<Function>(function));
+        job->counter = counter;
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        if (after)
+        {
+            std::lock_guard<std::mutex> guard(after->lock);
+            if (after->pending.load(std::memory_order_acquire) > 0)
+            {
+                after->parked.push_back(job);
+                return;
+            }
+        }
+        submit(job);
+    }
+
+    // Queues function() from any thread, e.g. an I/O completion. It runs on a
+    // worker, or on the owner while it waits or helps.
+    template <class Function>
+    void post(Function&& function)
+    {
+        start();
+        Job* job = new Job();
+        job->heap = true;
+        bind(*job, std::forward<Function>(function));
+        {
+            std::lock_guard<std::mutex> guard(injectLock);
+            injected.push_back(job);
+            injectedCount.fetch_add(1, std::memory_order_release);
+        }
+        notify();
+    }
+
+    // Runs one pending job on the calling thread; false if there was none or
+    // the thread is not part of the system
+    bool help()
+    {
+        ptrdiff_t index = self();
+        Job* job = index >= 0 ? find(size_t(index)) : nullptr;
+        if (job)
+            execute(job);
+        return job != nullptr;
+    }
+
+    // Runs other jobs until the counter reaches zero
+    void wait(Counter& counter)
+    {
+        ptrdiff_t index = self();
+        while (!counter.done())
+        {
+            Job* job = index >= 0 ? find(size_t(index)) : nullptr;
+            if (job)
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // Splits [0, count) into ranges of at most grain items and runs
+    // function(begin, end) on them; returns when all are done
+    template <class Function>
+    void parallelFor(size_t count, size_t grain, const Function& function)
+    {
+        if (count == 0)
+            return;
+        grain = std::max<size_t>(grain, 1);
+        if (count <= grain || size() == 1 || self() < 0)
+        {
+            function(size_t(0), count);
+            return;
+        }
+        Counter counter;
+        split(0, count, grain, function, counter);
+        wait(counter);
+    }
+};
+
+inline JobSystem jobSystem;
+
+// Spawn cost and parallelFor scaling against one std::thread per chunk
+inline void benchmarkJobs(std::ostream& os)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto ms = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    os << std::fixed << std::setprecision(3);
+
+    const size_t spawns = 1 << 18;
+    {
+        std::atomic<size_t> ran{ 0 };
+        JobSystem::Counter counter;
+        auto start = Clock::now();
+        for (size_t i = 0; i < spawns; i++)
+            jobSystem.spawn([&ran]() { ran.fetch_add(1, std::memory_order_relaxed); }, &counter);
+        jobSystem.wait(counter);
+        double total = ms(start);
+        os << "spawn+run " << spawns << " empty jobs on " << jobSystem.size() << " threads: " << total << " ms, "
+           << total * 1e6 / double(spawns) << " ns/job" << (ran == spawns ? "" : "  MISMATCH") << "\n";
+    }
+    {
+        const size_t chains = 1024, links = 64;
+        std::vector<JobSystem::Counter> counters(chains * links);
+        std::vector<std::atomic<uint32_t>> order(chains);
+        std::atomic<size_t> broken{ 0 };
+        auto start = Clock::now();
+        for (size_t c = 0; c < chains; c++)
+        {
+            order[c] = 0;
+            for (size_t l = 0; l < links; l++)
+                jobSystem.spawn([&, c, l]() {
+                    if (order[c].fetch_add(1) != l)
+                        broken++;
+                }, &counters[c * links + l], l ? &counters[c * links + l - 1] : nullptr);
+        }
+        for (size_t c = 0; c < chains; c++)
+            jobSystem.wait(counters[c * links + links - 1]);
+        double total = ms(start);
+        os << "dependency chains " << chains << "x" << links << ": " << total << " ms, " << total * 1e6 / double(chains * links)
+           << " ns/job" << (broken == 0 ? "" : "  ORDER BROKEN") << "\n";
+    }
+
+    // Memory-light arithmetic so that the scaling reflects the scheduler
+    const size_t count = 1 << 22;
+    std::vector<float> values(count);
+    auto body = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            float x = float(i) * 1e-6f;
+            for (int k = 0; k < 16; k++)
+                x = x * 0.999f + 0.001f / (1.0f + x * x);
+            values[i] = x;
+        }
+    };
+    double serial = 0.0;
+    {
+        auto start = Clock::now();
+        body(0, count);
+        serial = ms(start);
+        os << "parallelFor " << count << " items, serial: " << serial << " ms\n";
+    }
+    float reference = values[count / 3];
+    for (size_t grain : { size_t(1024), size_t(16384) })
+    {
+        for (size_t threads = 1; threads <= std::max<size_t>(cores, jobSystem.size()); threads *= 2)
+        {
+            JobSystem local;
+            local.start(unsigned(threads));
+            std::fill(values.begin(), values.end(), 0.0f);
+            auto start = Clock::now();
+            local.parallelFor(count, grain, body);
+            double total = ms(start);
+            os << "  jobs, grain " << grain << ", " << threads << " threads: " << total << " ms, speedup "
+               << serial / total << (values[count / 3] == reference ? "" : "  MISMATCH") << "\n";
+        }
+    }
+    {
+        // The previous parallelFor: one std::thread per core per call
+        auto start = Clock::now();
+        const size_t calls = 256;
+        for (size_t c = 0; c < calls; c++)
+        {
+            size_t step = (count / 64 + cores - 1) / cores;
+            std::vector<std::thread> threads;
+            for (size_t begin = step; begin < count / 64; begin += step)
+                threads.emplace_back([&, begin]() { body(begin, std::min(begin + step, count / 64)); });
+            body(0, std::min(step, count / 64));
+            for (std::thread& thread : threads)
+                thread.join();
+        }
+        double threadsMs = ms(start) / calls;
+        start = Clock::now();
+        for (size_t c = 0; c < calls; c++)
+            jobSystem.parallelFor(count / 64, 4096, body);
+        double jobsMs = ms(start) / calls;
+        os << "small parallelFor (" << count / 64 << " items) per call: std::thread " << threadsMs << " ms, jobs " << jobsMs << " ms\n";
+    }
+}
@@ -12,100 +12,71 @@
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <fstream>
+#include <cfloat>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
+#include "assets.h"
+#include "baked.h"
+#include "benchmark.h"
+#include "bvh.h"
+#include "curved_math.h"
+#include "derived_cache.h"
+#include "geometry.h"
+#include "honeycomb.h"
+#include "jobs.h"
+#include "mesh_bvh.h"
+#include "pack.h"
+#include "parallel.h"
+#include "portals.h"
+#include "profiler.h"
+#include "program_cache.h"
+#include "rasterizer.h"
+#include "raytracer.h"
+#include "registry.h"
+#include "residency.h"
+#include "shader_permutations.h"
+#include "torus.h"
+#include "trace.h"
+#include "virtual_texture.h"
 
 #define WINDOW_WIDTH 800.0f
 #define WINDOW_HEIGHT 600.0f
 #define CAMERA_STEP 5.0f
 #define GLOBAL_SCALE 0.005f
+#define HONEYCOMB_MARGIN 3.0f // generated beyond the visible radius, in H3 units
+#define HONEYCOMB_MAX_CELLS 50000
+#define HONEYCOMB_MAX_VISIBLE 1024
+#define TORUS_MAX_COPIES 512
+#define BACKGROUND_COLOR glm::vec4(0.2f, 0.3f, 0.3f, 1.0f)
+#define CAMERA_RADIUS 0.5f // collision sphere around the eye
+#define ASSET_PACK_FILE "assets.pack" // in the working directory; used when present
+#define ASSETS_DIRECTORY "Baked" // loose baked assets, beside the executable or in the working directory
+#define DERIVED_CACHE_DIRECTORY "derived_cache" // BVHs and program binaries, shared with asset_baker
+#define LOD_PIXEL_ERROR 1.0f // largest screen-space error of a mesh LOD, in pixels
+#define MIP_STREAM_TAIL 64 // texture levels this size and smaller are loaded with the texture
+#define MIP_STREAM_BIAS 0.5f // levels finer than the on-screen size asks for
+#define MIP_STREAM_HYSTERESIS 0.5f // levels the on-screen size must drop by before one is trimmed
+#define MIP_FADE_FRAMES 8 // a streamed-in level blends in over this many frames
+#define TERRAIN_GRID 32 // quads along each side of the terrain
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
 
 const int PI = 3.1416;
-bool mode = false; // Geometry
+SpaceMode mode = SPACE_EUCLIDEAN; // Geometry
 
-// Shaders
-const char* vertexShaderSource = R"glsl(
-    #version 330 core
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec2 aTexCoord;
-
-    out vec2 TexCoord;
-
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main()
-    {
-        gl_Position = projection * view * model * vec4(aPos, 1.0);
-        TexCoord = aTexCoord;
-    }
-)glsl";
-
-const char* fragmentShaderSource = R"glsl(
-    #version 330 core
-    out vec4 FragColor;
-
-    in vec2 TexCoord;
-
-    uniform sampler2D texture1;
-    void main()
-    {
-        vec4 texColor = texture(texture1, TexCoord);
-        FragColor = texColor;
-    }
-)glsl";
-
-const char *vertexShaderSource2 = "#version 330 core\n"
-    "layout (location = 0) in vec3 aPos;\n"
-    "layout (location = 1) in vec2 aTexCoord;\n"
-
-    "uniform mat4 model;\n"
-    "uniform mat4 view;\n"
-    "uniform mat4 projection;\n"
-
-    "uniform float scale;\n"
-    "uniform float curv;\n"
-    "uniform float anti;\n"
-
-    "out vec2 TexCoord;\n"
-
-    "vec4 port(vec3 ePoint) // port from Euclidean geometry\n"
-    "{\n"
-    "	vec3 p = ePoint * scale; // scaling happens here\n"
-    "	float d = length(p); // distance from geometry origin\n"
-    "	if (d < 0.0001f || curv == 0) return vec4(p, 1);\n"
-    "	if (curv > 0) return vec4(p/d * sin(d), cos(d));\n"
-    "	//if (curv < 0) return vec4(p/d * sinh(d), cosh(d));\n"
-    "}\n"
-    
-    "void main()\n"
-    "{\n"
-    "	TexCoord = aTexCoord;\n"
-    "	vec4 newPos = model * vec4(aPos, 1.0f);\n"
-    "   gl_Position = projection * view * (anti * port(newPos.xyz));\n"
-    "}\0";
-
-const char *fragmentShaderSource2 = "#version 330 core\n"
-    "out vec4 FragColor;\n"
-    "in vec2 TexCoord;\n"
-    "uniform sampler2D texture1;\n"
-    "void main()\n"
-    "{\n"
-    "    FragColor = texture(texture1, TexCoord);\n"
-    "}\0";
-
-GLuint programs[2]; // 2 Geometries
+GLuint programs[SHADER_GEOMETRY_COUNT];
+GLuint activeProgram = 0; // set by useProgram
 class Camera* camera;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processKeyInput(GLFWwindow* window, int key, int scancode, int action, int mods);
-GLuint loadShader(GLenum type, const char* source);
-GLuint loadTexture(const std::string& path);
+void processMouseInput(GLFWwindow* window, int button, int action, int mods);
 
 void printM(const glm::mat4x4& matrx)
 {
@@ -122,135 +93,240 @@ void printM(const glm::mat4x4& matrx)
 	std::cout << "---\n";
 }
 
-glm::mat4x4 NonEuclideanTranslate(const glm::vec4& to)
-{
-    float LorentzSign = 1.0f;
-    float denom = 1 + to.w;
-    glm::mat4x4 out;
-    out[0][0] = 1 - LorentzSign * to.x * to.x / denom; out[0][1] = -LorentzSign * to.x * to.y / denom; out[0][2] = -LorentzSign * to.x * to.z / denom; out[0][3] = -LorentzSign * to.x;
-    out[1][0] = -LorentzSign * to.y * to.x / denom; out[1][1] = 1 - LorentzSign * to.y * to.y / denom; out[1][2] = -LorentzSign * to.y * to.z / denom; out[1][3] = -LorentzSign * to.y;
-    out[2][0] = -LorentzSign * to.z * to.x / denom; out[2][1] = -LorentzSign * to.z * to.y / denom; out[2][2] = 1 - LorentzSign * to.z * to.z / denom; out[2][3] = -LorentzSign * to.z;
-    out[3][0] = to.x; out[3][1] =  to.y; out[3][2] = to.z; out[3][3] = to.w;
-    
-    return glm::transpose(out);
-}
-
 std::string out;
-class Model
+bool meshBvhCache = true; // false: always rebuild
+bool textureCompression = false; // GL_EXT_texture_compression_s3tc; baked textures are decoded without it
+
+// A baked texture on the GPU, shared through textureRegistry by every model
+// that uses it. Only the levels the on-screen size of those models asks for
+// are resident: the small ones come with the texture, finer ones are read
+// and uploaded one at a time as they are needed, the base level clamped to
+// the finest present and the minimum LOD fading in each new one, and they
+// are dropped again when the models move away or memory runs short.
+class Texture : public Resident
 {
-    std::vector<float> verticesData;
-    std::vector<unsigned int> indices;
-    GLuint vao, vbo, ebo;
-    GLuint textureID;
+    GlTexture object;
+    std::string directory, name;
+    uint32_t width = 0; // level 0
+    std::vector<size_t> levelBytes;
+    GLint baseLevel = 0; // finest level resident
+    GLint tailLevel = 0; // first level of at most MIP_STREAM_TAIL texels
+    GLint wantedLevel = 0;
+    float requested = FLT_MAX; // finest level asked for this frame
+    float minLod = 0.0f; // GL_TEXTURE_MIN_LOD over the base level
+
+    void uploadLevel(const TextureData& texture, size_t level);
+
+    void setWanted(GLint level)
+    {
+        wantedLevel = level;
+        wantedBytes = 0;
+        for (size_t l = size_t(level); l < levelBytes.size(); l++)
+            wantedBytes += levelBytes[l];
+    }
+
+public:
+    Texture(const std::string& _directory, const std::string& _name) : directory(_directory), name(_name) {}
 
-    bool loadModel(const std::string& objectPath, const std::string& texturePath)
+    ~Texture()
     {
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string warn, err;
+        release();
+    }
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, objectPath.c_str(), out.c_str()))
+    // Reads a baked texture; without S3TC support it is decoded to RGBA8 on a
+    // job system worker
+    static Task<Expected<TextureData>> read(std::string directory, std::string name, bool compressed)
+    {
+        Expected<std::vector<unsigned char>> bytes = co_await readAsset(directory, name);
+        if (!bytes)
+            co_return AssetError{ bytes.error() };
+        co_await resumeOnJobs();
+        Expected<TextureData> texture = readBakedTexture(*bytes, name);
+        if (texture && !compressed)
         {
-            std::cerr << "Error al cargar/parsear el archivo .obj: " << warn << err << std::endl;
-            return false;
+            TRACE_SCOPE("decodeTexture");
+            decodeTexture(*texture);
         }
+        co_return texture;
+    }
 
-        std::cout << "Warning: " << warn << '\n';
-        std::cout << "Number of materials: " << materials.size() << '\n';
-
-        // Loop over shapes
-        for (size_t s = 0; s < shapes.size(); s++) {
-            // Loop over faces(polygon)
-            size_t index_offset = 0;
-            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-                size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-
-                // Loop over vertices in the face.
-                for (size_t v = 0; v < fv; v++) {
-                    // access to vertex
-                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-
-                    tinyobj::real_t vx = attrib.vertices[3*size_t(idx.vertex_index)+0];
-                    tinyobj::real_t vy = attrib.vertices[3*size_t(idx.vertex_index)+1];
-                    tinyobj::real_t vz = attrib.vertices[3*size_t(idx.vertex_index)+2];
-
-                    verticesData.push_back(vx);
-                    verticesData.push_back(vy);
-                    verticesData.push_back(vz);
-
-                    // Check if `normal_index` is zero or positive. negative = no normal data
-                    if (idx.normal_index >= 0) {
-                        tinyobj::real_t nx = attrib.normals[3*size_t(idx.normal_index)+0];
-                        tinyobj::real_t ny = attrib.normals[3*size_t(idx.normal_index)+1];
-                        tinyobj::real_t nz = attrib.normals[3*size_t(idx.normal_index)+2];
-                    }
-
-                    // Check if `texcoord_index` is zero or positive. negative = no texcoord data
-                    if (true || idx.texcoord_index >= 0) {
-                        tinyobj::real_t tx = attrib.texcoords[2*size_t(idx.texcoord_index)+0];
-                        tinyobj::real_t ty = attrib.texcoords[2*size_t(idx.texcoord_index)+1];
-
-                        verticesData.push_back(tx);
-                        verticesData.push_back(ty);
-                    }
-                    // Optional: vertex colors
-                    // tinyobj::real_t red   = attrib.colors[3*size_t(idx.vertex_index)+0];
-                    // tinyobj::real_t green = attrib.colors[3*size_t(idx.vertex_index)+1];
-                    // tinyobj::real_t blue  = attrib.colors[3*size_t(idx.vertex_index)+2];
-
-                    indices.push_back(indices.size());
-
-                    // if (f == 0)
-                    // {
-                    //     std::cout << '\t' << idx.vertex_index << ' ' << idx.texcoord_index << ' ' << idx.normal_index << '\n';
-                    // }
-                }
-                index_offset += fv;
+    static size_t bytes(const TextureData& texture)
+    {
+        size_t bytes = 0;
+        for (const TextureLevel& level : texture.levels)
+            bytes += level.data.size();
+        return bytes;
+    }
 
-                // per-face material
-                // materials[shapes[s].mesh.material_ids[f]];
-            }
-        }
+    // Repeating texture with the levels from first on, replacing any others
+    void upload(const TextureData& texture, GLint first);
 
-        // for (const auto& shape : shapes)
-        // {
-        //     for (const auto& index : shape.mesh.indices)
-        //     {
-        //         vertices.push_back(attrib.vertices[3 * index.vertex_index + 0]);
-        //         vertices.push_back(attrib.vertices[3 * index.vertex_index + 1]);
-        //         vertices.push_back(attrib.vertices[3 * index.vertex_index + 2]);
-        //         if (!attrib.texcoords.empty()) {
-        //             texcoords.push_back(attrib.texcoords[2 * index.texcoord_index + 0]);
-        //             texcoords.push_back(attrib.texcoords[2 * index.texcoord_index + 1]);
-        //         }
-        //         indices.push_back(indices.size());
-        //     }
-        // }
+    // Levels from MIP_STREAM_TAIL down; the rest streams in once drawn
+    void upload(const TextureData& texture)
+    {
+        GLint tail = 0;
+        while (size_t(tail) + 1 < texture.levels.size() &&
+               std::max(texture.levels[size_t(tail)].width, texture.levels[size_t(tail)].height) > MIP_STREAM_TAIL)
+            tail++;
+        tailLevel = tail;
+        upload(texture, tail);
+    }
 
-        setUpVao();
+    GLuint get() const
+    {
+        return object.get();
+    }
+
+    // A model drawing it wants level (fractional, 0 the finest) this frame
+    void request(float level)
+    {
+        requested = std::min(requested, level);
+    }
+
+    uint32_t getWidth() const
+    {
+        return width;
+    }
 
-        textureID = loadTexture(texturePath);
+    void update() override
+    {
+        if (minLod > 0.0f && object)
+        {
+            minLod = std::max(0.0f, minLod - 1.0f / MIP_FADE_FRAMES);
+            glBindTexture(GL_TEXTURE_2D, object.get());
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, minLod);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        if (requested == FLT_MAX)
+            return; // not drawn: left to the budget
+        float ideal = std::max(0.0f, requested - MIP_STREAM_BIAS);
+        requested = FLT_MAX;
+        GLint finer = std::min(GLint(ideal), tailLevel), coarser = std::min(GLint(std::max(0.0f, ideal - MIP_STREAM_HYSTERESIS)), tailLevel);
+        if (finer < wantedLevel)
+            setWanted(finer);
+        else if (coarser > wantedLevel)
+            setWanted(coarser);
+    }
 
+    bool demote() override
+    {
+        if (!object || baseLevel + 1 >= GLint(levelBytes.size()))
+            return false;
+        glBindTexture(GL_TEXTURE_2D, object.get());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel + 1);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 0.0f);
+        // An empty image gives the level's storage back
+        glTexImage2D(GL_TEXTURE_2D, baseLevel, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        gpuBytes -= levelBytes[size_t(baseLevel)];
+        baseLevel++;
+        minLod = 0.0f;
         return true;
     }
 
+    void evict() override
+    {
+        object.reset();
+        gpuBytes = 0;
+        baseLevel = GLint(levelBytes.size());
+    }
+
+    // Evicted: every wanted level at once. Otherwise the next finer level,
+    // blended in over MIP_FADE_FRAMES.
+    Task<bool> restore() override
+    {
+        Task<Expected<TextureData>> load = read(directory, name, textureCompression);
+        Expected<TextureData> texture = co_await load;
+        if (!texture)
+        {
+            std::cerr << texture.error() << std::endl;
+            co_return false;
+        }
+        co_await renderThread.resume();
+        if (!object)
+        {
+            upload(*texture, std::min(wantedLevel, tailLevel));
+            co_return true;
+        }
+        if (baseLevel == 0)
+            co_return true;
+        baseLevel--;
+        glBindTexture(GL_TEXTURE_2D, object.get());
+        uploadLevel(*texture, size_t(baseLevel));
+        minLod = 1.0f; // samples as before the new level
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, minLod);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        gpuBytes += levelBytes[size_t(baseLevel)];
+        co_return true;
+    }
+};
+
+inline AssetRegistry<Texture> textureRegistry;
+
+// Mesh on the GPU; under memory pressure it keeps only its coarser LODs, or
+// nothing, and restore() reads the baked mesh again. The CPU copy of the
+// vertices and indices is dropped once uploaded; the CPU renderers get one of
+// their own with readCpuMesh().
+class Model : public Resident
+{
+public:
+    // LOD 0 for the CPU renderers
+    struct CpuMesh
+    {
+        std::vector<float> vertices; // x, y, z, u, v
+        std::vector<unsigned int> indices;
+    };
+
+private:
+    std::shared_ptr<const CpuMesh> cpuMesh; // until uploaded
+    std::vector<unsigned int> coarseIndices; // the other LODs, after LOD 0 in the element buffer
+    std::vector<MeshLod> lods;
+    MeshBvh meshBvh;
+    GlVertexArray vao, instancedVao;
+    GlBuffer vbo, ebo;
+    GLuint instanceBuffer = 0;
+    std::shared_ptr<Texture> texture; // shared through textureRegistry
+    std::optional<TextureData> pendingTexture; // read by load(), not yet uploaded
+    std::string directory, meshName, textureName;
+    uint64_t contentHash = 0;
+    size_t vertexCount = 0, indexCount = 0; // all LODs
+    size_t residentLod = 0; // finest LOD in the element buffer
+    uint32_t indexBase = 0; // first index kept in the element buffer
+    float uvDensity = 1.0f; // texture coordinate units per model unit
+    glm::vec4 bounds; // bounding sphere: center xyz, radius w
+
+    // Reads a baked mesh and expands it on a job system worker
+    static Task<Expected<MeshData>> loadMesh(std::string directory, std::string name)
+    {
+        Expected<std::vector<unsigned char>> bytes = co_await readAsset(directory, name);
+        if (!bytes)
+            co_return AssetError{ bytes.error() };
+        co_await resumeOnJobs();
+        TRACE_SCOPE("readBakedMesh");
+        co_return readBakedMesh(*bytes, name);
+    }
+
     void setUpVao()
     {
+        TRACE_SCOPE("Model::setUpVao");
         // std::cout << "Vertices : " << vertices.size() << std::endl;
         // std::cout << "Indices: " << indices.size() << std::endl;
 
-        glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &vbo);
-        glGenBuffers(1, &ebo);
+        vao = GlVertexArray::create();
+        vbo = GlBuffer::create();
+        ebo = GlBuffer::create();
 
-        glBindVertexArray(vao);
+        glBindVertexArray(vao.get());
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, verticesData.size() * sizeof(float), verticesData.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
+        glBufferData(GL_ARRAY_BUFFER, cpuMesh->vertices.size() * sizeof(float), cpuMesh->vertices.data(), GL_STATIC_DRAW);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, cpuMesh->indices.size() * sizeof(unsigned int), cpuMesh->indices.data());
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, cpuMesh->indices.size() * sizeof(unsigned int), coarseIndices.size() * sizeof(unsigned int),
+                        coarseIndices.data());
 
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(0);
@@ -270,9 +346,38 @@ class Model
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
 
-        // vertices.clear();
-        // texcoords.clear();
-        // indices.clear();
+        wantedBytes = gpuBytes = (vertexCount * 5 + indexCount) * sizeof(unsigned int);
+        residentLod = 0;
+        indexBase = 0;
+        cpuMesh.reset();
+        coarseIndices = {};
+        cpuBytes = 0;
+    }
+
+    // Both buffers again, keeping their names so every vertex array using
+    // them stays valid
+    void uploadMesh(const MeshData& mesh)
+    {
+        TRACE_SCOPE("Model::uploadMesh");
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo.get());
+        glBufferData(GL_COPY_WRITE_BUFFER, mesh.vertices.size() * sizeof(float), mesh.vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo.get());
+        glBufferData(GL_COPY_WRITE_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        gpuBytes = wantedBytes;
+        residentLod = 0;
+        indexBase = 0;
+    }
+
+    // The draw call alone; returns the triangles drawn
+    size_t submit(GLuint vertexArray, size_t lod)
+    {
+        const MeshLod& range = lods[std::max(lod, residentLod)];
+        glBindTexture(GL_TEXTURE_2D, texture ? texture->get() : 0);
+        glBindVertexArray(vertexArray);
+        glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(size_t(range.first - indexBase) * sizeof(unsigned int)));
+        glBindVertexArray(0);
+        return range.count / 3;
     }
 
 public:
@@ -282,22 +387,341 @@ public:
     //     setUpVao();
     // }
 
-    Model(const std::string& objPath, const std::string& texturePath)
+    // CPU data and mesh BVH only; see load()
+    Model(MeshData&& mesh, const std::string& _directory, const std::string& _meshName, const std::string& _textureName) :
+        lods(std::move(mesh.lods)), directory(_directory), meshName(_meshName), textureName(_textureName)
+    {
+        // LOD 0 comes first in the baked index buffer
+        std::shared_ptr<CpuMesh> cpu = std::make_shared<CpuMesh>();
+        cpu->vertices = std::move(mesh.vertices);
+        cpu->indices.assign(mesh.indices.begin(), mesh.indices.begin() + lods[0].count);
+        coarseIndices.assign(mesh.indices.begin() + lods[0].count, mesh.indices.end());
+        bounds = glm::vec4(mesh.sphere[0], mesh.sphere[1], mesh.sphere[2], mesh.sphere[3]);
+        vertexCount = cpu->vertices.size() / 5;
+        indexCount = mesh.indices.size();
+        cpuBytes = cpu->vertices.size() * sizeof(float) + indexCount * sizeof(unsigned int);
+
+        const std::vector<float>& verticesData = cpu->vertices;
+        const std::vector<unsigned int>& indices = cpu->indices;
+
+        double area = 0.0, uvArea = 0.0;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            const float* a = &verticesData[size_t(indices[i]) * 5];
+            const float* b = &verticesData[size_t(indices[i + 1]) * 5];
+            const float* c = &verticesData[size_t(indices[i + 2]) * 5];
+            area += glm::length(glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2])));
+            uvArea += std::abs((b[3] - a[3]) * (c[4] - a[4]) - (c[3] - a[3]) * (b[4] - a[4]));
+        }
+        if (area > 0.0 && uvArea > 0.0)
+            uvDensity = float(std::sqrt(uvArea / area));
+        contentHash = fnv1a64(textureName.data(), textureName.size(), mesh.sourceHash);
+        meshBvh.build(verticesData, 5, indices, meshBvhCache ? &derivedCache : nullptr);
+        std::cout << "Mesh BVH: " << meshBvh.size() << " triangles " << (meshBvh.wasCached() ? "loaded" : "built") << " in "
+                  << meshBvh.getBuildMs() << " ms\n";
+        cpuMesh = std::move(cpu);
+    }
+
+    Model(Model&&) = default;
+
+    ~Model()
+    {
+        release();
+    }
+
+    // Reads the baked mesh and texture concurrently; a texture already in
+    // textureRegistry by name is shared instead of read. Names are looked up
+    // in the asset pack, then under directory. Nothing is uploaded yet, so a
+    // model found in modelRegistry by content costs no GL work; see upload().
+    // upload false: the mesh only (headless renderers)
+    static Task<Expected<Model>> load(std::string directory, std::string meshName, std::string textureName, bool upload)
+    {
+        std::shared_ptr<Texture> shared = upload ? textureRegistry.find(textureName) : nullptr;
+        Task<Expected<MeshData>> mesh = loadMesh(directory, meshName);
+        Task<Expected<TextureData>> texture = Texture::read(directory, textureName, textureCompression);
+        if (upload && !shared)
+            co_await whenAll(mesh, texture);
+        else
+            co_await whenAll(mesh);
+
+        Expected<MeshData> meshData = mesh.result();
+        if (!meshData)
+            co_return AssetError{ meshData.error() };
+        Model model(std::move(*meshData), directory, meshName, textureName);
+        if (!upload)
+            co_return std::move(model);
+
+        if (!shared)
+        {
+            Expected<TextureData> textureData = texture.result();
+            if (!textureData)
+                co_return AssetError{ "Error al cargar la textura: " + textureData.error() };
+            model.pendingTexture = std::move(*textureData);
+        }
+        model.texture = std::move(shared);
+        co_return std::move(model);
+    }
+
+    // Creates the buffers and, unless shared already, the texture; a texture
+    // in textureRegistry by content is shared instead. Render thread, once.
+    void upload()
+    {
+        setUpVao();
+        if (!pendingTexture)
+            return;
+        const TextureData& data = *pendingTexture;
+        texture = textureRegistry.add(textureName, data.sourceHash, Texture::bytes(data), [&]() {
+            std::shared_ptr<Texture> uploaded = std::make_shared<Texture>(directory, textureName);
+            uploaded->upload(data);
+            residency.add(*uploaded);
+            return uploaded;
+        });
+        pendingTexture.reset();
+    }
+
+    // Marks the mesh and texture drawn this frame; false while the mesh is
+    // evicted
+    bool use()
+    {
+        residency.use(*this);
+        if (texture)
+            residency.use(*texture);
+        return isResident();
+    }
+
+    // Drops the finest LOD still in the element buffer; the coarser ones
+    // follow it there, copied on the GPU through a scratch buffer so the
+    // render thread never waits for them. The element buffer keeps its name
+    // for the vertex arrays using it.
+    bool demote() override
+    {
+        if (!isResident() || residentLod + 1 >= lods.size())
+            return false;
+        residentLod++;
+        uint32_t first = lods[residentLod].first;
+        size_t kept = indexCount - first;
+        GLsizeiptr keptBytes = GLsizeiptr(kept * sizeof(unsigned int));
+        GlBuffer scratch = GlBuffer::create();
+        glBindBuffer(GL_COPY_READ_BUFFER, ebo.get());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, scratch.get());
+        glBufferData(GL_COPY_WRITE_BUFFER, keptBytes, nullptr, GL_STREAM_COPY);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GLintptr(first - indexBase) * sizeof(unsigned int), 0, keptBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, scratch.get());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo.get());
+        glBufferData(GL_COPY_WRITE_BUFFER, keptBytes, nullptr, GL_STATIC_DRAW);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keptBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        indexBase = first;
+        gpuBytes = (vertexCount * 5 + kept) * sizeof(unsigned int);
+        return true;
+    }
+
+    void evict() override
+    {
+        for (const GlBuffer* buffer : { &vbo, &ebo })
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->get());
+            glBufferData(GL_COPY_WRITE_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        gpuBytes = 0;
+    }
+
+    Task<bool> restore() override
+    {
+        Task<Expected<MeshData>> load = loadMesh(directory, meshName);
+        Expected<MeshData> mesh = co_await load;
+        if (!mesh)
+        {
+            std::cerr << mesh.error() << std::endl;
+            co_return false;
+        }
+        co_await renderThread.resume();
+        uploadMesh(*mesh);
+        co_return true;
+    }
+
+    // Asks the texture for the level that maps a texel to a pixel when one
+    // model unit covers pixelsPerUnit pixels
+    void requestMips(float pixelsPerUnit)
+    {
+        if (texture && texture->getWidth() > 0)
+            texture->request(std::log2(std::max(uvDensity * float(texture->getWidth()) / pixelsPerUnit, 1.0f)));
+    }
+
+    // Coarsest LOD whose error stays under LOD_PIXEL_ERROR pixels when one
+    // model unit covers pixelsPerUnit pixels
+    size_t selectLod(float pixelsPerUnit) const
+    {
+        size_t lod = 0;
+        while (lod + 1 < lods.size() && lods[lod + 1].error * pixelsPerUnit <= LOD_PIXEL_ERROR)
+            lod++;
+        return lod;
+    }
+
+    void draw(size_t lod = 0)
+    {
+        draw(vao.get(), lod);
+    }
+
+    // Draws with another vertex array over the same indices (baked positions)
+    void draw(GLuint vertexArray, size_t lod = 0)
+    {
+        TRACE_SCOPE("Model::draw");
+        if (!use())
+            return;
+        size_t triangles = submit(vertexArray, lod);
+
+        renderStats.draws++;
+        renderStats.triangles += triangles;
+    }
+
+    // A second pass over what draw() drew this frame (the virtual texture
+    // feedback): neither counted in renderStats nor marked used, so it skews
+    // neither the benchmark nor the residency order
+    void drawUncounted(size_t lod = 0)
     {
-        bool build = loadModel(objPath, texturePath);
-        if (!build)
-            exit(1);
+        if (isResident())
+            submit(vao.get(), lod);
     }
 
-    void draw()
+    // One draw of count copies, each translated by a vec3 from offsetBuffer
+    // (location 2, advanced per instance); needs an INSTANCED program
+    void drawInstanced(GLuint offsetBuffer, GLsizei count)
     {
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        TRACE_SCOPE("Model::drawInstanced");
+        if (!use())
+            return;
+        if (!instancedVao || offsetBuffer != instanceBuffer)
+        {
+            if (!instancedVao)
+                instancedVao = GlVertexArray::create();
+            glBindVertexArray(instancedVao.get());
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
+            glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+            glEnableVertexAttribArray(1);
+            glBindBuffer(GL_ARRAY_BUFFER, offsetBuffer);
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            instanceBuffer = offsetBuffer;
+        }
+
+        const MeshLod& range = lods[residentLod];
+        glBindTexture(GL_TEXTURE_2D, texture ? texture->get() : 0);
+        glBindVertexArray(instancedVao.get());
+        glDrawElementsInstanced(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(size_t(range.first - indexBase) * sizeof(unsigned int)),
+                                count);
+        glBindVertexArray(0);
+
+        renderStats.draws++;
+        renderStats.triangles += size_t(count) * (range.count / 3);
+    }
+
+    // Texture coordinates and indices from this model, curved positions
+    // (vec4, location 3) from bakedVbo
+    GlVertexArray createBakedVao(GLuint bakedVbo)
+    {
+        GlVertexArray bakedVao = GlVertexArray::create();
+        glBindVertexArray(bakedVao.get());
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
+        glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, bakedVbo);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(3);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
+        return bakedVao;
+    }
+
+    const glm::vec4& getBounds() const
+    {
+        return bounds;
+    }
+
+    size_t getVertexCount() const
+    {
+        return vertexCount;
+    }
+
+    // Asset name, see rayTexture()
+    const std::string& getTextureName() const
+    {
+        return textureName;
+    }
+
+    // Mesh content and texture name, for modelRegistry
+    uint64_t getContentHash() const
+    {
+        return contentHash;
+    }
+
+    // The CPU copy while the model keeps it (never uploaded), otherwise the
+    // baked mesh read again; either way the caller holds what it gets, and a
+    // mesh read again is freed with the last handle
+    Task<Expected<std::shared_ptr<const CpuMesh>>> loadCpuMesh() const
+    {
+        if (cpuMesh)
+            co_return cpuMesh;
+        Task<Expected<MeshData>> load = loadMesh(directory, meshName);
+        Expected<MeshData> mesh = co_await load;
+        if (!mesh)
+            co_return AssetError{ mesh.error() };
+        std::shared_ptr<CpuMesh> cpu = std::make_shared<CpuMesh>();
+        cpu->vertices = std::move(mesh->vertices);
+        cpu->indices.assign(mesh->indices.begin(), mesh->indices.begin() + mesh->lods[0].count);
+        co_return std::shared_ptr<const CpuMesh>(std::move(cpu));
+    }
+
+    // loadCpuMesh() on the render thread
+    Expected<std::shared_ptr<const CpuMesh>> readCpuMesh() const
+    {
+        Task<Expected<std::shared_ptr<const CpuMesh>>> load = loadCpuMesh();
+        return runUntilDone(load);
+    }
+
+    const MeshBvh& getMeshBvh() const
+    {
+        return meshBvh;
     }
 };
 
+inline AssetRegistry<Model> modelRegistry;
+
+// Shared handle to a model; each mesh and texture pair is loaded and uploaded
+// once however many objects use it
+Task<Expected<std::shared_ptr<Model>>> loadModel(std::string directory, std::string meshName, std::string textureName, bool upload)
+{
+    std::string name = meshName + ":" + textureName;
+    if (std::shared_ptr<Model> model = modelRegistry.find(name))
+        co_return model;
+    Task<Expected<Model>> load = Model::load(directory, meshName, textureName, upload);
+    Expected<Model> loaded = co_await load;
+    if (!loaded)
+        co_return AssetError{ loaded.error() };
+    // Only a model new by content is uploaded
+    if (upload)
+        co_await renderThread.resume();
+    co_return modelRegistry.add(name, loaded->getContentHash(), loaded->getCpuBytes(), [&]() {
+        std::shared_ptr<Model> model = std::make_shared<Model>(std::move(*loaded));
+        if (upload)
+        {
+            model->upload();
+            residency.add(*model);
+        }
+        return model;
+    });
+}
+
 // Model loadCubeModel()
 // {
 //     std::vector<float> vertices = {
@@ -316,311 +740,1224 @@ public:
 //     return Model(vertices, indices);
 // }
 
-class Object
+// S3 positions port(transformation * v) of a static object, baked from the
+// CPU mesh on job system workers into a vertex buffer of its own (a vec4 per
+// vertex). A Resident like the meshes: the first restore() bakes it once it is
+// drawn, evicting it (or its model) frees the buffer, and a new transform or
+// scale drops it for the next restore to bake again.
+class BakedPositions : public Resident
 {
-    glm::vec4 position;
+    Model& model;
+    GlBuffer vbo;
+    GlVertexArray vao;
     glm::mat4x4 transformation;
-    Model* model;
+    float scale;
+    uint32_t version = 0; // of transformation and scale
 
-public:
-    Object(Model* _model, const glm::mat4x4& _transformation) :
-        transformation(_transformation), model(_model)
+    // Drops what was baked for the old ones
+    void changed()
     {
-        position = transformation * glm::vec4(0.0f);
+        version++;
+        if (isResident())
+            evict();
     }
 
-    void draw()
+public:
+    BakedPositions(Model& _model, const glm::mat4x4& _transformation, float _scale) :
+        model(_model), transformation(_transformation), scale(_scale)
     {
-        glUniformMatrix4fv(glGetUniformLocation(programs[mode], "model"), 1, GL_FALSE, glm::value_ptr(transformation));
-        model->draw();
+        wantedBytes = model.getVertexCount() * 4 * sizeof(float);
     }
-};
-
-glm::vec4 portEucToCurved(glm::vec4 eucPoint)
-{
-	glm::vec3 P = eucPoint;
-	float distance = P.length();
-	if (distance < 0.0001f) return eucPoint;
-	/*if (LorentzSign > 0)*/ return glm::vec4(P / distance * std::sin(distance), std::cos(distance));
-	// if (LorentzSign < 0) return float4(P / distance * sinh(distance), cosh(distance));
-	return eucPoint;
-}
-
-class Camera
-{
-    glm::vec3 position;
-    glm::vec3 center;
-
-    glm::mat4x4 viewMatrix;
-    glm::mat4x4 projMatrix;
 
-    float fovy, aspect, near, far;
+    ~BakedPositions()
+    {
+        release();
+    }
 
-    void updateViewMatrix()
+    void setTransformation(const glm::mat4x4& _transformation)
     {
-        glUseProgram(programs[mode]);
-        viewMatrix = glm::lookAt(position, center, glm::vec3(0.0f, 0.1f, 0.0f));
+        transformation = _transformation;
+        changed();
+    }
 
-        if (mode == 1)
+    // Needs a BAKED program; draws nothing until baked
+    void draw(float _scale)
+    {
+        residency.use(*this);
+        if (_scale != scale)
         {
-            auto tmp = viewMatrix;
-
-            glm::vec4 ic = glm::vec4(tmp[0][0], tmp[1][0], tmp[2][0], 0.0f);
-            glm::vec4 jc = glm::vec4(tmp[0][1], tmp[1][1], tmp[2][1], 0.0f);
-            glm::vec4 kc = glm::vec4(tmp[0][2], tmp[1][2], tmp[2][2], 0.0f);
-            
-            glm::vec4 geomEye = portEucToCurved(glm::vec4(position * GLOBAL_SCALE, 1.0f));
-
-            glm::mat4x4 eyeTranslate = NonEuclideanTranslate(geomEye);
-            // eyeTranslate[3][3] = geomEye[3];
-            glm::vec4 icp, jcp, kcp;
-            icp = eyeTranslate * ic;
-            jcp = eyeTranslate * jc;
-            kcp = eyeTranslate * kc;
-            
-            viewMatrix[0][0] = icp[0]; viewMatrix[0][1] = jcp[0]; viewMatrix[0][2] = kcp[0]; viewMatrix[0][3] = geomEye[0];
-            viewMatrix[1][0] = icp[1]; viewMatrix[1][1] = jcp[1]; viewMatrix[1][2] = kcp[1]; viewMatrix[1][3] = geomEye[1];
-            viewMatrix[2][0] = icp[2]; viewMatrix[2][1] = jcp[2]; viewMatrix[2][2] = kcp[2]; viewMatrix[2][3] = geomEye[2];
-            viewMatrix[3][0] = icp[3]; viewMatrix[3][1] = jcp[3]; viewMatrix[3][2] = kcp[3]; viewMatrix[3][3] = /*geomEye[3]*/ 1.0f;
-        
-            // viewMatrix =  glm::transpose(viewMatrix);
+            scale = _scale;
+            changed();
         }
+        if (isResident())
+            model.draw(vao.get());
+        else
+            model.use();
+    }
 
-        // std::cout << "-----Begin View Matrix\n";
-		// printM(viewMatrix);
-		// std::cout << "-----End View Matrix\n";
-        // std::cout << "-----Begin View Raw\n";
-        // auto rawww = glm::value_ptr(viewMatrix);
-        // for (int i = 0; i < 16; i++)
-        //     std::cout << rawww[i] << ' ';
-        // std::cout << '\n';
-		// std::cout << "-----End View Raw\n";
+    void update() override
+    {
+        if (isResident() && !model.isResident())
+            evict();
+    }
 
-        glUniformMatrix4fv(glGetUniformLocation(programs[mode], "view"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+    bool demote() override
+    {
+        return false;
     }
 
-    void updateProjectionMatrix()
+    void evict() override
     {
-        glUseProgram(programs[mode]);
-        if (mode == 0)
-        {
-            projMatrix = glm::perspective(fovy, aspect, near, far);
-        }
-        else
+        vao.reset();
+        vbo.reset();
+        gpuBytes = 0;
+    }
+
+    Task<bool> restore() override
+    {
+        const glm::mat4x4 m = transformation;
+        const float s = scale;
+        const uint32_t baking = version;
+        Task<Expected<std::shared_ptr<const Model::CpuMesh>>> load = model.loadCpuMesh();
+        Expected<std::shared_ptr<const Model::CpuMesh>> mesh = co_await load;
+        if (!mesh)
         {
-            float sFovX = 1.0f/std::tan(fovy/2);
-            float sFovY = 1.0f/std::tan(fovy * aspect/2);
-            float div = (std::sin(far * GLOBAL_SCALE - near * GLOBAL_SCALE));
-            float fp = (2.0f * std::sin(near * GLOBAL_SCALE) * std::sin(far * GLOBAL_SCALE)) / div;
-            float alph = (std::sin(near * GLOBAL_SCALE + far * GLOBAL_SCALE)) / div;
-            // float alph = 0;
-
-            // sFovX, 0, 0, 0,
-            // 0, sFovY, 0, 0,
-            // 0, 0, -alph, -1,
-            // 0, 0, -fp, 0
-
-            projMatrix[0][0] = sFovX;
-            projMatrix[1][1] = sFovY;
-            projMatrix[2][2] = -alph;
-            projMatrix[2][3] = -1;
-            projMatrix[3][2] = -fp;
-            
-            // projMatrix = glm::transpose(projMatrix);
+            std::cerr << mesh.error() << std::endl;
+            co_return false;
         }
-
-        // std::cout << "-----Begin Projection Matrix\n";
-		// printM(projMatrix);
-		// std::cout << "-----End Projection Matrix\n";
-		// std::cout << "-----Begin Projection Raw\n";
-        // auto rawww = glm::value_ptr(projMatrix);
-        // for (int i = 0; i < 16; i++)
-        //     std::cout << rawww[i] << ' ';
-        // std::cout << '\n';
-		// std::cout << "-----End Projection Raw\n";
-        
-        glUniformMatrix4fv(glGetUniformLocation(programs[mode], "projection"), 1, GL_FALSE, glm::value_ptr(projMatrix));
+        co_await resumeOnJobs();
+        auto start = std::chrono::steady_clock::now();
+        const std::vector<float>& vertices = (*mesh)->vertices;
+        size_t count = vertices.size() / 5;
+        std::vector<float> baked(count * 4);
+        parallelFor(count, 4096, [&](size_t begin, size_t end) {
+            batchTransformPort<CURVED_SPHERICAL>(&vertices[begin * 5], 5, end - begin, m, s, &baked[begin * 4]);
+        });
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        co_await renderThread.resume();
+        if (baking != version)
+            co_return true; // moved meanwhile; the next restore bakes again
+        vbo = GlBuffer::create();
+        vao = model.createBakedVao(vbo.get());
+        glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
+        glBufferData(GL_ARRAY_BUFFER, baked.size() * sizeof(float), baked.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        gpuBytes = baked.size() * sizeof(float);
+        std::cout << "Baked " << count << " vertices in " << ms << " ms\n";
+        co_return true;
     }
+};
+
+class Object
+{
+    glm::vec4 position;
+    glm::mat4x4 transformation;
+    std::shared_ptr<Model> model;
+    std::unique_ptr<BakedPositions> baked; // once drawn baked
 
 public:
-    Camera(const glm::vec3& _position, const glm::vec3& _center, float _fovy, float _aspect, float _near, float _far) :
-        position(_position), center(_center), fovy(_fovy), aspect(_aspect), near(_near), far(_far)
+    Object(std::shared_ptr<Model> _model, const glm::mat4x4& _transformation) :
+        transformation(_transformation), model(std::move(_model))
     {
-        updateViewMatrix();
-        updateProjectionMatrix();
+        position = transformation * glm::vec4(0.0f);
     }
 
-    void move(const glm::vec3& amount)
+    void setTransformation(const glm::mat4x4& _transformation)
     {
-        center += amount;
-        position += amount;
-
-        updateViewMatrix();
+        transformation = _transformation;
+        position = transformation * glm::vec4(0.0f);
+        if (baked)
+            baked->setTransformation(transformation);
     }
 
-    void turn(const glm::vec3& amount)
+    // World-space bounding sphere: center xyz, radius w
+    glm::vec4 getBoundingSphere() const
     {
-        center += amount;
+        const glm::vec4& bounds = model->getBounds();
+        float stretch = std::max(glm::length(glm::vec3(transformation[0])),
+                                 std::max(glm::length(glm::vec3(transformation[1])), glm::length(glm::vec3(transformation[2]))));
+        return glm::vec4(glm::vec3(transformation * glm::vec4(glm::vec3(bounds), 1.0f)), bounds.w * stretch);
+    }
 
-        updateViewMatrix();
+    // World-space ray against the model's triangles; distance in world units
+    float raycast(const Bvh::Ray& ray, uint32_t* triangle = nullptr) const
+    {
+        glm::mat4x4 toModel = glm::inverse(transformation);
+        glm::vec3 direction = glm::vec3(toModel * glm::vec4(ray.direction, 0.0f));
+        float length = glm::length(direction);
+        Bvh::Ray local = { glm::vec3(toModel * glm::vec4(ray.origin, 1.0f)), direction / length, ray.tMax * length };
+        return model->getMeshBvh().ray(local, triangle) / length;
     }
 
-    void update()
+    // Fraction of a world-space sphere motion that stays clear of the model
+    float sweep(const glm::vec3& from, const glm::vec3& to, float radius) const
     {
-        updateViewMatrix();
-        updateProjectionMatrix();
+        glm::mat4x4 toModel = glm::inverse(transformation);
+        float shrink = std::min(glm::length(glm::vec3(transformation[0])),
+                                std::min(glm::length(glm::vec3(transformation[1])), glm::length(glm::vec3(transformation[2]))));
+        return model->getMeshBvh().sweepSphere(glm::vec3(toModel * glm::vec4(from, 1.0f)), glm::vec3(toModel * glm::vec4(to, 1.0f)), radius / shrink);
     }
 
-    glm::vec3 getCenter()
+    const Model* getModel() const
     {
-        return center;
+        return model.get();
     }
 
-    glm::vec3 getPosition()
+    Model* getModel()
     {
-        return position;
+        return model.get();
     }
-};
 
-int main()
-{
-    // Inicializar GLFW
-    if (!glfwInit()) {
-        std::cerr << "Error al inicializar GLFW" << std::endl;
-        return -1;
+    const glm::mat4x4& getTransformation() const
+    {
+        return transformation;
     }
 
-    // Crear ventana
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Cargador de múltiples OBJ", NULL, NULL);
-    if (window == NULL) {
-        std::cerr << "Error al crear la ventana GLFW" << std::endl;
-        glfwTerminate();
-        return -1;
+    // LOD for a camera at eye whose projection maps one unit at distance 1 to
+    // pixelScale pixels
+    size_t selectLod(const glm::vec3& eye, float pixelScale) const
+    {
+        glm::vec4 sphere = getBoundingSphere();
+        float distance = std::max(glm::length(glm::vec3(sphere) - eye) - sphere.w, 1e-3f);
+        float stretch = sphere.w / std::max(model->getBounds().w, 1e-6f);
+        return model->selectLod(pixelScale * stretch / distance);
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetKeyCallback(window, processKeyInput);
 
-    // Inicializar GLAD
-    if (!gladLoadGL(glfwGetProcAddress))
+    // Texture detail for the object's size on screen: a model unit at
+    // geodesic distance d covers pixelScale * scale / sinK(d) pixels, which in
+    // S3 grows again past pi / 2, towards the antipode
+    template <class Geometry>
+    void requestMips(const glm::vec3& eye, float pixelScale) const
     {
-        std::cout << "Error al inicializar GLAD.\n";
-        glfwTerminate();
-        return -1;
+        glm::vec4 sphere = getBoundingSphere();
+        float scale = Geometry::curvature == 0 ? 1.0f : GLOBAL_SCALE;
+        float distance = Geometry::distance(Geometry::port(eye, GLOBAL_SCALE), Geometry::port(glm::vec3(sphere), GLOBAL_SCALE));
+        distance = std::max(distance - sphere.w * scale, 1e-3f * scale);
+        float stretch = sphere.w / std::max(model->getBounds().w, 1e-6f);
+        model->requestMips(pixelScale * stretch * scale / std::max(std::abs(Geometry::sinK(distance)), 1e-3f * scale));
     }
 
-    // Flipping the image
-    stbi_set_flip_vertically_on_load(true);
+    void draw(size_t lod = 0)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(activeProgram, "model"), 1, GL_FALSE, glm::value_ptr(transformation));
+        model->draw(lod);
+    }
 
-    // Compilar shaders
-    GLuint vertexShader = loadShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-    programs[0] = glCreateProgram();
-    glAttachShader(programs[0], vertexShader);
-    glAttachShader(programs[0], fragmentShader);
-    glLinkProgram(programs[0]);
-
-    // Comprobar errores de enlace
-    int success;
-    char infoLog[512];
-    glGetProgramiv(programs[0], GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(programs[0], 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    void drawUncounted(size_t lod = 0)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(activeProgram, "model"), 1, GL_FALSE, glm::value_ptr(transformation));
+        model->drawUncounted(lod);
+    }
 
-    // Segundo Shader NO EUCLIDEANO
-    vertexShader = loadShader(GL_VERTEX_SHADER, vertexShaderSource2);
-    fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentShaderSource2);
-    programs[1] = glCreateProgram();
-    glAttachShader(programs[1], vertexShader);
-    glAttachShader(programs[1], fragmentShader);
-    glLinkProgram(programs[1]);
-
-    glGetProgramiv(programs[1], GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(programs[1], 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    glUseProgram(programs[1]);
-
-    glUniform1f(glGetUniformLocation(programs[1], "scale"), GLOBAL_SCALE);
-    glUniform1f(glGetUniformLocation(programs[1], "curv"), 1.0f);
-
-    // Relative Path
-	std::filesystem::path p = std::filesystem::current_path();
-	int levels_path = 1;
-	std::filesystem::path p_current;
-	p_current = p.parent_path();
-
-	for (int i = 0; i < levels_path; i++)
-	{
-		p_current = p_current.parent_path();
-	}
+    void drawInstanced(GLuint offsetBuffer, GLsizei count)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(activeProgram, "model"), 1, GL_FALSE, glm::value_ptr(transformation));
+        model->drawInstanced(offsetBuffer, count);
+    }
 
-	std::string vs_path, fs_path;
+    // Needs a BAKED program; the positions are baked in the background the
+    // first time and again after a change of transform or scale
+    void drawBaked(float scale)
+    {
+        if (!baked)
+        {
+            baked = std::make_unique<BakedPositions>(*model, transformation, scale);
+            residency.add(*baked);
+        }
+        baked->draw(scale);
+    }
+};
 
-	std::stringstream ss;
-	ss << std::quoted(p_current.string());
-	ss >> std::quoted(out);
+class Camera
+{
+    glm::vec3 position;
+    glm::vec3 center;
 
-    out += "\\glfw-master\\OwnProjects\\Project_13\\Models\\";
-	std::cout << "Assets path: " << out << "\n";
+    glm::mat4x4 viewMatrix;
+    glm::mat4x4 projMatrix;
+
+    float fovy, aspect, near, far;
+
+    template <class Geometry>
+    void updateViewMatrix()
+    {
+        TRACE_SCOPE("Camera::updateViewMatrix");
+        viewMatrix = Geometry::view(position, center, glm::vec3(0.0f, 0.1f, 0.0f), GLOBAL_SCALE);
+    }
+
+    template <class Geometry>
+    void updateProjectionMatrix()
+    {
+        TRACE_SCOPE("Camera::updateProjectionMatrix");
+        projMatrix = Geometry::projection(fovy, aspect, near, far, GLOBAL_SCALE);
+    }
+
+    void updateViewMatrix()
+    {
+        dispatchGeometry(mode, [this](auto geometry) { this->updateViewMatrix<decltype(geometry)>(); });
+    }
+
+    void updateProjectionMatrix()
+    {
+        dispatchGeometry(mode, [this](auto geometry) { this->updateProjectionMatrix<decltype(geometry)>(); });
+    }
+
+public:
+    Camera(const glm::vec3& _position, const glm::vec3& _center, float _fovy, float _aspect, float _near, float _far) :
+        position(_position), center(_center), fovy(_fovy), aspect(_aspect), near(_near), far(_far)
+    {
+        updateViewMatrix();
+        updateProjectionMatrix();
+    }
+
+    void move(const glm::vec3& amount)
+    {
+        center += amount;
+        position += amount;
+
+        updateViewMatrix();
+    }
+
+    void turn(const glm::vec3& amount)
+    {
+        center += amount;
+
+        updateViewMatrix();
+    }
+
+    void update()
+    {
+        updateViewMatrix();
+        updateProjectionMatrix();
+    }
+
+    void set(const glm::vec3& _position, const glm::vec3& _center)
+    {
+        position = _position;
+        center = _center;
+
+        updateViewMatrix();
+    }
+
+    glm::vec3 getCenter()
+    {
+        return center;
+    }
+
+    glm::vec3 getPosition()
+    {
+        return position;
+    }
+
+    const glm::mat4x4& getViewMatrix() const
+    {
+        return viewMatrix;
+    }
+
+    const glm::mat4x4& getProjectionMatrix() const
+    {
+        return projMatrix;
+    }
+
+    float getFar() const
+    {
+        return far;
+    }
+
+    float getFovy() const
+    {
+        return fovy;
+    }
+};
+
+// Binds a program and uploads the camera matrices to it
+void useProgram(GLuint program)
+{
+    activeProgram = program;
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(camera->getViewMatrix()));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(camera->getProjectionMatrix()));
+}
+
+std::string profileOut, traceOut;
+bool bakeStatic = false; // B: draw static objects from baked S3 positions
+float cellRadius = 1.5f; // H3: honeycomb cells reaching within this distance are drawn
+Bvh objectBvh; // objects' bounding boxes; update() an object's box after moving it
+float torusSize = 120.0f, torusBudget = 600.0f; // 3-torus: box side and draw distance
+std::vector<Object>* sceneObjects = nullptr; // for collision and picking from the input callbacks
+std::string terrainName; // --terrain: virtual texture (.vtex) of the ground, none if empty
+float terrainSize = 400.0f; // side of the ground, in world units
+
+// Ground under the scene (--terrain): a flat grid terrainSize units across,
+// the virtual texture stretched once over it. Only the Euclidean view draws
+// it, and runs the feedback pass it needs.
+class Terrain
+{
+    GlVertexArray vao;
+    GlBuffer vbo, ebo;
+    GLsizei indexCount = 0;
+    std::unique_ptr<VirtualTexture> texture;
+
+public:
+    // Reads the virtual texture and builds the grid at height y; render
+    // thread, false if the texture failed to load
+    bool create(const std::string& directory, const std::string& name, float size, float y)
+    {
+        Task<Expected<std::unique_ptr<VirtualTexture>>> load = VirtualTexture::load(directory, name, textureCompression);
+        Expected<std::unique_ptr<VirtualTexture>> loaded = runUntilDone(load);
+        if (!loaded)
+        {
+            std::cerr << loaded.error() << "\n(las texturas virtuales se precompilan con asset_baker --virtual)" << std::endl;
+            return false;
+        }
+        texture = std::move(*loaded);
+
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+        for (int z = 0; z <= TERRAIN_GRID; z++)
+            for (int x = 0; x <= TERRAIN_GRID; x++)
+            {
+                float u = float(x) / TERRAIN_GRID, v = float(z) / TERRAIN_GRID;
+                vertices.insert(vertices.end(), { (u - 0.5f) * size, y, (0.5f - v) * size, u, v });
+            }
+        for (unsigned int z = 0; z < TERRAIN_GRID; z++)
+            for (unsigned int x = 0; x < TERRAIN_GRID; x++)
+            {
+                unsigned int corner = z * (TERRAIN_GRID + 1) + x, above = corner + TERRAIN_GRID + 1;
+                indices.insert(indices.end(), { corner, corner + 1, above + 1, corner, above + 1, above });
+            }
+        indexCount = GLsizei(indices.size());
+
+        vao = GlVertexArray::create();
+        vbo = GlBuffer::create();
+        ebo = GlBuffer::create();
+        glBindVertexArray(vao.get());
+        glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "Terrain " << name << ": " << texture->getSize() << "x" << texture->getSize() << " virtual texels over " << size
+                  << " units; " << texture->getStats() << "\n";
+        return true;
+    }
+
+    void release()
+    {
+        if (texture)
+            std::cout << "Virtual texture: " << texture->getStats() << "\n";
+        texture.reset();
+        vao.reset();
+        vbo.reset();
+        ebo.reset();
+    }
+
+    bool isLoaded() const
+    {
+        return texture != nullptr;
+    }
+
+    VirtualTexture& getTexture()
+    {
+        return *texture;
+    }
+
+    // Needs a VIRTUAL_TEXTURE program; counted false for the feedback pass
+    void draw(bool counted = true)
+    {
+        TRACE_SCOPE("Terrain::draw");
+        glm::mat4x4 identity(1.0f);
+        glUniformMatrix4fv(glGetUniformLocation(activeProgram, "model"), 1, GL_FALSE, glm::value_ptr(identity));
+        texture->bind(activeProgram);
+        glBindVertexArray(vao.get());
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr);
+        glBindVertexArray(0);
+        texture->unbind();
+
+        if (!counted)
+            return;
+        renderStats.draws++;
+        renderStats.triangles += size_t(indexCount) / 3;
+    }
+};
+
+Terrain terrain;
+
+void dumpProfile()
+{
+    if (profileOut.empty())
+    {
+        profiler.dump(std::cout);
+        portalScene.dump(std::cout);
+        if (terrain.isLoaded())
+            std::cout << "Virtual texture: " << terrain.getTexture().getStats() << "\n";
+        return;
+    }
+    std::ofstream file(profileOut, std::ios::app);
+    profiler.dump(file);
+    portalScene.dump(file);
+    if (terrain.isLoaded())
+        file << "Virtual texture: " << terrain.getTexture().getStats() << "\n";
+    std::cout << "Profile appended to " << profileOut << "\n";
+}
+
+void finishTrace()
+{
+    if (!traceOut.empty())
+        tracer.write(traceOut);
+}
+
+// Texture levels for this frame's view, from each object's size on screen
+template <class Geometry>
+void requestMips(const std::vector<Object>& objects)
+{
+    float pixelScale = WINDOW_HEIGHT / (2.0f * std::tan(camera->getFovy() * 0.5f));
+    for (const Object& object : objects)
+        object.requestMips<Geometry>(camera->getPosition(), pixelScale);
+}
+
+// Euclidean: only the objects whose bounds reach the view frustum, each at
+// the coarsest LOD that stays within LOD_PIXEL_ERROR; counted: false for
+// extra passes, which leave renderStats and the residency order alone
+void drawVisible(std::vector<Object>& objects, bool counted = true)
+{
+    static std::vector<uint32_t> visible;
+    objectBvh.frustum(Frustum(camera->getProjectionMatrix() * camera->getViewMatrix()), visible);
+    float pixelScale = WINDOW_HEIGHT / (2.0f * std::tan(camera->getFovy() * 0.5f));
+    glm::vec3 eye = camera->getPosition();
+    for (uint32_t i : visible)
+    {
+        size_t lod = objects[i].selectLod(eye, pixelScale);
+        if (counted)
+            objects[i].draw(lod);
+        else
+            objects[i].drawUncounted(lod);
+    }
+}
+
+void drawTerrain()
+{
+    ProfileScope scope("terrain");
+    ShaderKey key = { SHADER_EUCLIDEAN };
+    key.virtualTexture = true;
+    useProgram(shaderPermutations.get(key));
+    terrain.draw();
+}
+
+// Virtual texture pages this frame's view needs: the visible objects, which
+// only hide ground, and the terrain into the small feedback target; the page
+// cache then takes in what has arrived and asks for what is missing
+void renderFeedback(std::vector<Object>& objects)
+{
+    ProfileScope scope("feedback");
+    VirtualTexture& texture = terrain.getTexture();
+    texture.beginFeedback();
+    ShaderKey key = { SHADER_EUCLIDEAN };
+    key.feedback = true;
+    useProgram(shaderPermutations.get(key));
+    drawVisible(objects, false);
+    key.virtualTexture = true;
+    useProgram(shaderPermutations.get(key));
+    terrain.draw(false);
+    texture.endFeedback();
+    texture.update();
+}
+
+void drawObjects(std::vector<Object>& objects, bool baked)
+{
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        if (baked)
+            objects[i].drawBaked(GLOBAL_SCALE);
+        else
+            objects[i].draw();
+    }
+}
+
+// H3: the scene is repeated in every honeycomb cell near the camera, each
+// copy drawn with the cell's isometry folded into the view matrix
+void drawHoneycomb(std::vector<Object>& objects)
+{
+    glm::vec4 eye = Hyperbolic::port(camera->getPosition(), GLOBAL_SCALE);
+    const std::vector<int>& cells = honeycomb.visit(eye, cellRadius, HONEYCOMB_MAX_VISIBLE);
+    GLint viewLocation = glGetUniformLocation(activeProgram, "view");
+    for (int cell : cells)
+    {
+        glm::mat4x4 view = camera->getViewMatrix() * honeycomb.getCell(cell).transform;
+        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
+        drawObjects(objects, false);
+    }
+    renderStats.cells += cells.size();
+}
+
+// Elliptic space: one draw per object, as the representative (p or -p) in
+// front of the camera. Only objects crossing the camera's side plane z = 0,
+// which have a visible part in both, are drawn twice.
+void drawElliptic(std::vector<Object>& objects, bool baked)
+{
+    GLint antiLocation = glGetUniformLocation(activeProgram, "anti");
+    for (Object& object : objects)
+    {
+        glm::vec4 sphere = object.getBoundingSphere();
+        glm::vec4 center = camera->getViewMatrix() * Spherical::port(glm::vec3(sphere), GLOBAL_SCALE);
+        float reach = std::sin(std::min(sphere.w * GLOBAL_SCALE, 1.5707963f));
+        for (float anti : { 1.0f, -1.0f })
+        {
+            if (anti * center.z >= reach)
+                continue;
+            glUniform1f(antiLocation, anti);
+            if (baked)
+                object.drawBaked(GLOBAL_SCALE);
+            else
+                object.draw();
+        }
+    }
+}
+
+// 3-torus: every box copy that survives the distance and frustum tests goes
+// into one offset table, and each object is drawn once for all of them
+void drawTorus(std::vector<Object>& objects)
+{
+    if (objects.empty())
+        return;
+    glm::vec4 scene = objects[0].getBoundingSphere();
+    for (size_t i = 1; i < objects.size(); i++)
+    {
+        glm::vec4 sphere = objects[i].getBoundingSphere();
+        float d = glm::length(glm::vec3(sphere) - glm::vec3(scene));
+        if (d + sphere.w <= scene.w)
+            continue;
+        if (d + scene.w <= sphere.w)
+        {
+            scene = sphere;
+            continue;
+        }
+        float radius = (d + scene.w + sphere.w) * 0.5f;
+        scene = glm::vec4(glm::vec3(scene) + (glm::vec3(sphere) - glm::vec3(scene)) * ((radius - scene.w) / d), radius);
+    }
+
+    const std::vector<glm::vec3>& copies =
+        torusSpace.update(camera->getPosition(), camera->getProjectionMatrix() * camera->getViewMatrix(), scene);
+    renderStats.cells += copies.size();
+    if (copies.empty())
+        return;
+    GLuint offsets = torusSpace.upload();
+    for (Object& object : objects)
+        object.drawInstanced(offsets, GLsizei(copies.size()));
+}
+
+// Portal scene: the objects are drawn once per portal level they are seen
+// in, with that level's view, projection and stencil value
+void drawPortals(std::vector<Object>& objects)
+{
+    std::vector<glm::vec4> spheres;
+    for (const Object& object : objects)
+        spheres.push_back(object.getBoundingSphere());
+    ShaderKey quadKey = { SHADER_EUCLIDEAN };
+    quadKey.textured = false;
+    glClear(GL_STENCIL_BUFFER_BIT);
+    portalScene.render(camera->getPosition(), camera->getViewMatrix(), camera->getProjectionMatrix(), shaderPermutations.get(quadKey),
+                       activeProgram, BACKGROUND_COLOR, spheres, [&](size_t i) { objects[i].draw(); });
+    renderStats.cells += portalScene.getViews();
+}
+
+template <class Geometry>
+void renderScene(std::vector<Object>& objects)
+{
+    // S3 has no antipodal identification: every object is drawn again at -p
+    constexpr bool antipodal = Geometry::curvature > 0 && !Geometry::identifiesAntipodes;
+    bool baked = bakeStatic && Geometry::curvature > 0;
+    ShaderKey bakedKey = { Geometry::shaderGeometry };
+    bakedKey.baked = true;
+    ShaderKey instancedKey = { Geometry::shaderGeometry };
+    instancedKey.instanced = true;
+    if (Geometry::periodic)
+        useProgram(shaderPermutations.get(instancedKey));
+    else
+        useProgram(baked ? shaderPermutations.get(bakedKey) : programs[Geometry::shaderGeometry]);
+
+    // Renderizar
+    if constexpr (Geometry::portals)
+    {
+        ProfileScope scope("portals");
+        drawPortals(objects);
+    }
+    else if constexpr (Geometry::periodic)
+    {
+        ProfileScope scope("torus");
+        drawTorus(objects);
+    }
+    else if constexpr (Geometry::curvature < 0)
+    {
+        ProfileScope scope("honeycomb");
+        drawHoneycomb(objects);
+    }
+    else if constexpr (Geometry::identifiesAntipodes)
+    {
+        ProfileScope scope(baked ? "elliptic (baked)" : "elliptic");
+        drawElliptic(objects, baked);
+    }
+    else
+    {
+        ProfileScope scope(baked ? "opaque (baked)" : "opaque");
+        if (antipodal)
+            glUniform1f(glGetUniformLocation(activeProgram, "anti"), 1.0f);
+        if constexpr (Geometry::curvature == 0)
+        {
+            drawVisible(objects);
+            if (terrain.isLoaded())
+                drawTerrain();
+        }
+        else
+            drawObjects(objects, baked);
+    }
 
+    if constexpr (antipodal)
+    {
+        ProfileScope scope(baked ? "antipodal (baked)" : "antipodal");
+        glUniform1f(glGetUniformLocation(activeProgram, "anti"), -1.0f);
+        drawObjects(objects, baked);
+    }
+}
+
+void renderFrame(std::vector<Object>& objects)
+{
+    TRACE_SCOPE("renderFrame");
+    profiler.newFrame();
+    {
+        ProfileScope scope("clear");
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    dispatchGeometry(mode, [&](auto geometry) {
+        requestMips<decltype(geometry)>(objects);
+        if constexpr (std::is_same_v<decltype(geometry), Euclidean>)
+            if (terrain.isLoaded())
+                renderFeedback(objects);
+        renderScene<decltype(geometry)>(objects);
+    });
+    residency.endFrame();
+}
+
+// Texture of a model for the CPU renderers: level 0 of the baked texture,
+// from the asset pack or the loose file, decoded once
+const RayTexture* rayTexture(const Model& model)
+{
+    const std::string& name = model.getTextureName();
+    return rayTracer.texture(name, [&](RayTexture& texture) {
+        Task<Expected<std::vector<unsigned char>>> read = readAsset(out, name);
+        Expected<std::vector<unsigned char>> bytes = runUntilDone(read);
+        if (!bytes)
+            return false;
+        Expected<TextureData> baked = readBakedTexture(*bytes, name);
+        if (!baked)
+            return false;
+        decodeTexture(*baked);
+        TextureLevel& level = baked->levels[0];
+        texture.assign(int(level.width), int(level.height), std::move(level.data));
+        return true;
+    });
+}
+
+// Hands the objects to the ray tracer, with the honeycomb cells drawn around
+// the camera as copies in H3. Returns how far a geodesic is followed: all
+// the way around S3, half of that in elliptic space, the far plane in H3.
+// The ray tracer points into meshes, which must outlive its use.
+template <class Geometry>
+float loadRayScene(std::vector<std::shared_ptr<const Model::CpuMesh>>& meshes)
+{
+    rayTracer.clear();
+    meshes.clear();
+    for (Object& object : *sceneObjects)
+    {
+        Model* model = object.getModel();
+        Expected<std::shared_ptr<const Model::CpuMesh>> cpu = model->readCpuMesh();
+        if (!cpu)
+        {
+            std::cerr << cpu.error() << std::endl;
+            continue;
+        }
+        meshes.push_back(*cpu);
+        const MeshBvh& mesh = model->getMeshBvh();
+        rayTracer.add({ &mesh, &(*cpu)->vertices, &(*cpu)->indices, 5, rayTexture(*model), mesh.place<Geometry>(object.getTransformation(), GLOBAL_SCALE) });
+    }
+    if (Geometry::curvature > 0)
+        return Geometry::identifiesAntipodes ? 3.14159265f : 2.0f * 3.14159265f;
+
+    std::vector<glm::mat4x4> copies;
+    for (int cell : honeycomb.visit(Hyperbolic::port(camera->getPosition(), GLOBAL_SCALE), cellRadius, HONEYCOMB_MAX_VISIBLE))
+        copies.push_back(honeycomb.getCell(cell).transform);
+    rayTracer.setCopies(copies);
+    return camera->getFar() * GLOBAL_SCALE;
+}
+
+// CPU reference render of the current view to a PNG (curved modes)
+template <class Geometry>
+void raytraceView(const std::string& path, unsigned threads)
+{
+    if constexpr (Geometry::curvature == 0)
+        std::cerr << "El trazado de rayos solo admite los modos curvos" << std::endl;
+    else
+    {
+        std::vector<unsigned char> rgb;
+        std::vector<std::shared_ptr<const Model::CpuMesh>> meshes;
+        float tMax = loadRayScene<Geometry>(meshes);
+        RayTracer::Stats stats = rayTracer.render<Geometry>(camera->getViewMatrix(), camera->getProjectionMatrix(), tMax, BACKGROUND_COLOR,
+                                                            int(WINDOW_WIDTH), int(WINDOW_HEIGHT), threads, rgb);
+        rayTracer.clear();
+        std::cout << "Ray traced " << stats << "\n";
+        if (writePng(path, int(WINDOW_WIDTH), int(WINDOW_HEIGHT), rgb))
+            std::cout << "Image written to " << path << "\n";
+        else
+            std::cerr << "Error al escribir la imagen: " << path << std::endl;
+    }
+}
+
+// CPU render of the current view to a PNG with the software rasterizer
+// (Euclidean and S3)
+template <class Geometry>
+void rasterizeView(const std::string& path)
+{
+    if constexpr (Geometry::curvature < 0 || Geometry::identifiesAntipodes)
+        std::cerr << "El rasterizador por software solo admite los modos euclideo y esferico" << std::endl;
+    else
+    {
+        std::vector<Rasterizer::Item> items;
+        std::vector<std::shared_ptr<const Model::CpuMesh>> meshes; // the items point into them
+        for (Object& object : *sceneObjects)
+        {
+            Model* model = object.getModel();
+            Expected<std::shared_ptr<const Model::CpuMesh>> cpu = model->readCpuMesh();
+            if (!cpu)
+            {
+                std::cerr << cpu.error() << std::endl;
+                continue;
+            }
+            meshes.push_back(*cpu);
+            items.push_back({ &(*cpu)->vertices, 5, &(*cpu)->indices, rayTexture(*model), object.getTransformation() });
+        }
+        Rasterizer::Stats stats = rasterizer.draw<Geometry>(items, camera->getViewMatrix(), camera->getProjectionMatrix(), GLOBAL_SCALE,
+                                                            BACKGROUND_COLOR, int(WINDOW_WIDTH), int(WINDOW_HEIGHT));
+        std::cout << "Rasterized " << stats << "\n";
+        if (writePng(path, int(WINDOW_WIDTH), int(WINDOW_HEIGHT), rasterizer.getColor()))
+            std::cout << "Image written to " << path << "\n";
+        else
+            std::cerr << "Error al escribir la imagen: " << path << std::endl;
+    }
+}
+
+// Loads the models and places the objects; upload false keeps everything on
+// the CPU. Called on the render thread; false if a model failed to load.
+// Models stay in modelRegistry until releaseScene().
+bool createScene(std::vector<Object>& objects, bool upload)
+{
     // Cargar modelos
-    std::vector<Model> models;
-    models.push_back(Model(out + "stylized_house_OBJ.obj", out + "house_texture.png"));
+    Task<Expected<std::shared_ptr<Model>>> house = loadModel(out, "stylized_house_OBJ.mesh", "house_texture.tex", upload);
+    Expected<std::shared_ptr<Model>> loaded = runUntilDone(house);
+    if (!loaded)
+    {
+        std::cerr << loaded.error() << "\n(los modelos se precompilan con asset_baker)" << std::endl;
+        return false;
+    }
 
     // Crear objetos
-    std::vector<Object> objects;
-
     objects.push_back(
-        Object(&models[0], // House
+        Object(*loaded, // House
             glm::mat4x4(1.0f)
         )
     );
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-    glUseProgram(programs[mode]);
+    std::vector<Bvh::Box> objectBoxes;
+    for (const Object& object : objects)
+        objectBoxes.push_back(Bvh::Box::fromSphere(object.getBoundingSphere()));
+    objectBvh.build(objectBoxes);
+    sceneObjects = &objects;
+
+    // Terreno bajo el punto mas bajo de la escena
+    if (upload && !terrainName.empty())
+    {
+        float lowest = FLT_MAX;
+        for (const Object& object : objects)
+        {
+            Expected<std::shared_ptr<const Model::CpuMesh>> cpu = object.getModel()->readCpuMesh();
+            if (!cpu)
+            {
+                std::cerr << cpu.error() << std::endl;
+                return false;
+            }
+            const std::vector<float>& vertices = (*cpu)->vertices;
+            for (size_t v = 0; v + 5 <= vertices.size(); v += 5)
+                lowest = std::min(lowest, (object.getTransformation() * glm::vec4(vertices[v], vertices[v + 1], vertices[v + 2], 1.0f)).y);
+        }
+        if (!terrain.create(out, terrainName, terrainSize, lowest == FLT_MAX ? 0.0f : lowest))
+            return false;
+    }
 
-    camera = new Camera(
+    std::cout << "Derived cache: " << derivedCache.getStats() << "\n";
+    std::cout << "Model registry: " << modelRegistry.getStats() << "\n";
+    std::cout << "Texture registry: " << textureRegistry.getStats() << "\n";
+    if (upload)
+        std::cout << "Residency: " << residency.getStats() << "\n";
+    return true;
+}
+
+// Drops the objects and the registries' references, deleting the GL objects;
+// the context must still be current
+void releaseScene(std::vector<Object>& objects)
+{
+    std::cout << "Residency: " << residency.getStats() << "\n";
+    terrain.release();
+    torusSpace.release();
+    sceneObjects = nullptr;
+    objects.clear();
+    modelRegistry.clear();
+    textureRegistry.clear();
+}
+
+Camera* createCamera()
+{
+    return new Camera(
         glm::vec3(0.0f, 0.0f, 5.0f),
         glm::vec3(0.0f, 0.0f, 0.0f),
         glm::radians(45.0f), WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, 1000.0f);
+}
+
+int main(int argc, char** argv)
+{
+    // Opciones: --benchmark [frames] [--benchmark-path file] [--benchmark-out file] [--profile-out file] [--trace file] [--bake] [--validate-math]
+    //           [--cell-radius r] [--bench-honeycomb] [--torus-size s] [--torus-budget d] [--portals file] [--portal-depth n]
+    //           [--bench-bvh [objects]] [--bench-mesh-bvh] [--no-bvh-cache] [--raytrace file.png] [--raytrace-mode n] [--raytrace-threads n]
+    //           [--rasterize file.png] [--rasterize-mode n] [--bench-jobs] [--job-threads n]
+    //           [--pack file] [--assets dir] [--cache dir] [--cache-limit mb] [--no-cache] [--gpu-budget mb]
+    //           [--terrain file.vtex] [--terrain-size s]
+    int benchmarkFrames = 0;
+    std::string benchmarkPath, benchmarkOut, portalsPath, packPath, assetsPath;
+    std::string cachePath = DERIVED_CACHE_DIRECTORY;
+    uint64_t cacheLimit = DERIVED_CACHE_LIMIT;
+    bool benchMeshBvh = false;
+    std::string raytraceOut;
+    int raytraceMode = SPACE_SPHERICAL;
+    unsigned raytraceThreads = 0;
+    std::string rasterizeOut;
+    int rasterizeMode = SPACE_EUCLIDEAN;
+    unsigned jobThreads = 0;
+    bool benchJobs = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--benchmark")
+        {
+            benchmarkFrames = 600;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]))
+                benchmarkFrames = std::atoi(argv[++i]);
+        }
+        else if (arg == "--benchmark-path" && i + 1 < argc)
+            benchmarkPath = argv[++i];
+        else if (arg == "--benchmark-out" && i + 1 < argc)
+            benchmarkOut = argv[++i];
+        else if (arg == "--profile-out" && i + 1 < argc)
+            profileOut = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc)
+            traceOut = argv[++i];
+        else if (arg == "--bake")
+            bakeStatic = true;
+        else if (arg == "--validate-math")
+            return validateCurvedMath(std::cout) ? 0 : 1;
+        else if (arg == "--cell-radius" && i + 1 < argc)
+            cellRadius = float(std::atof(argv[++i]));
+        else if (arg == "--torus-size" && i + 1 < argc)
+            torusSize = float(std::atof(argv[++i]));
+        else if (arg == "--torus-budget" && i + 1 < argc)
+            torusBudget = float(std::atof(argv[++i]));
+        else if (arg == "--pack" && i + 1 < argc)
+            packPath = argv[++i];
+        else if (arg == "--assets" && i + 1 < argc)
+            assetsPath = argv[++i];
+        else if (arg == "--cache" && i + 1 < argc)
+            cachePath = argv[++i];
+        else if (arg == "--cache-limit" && i + 1 < argc)
+            cacheLimit = uint64_t(std::atof(argv[++i]) * 1024.0 * 1024.0);
+        else if (arg == "--no-cache")
+            cachePath.clear();
+        else if (arg == "--gpu-budget" && i + 1 < argc)
+            residency.setBudget(uint64_t(std::atof(argv[++i]) * 1024.0 * 1024.0));
+        else if (arg == "--terrain" && i + 1 < argc)
+            terrainName = argv[++i];
+        else if (arg == "--terrain-size" && i + 1 < argc)
+            terrainSize = float(std::atof(argv[++i]));
+        else if (arg == "--portals" && i + 1 < argc)
+            portalsPath = argv[++i];
+        else if (arg == "--portal-depth" && i + 1 < argc)
+            portalScene.setMaxDepth(std::atoi(argv[++i]));
+        else if (arg == "--bench-bvh")
+        {
+            size_t count = 100000;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]))
+                count = size_t(std::atol(argv[++i]));
+            benchmarkBvh(std::cout, count);
+            return 0;
+        }
+        else if (arg == "--bench-mesh-bvh")
+            benchMeshBvh = true;
+        else if (arg == "--raytrace" && i + 1 < argc)
+            raytraceOut = argv[++i];
+        else if (arg == "--raytrace-mode" && i + 1 < argc)
+            raytraceMode = std::atoi(argv[++i]);
+        else if (arg == "--raytrace-threads" && i + 1 < argc)
+            raytraceThreads = unsigned(std::atoi(argv[++i]));
+        else if (arg == "--rasterize" && i + 1 < argc)
+            rasterizeOut = argv[++i];
+        else if (arg == "--rasterize-mode" && i + 1 < argc)
+            rasterizeMode = std::atoi(argv[++i]);
+        else if (arg == "--job-threads" && i + 1 < argc)
+            jobThreads = unsigned(std::atoi(argv[++i]));
+        else if (arg == "--bench-jobs")
+            benchJobs = true;
+        else if (arg == "--no-bvh-cache")
+            meshBvhCache = false;
+        else if (arg == "--bench-honeycomb")
+        {
+            benchmarkHoneycomb(std::cout, GLOBAL_SCALE);
+            return 0;
+        }
+        else
+            std::cerr << "Opcion desconocida: " << arg << std::endl;
+    }
+
+    // Hilos del sistema de tareas (0: uno por nucleo); el hilo principal es el numero 0
+    jobSystem.start(jobThreads);
+    if (benchJobs)
+    {
+        benchmarkJobs(std::cout);
+        return 0;
+    }
+
+    // Cache de datos derivados (vacia: desactivada)
+    derivedCache.open(cachePath, cacheLimit);
+
+#ifdef ENABLE_TRACING
+    if (!traceOut.empty())
+        tracer.start();
+#else
+    if (!traceOut.empty())
+        std::cerr << "--trace requiere compilar con ENABLE_TRACING" << std::endl;
+#endif
+
+    // Salida de asset_baker, no los modelos originales: --assets, si no
+    // Baked/ junto al ejecutable, si no Baked/ en el directorio de trabajo
+    std::filesystem::path assets = assetsPath;
+    if (assets.empty())
+    {
+        std::error_code error;
+        std::filesystem::path beside = std::filesystem::absolute(argv[0], error).parent_path() / ASSETS_DIRECTORY;
+        assets = !error && std::filesystem::is_directory(beside, error) ? beside : std::filesystem::path(ASSETS_DIRECTORY);
+    }
+    out = (assets / "").string();
+	std::cout << "Assets path: " << out << "\n";
+
+    // Paquete de recursos: lo que contiene ya no se lee de los archivos sueltos
+    if (packPath.empty() && std::filesystem::exists(ASSET_PACK_FILE))
+        packPath = ASSET_PACK_FILE;
+    if (!packPath.empty())
+    {
+        Expected<size_t> entries = assetPack.open(packPath);
+        if (!entries)
+        {
+            std::cerr << entries.error() << std::endl;
+            return -1;
+        }
+        std::cout << "Asset pack " << packPath << ": " << *entries << " entries\n";
+    }
+
+    // Panal {4,3,5} para el modo hiperbolico
+    auto honeycombStart = std::chrono::steady_clock::now();
+    honeycomb.build(cellRadius + HONEYCOMB_MARGIN, HONEYCOMB_MAX_CELLS);
+    std::cout << "Honeycomb {4,3,5}: " << honeycomb.size() << " cells in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - honeycombStart).count() << " ms\n";
+
+    if (!torusSpace.configure(torusSize, torusBudget, TORUS_MAX_COPIES))
+    {
+        std::cerr << "Tamano o distancia del toro no validos: " << torusSize << ", " << torusBudget << std::endl;
+        return -1;
+    }
+    if (!portalsPath.empty() && !portalScene.load(portalsPath))
+    {
+        std::cerr << "Error al cargar los portales: " << portalsPath << std::endl;
+        return -1;
+    }
+
+    // Flipping the image
+    stbi_set_flip_vertically_on_load(true);
+
+    // Sin ventana: banco de pruebas del BVH, trazado de rayos o rasterizado por software de la vista inicial
+    if (benchMeshBvh || !raytraceOut.empty() || !rasterizeOut.empty())
+    {
+        std::vector<Object> objects;
+        if (!createScene(objects, false))
+            return -1;
+        camera = createCamera();
+        if (benchMeshBvh)
+        {
+            Expected<std::shared_ptr<const Model::CpuMesh>> cpu = objects[0].getModel()->readCpuMesh();
+            if (cpu)
+                benchmarkMeshBvh(std::cout, (*cpu)->vertices, 5, (*cpu)->indices, GLOBAL_SCALE);
+            else
+                std::cerr << cpu.error() << std::endl;
+        }
+        if (!raytraceOut.empty())
+        {
+            mode = SpaceMode(std::clamp(raytraceMode, 0, SPACE_MODE_COUNT - 1));
+            camera->update();
+            dispatchGeometry(mode, [&](auto geometry) { raytraceView<decltype(geometry)>(raytraceOut, raytraceThreads); });
+        }
+        if (!rasterizeOut.empty())
+        {
+            mode = SpaceMode(std::clamp(rasterizeMode, 0, SPACE_MODE_COUNT - 1));
+            camera->update();
+            dispatchGeometry(mode, [&](auto geometry) { rasterizeView<decltype(geometry)>(rasterizeOut); });
+        }
+        finishTrace();
+        return 0;
+    }
+
+    // Inicializar GLFW
+    if (!glfwInit()) {
+        std::cerr << "Error al inicializar GLFW" << std::endl;
+        return -1;
+    }
+
+    // Crear ventana
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8); // portal levels
+    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Cargador de múltiples OBJ", NULL, NULL);
+    if (window == NULL) {
+        std::cerr << "Error al crear la ventana GLFW" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetKeyCallback(window, processKeyInput);
+    glfwSetMouseButtonCallback(window, processMouseInput);
+
+    // Inicializar GLAD
+    if (!gladLoadGL(glfwGetProcAddress))
+    {
+        std::cout << "Error al inicializar GLAD.\n";
+        glfwTerminate();
+        return -1;
+    }
+
+    // Texturas precompiladas BC1/BC3: sin S3TC se descomprimen al cargarlas
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions && !textureCompression; i++)
+        textureCompression = std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, GLuint(i)), "GL_EXT_texture_compression_s3tc") == 0;
+    std::cout << "S3TC textures: " << (textureCompression ? "yes" : "no, decoded on load") << "\n";
+
+    // Compilar shaders (o cargarlos desde la cache de binarios)
+    auto compileStart = std::chrono::steady_clock::now();
+    programCache.init(glfwGetProcAddress, derivedCache);
+    shaderPermutations.init(glfwGetProcAddress, GLOBAL_SCALE);
+    programs[0] = shaderPermutations.get({ SHADER_EUCLIDEAN });
+
+    // Segundo Shader NO EUCLIDEANO
+    programs[1] = shaderPermutations.get({ SHADER_SPHERICAL });
+    programs[SHADER_HYPERBOLIC] = shaderPermutations.get({ SHADER_HYPERBOLIC });
+    programs[SHADER_ELLIPTIC] = shaderPermutations.get({ SHADER_ELLIPTIC });
+    std::cout << "Programs ready in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compileStart).count()
+              << " ms, program cache saved " << programCache.getSavedMs() << " ms\n";
+
+    std::vector<Object> objects;
+    if (!createScene(objects, true))
+    {
+        releaseScene(objects);
+        glfwTerminate();
+        return -1;
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(BACKGROUND_COLOR.x, BACKGROUND_COLOR.y, BACKGROUND_COLOR.z, BACKGROUND_COLOR.w);
+    glUseProgram(programs[SHADER_EUCLIDEAN]);
+
+    camera = createCamera();
+
+    if (benchmarkFrames > 0)
+    {
+        CameraPath path = CameraPath::defaultPath();
+        if (!benchmarkPath.empty() && !CameraPath::load(benchmarkPath, path))
+        {
+            std::cerr << "Error al cargar el recorrido de camara: " << benchmarkPath << std::endl;
+            releaseScene(objects);
+            glfwTerminate();
+            return -1;
+        }
+
+        glfwSwapInterval(0);
+        Benchmark benchmark(path, benchmarkFrames);
+        benchmark.run(
+            [](const CameraKeyframe& key) {
+                if (mode != SpaceMode(key.mode))
+                {
+                    mode = SpaceMode(key.mode);
+                    camera->update();
+                }
+                camera->set(key.position, key.center);
+            },
+            [&]() { renderFrame(objects); },
+            [&]() {
+                {
+                    ProfileScope scope("swap");
+                    glfwSwapBuffers(window);
+                }
+                glfwPollEvents();
+                renderThread.pump();
+                jobSystem.help();
+            });
+
+        if (!profileOut.empty())
+            dumpProfile();
+        if (benchmarkOut.empty())
+            benchmark.writeJson(std::cout);
+        else
+        {
+            std::ofstream file(benchmarkOut);
+            benchmark.writeJson(file);
+            std::cout << "Benchmark written to " << benchmarkOut << "\n";
+        }
+
+        finishTrace();
+        releaseScene(objects);
+        glfwTerminate();
+        return 0;
+    }
 
     // Bucle de renderizado
     while (!glfwWindowShouldClose(window))
     {
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(programs[mode]);
+        renderFrame(objects);
 
-        // Renderizar
-        for (size_t i = 0; i < objects.size(); ++i)
         {
-            if (mode == 1)
-                glUniform1f(glGetUniformLocation(programs[1], "anti"), 1.0f);
-            objects[i].draw();
-            if (mode == 1)
-            {
-                glUniform1f(glGetUniformLocation(programs[1], "anti"), -1.0f);
-                objects[i].draw();
-            }
+            ProfileScope scope("swap");
+            glfwSwapBuffers(window);
         }
-
-        glfwSwapBuffers(window);
         glfwPollEvents();
+        renderThread.pump(); // GL uploads of loads finished in the background
+        jobSystem.help(); // and one job, so they progress without a spare core
     }
 
+    finishTrace();
+    releaseScene(objects);
     glfwTerminate();
     return 0;
 }
@@ -630,85 +1967,185 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
+// Moves the camera as far along amount as a CAMERA_RADIUS sphere can go
+// without entering an object; objects it starts inside do not stop it
+void moveCamera(const glm::vec3& amount)
+{
+    glm::vec3 from = camera->getPosition(), to = from + amount;
+    float fraction = 1.0f;
+    glm::vec4 reach((from + to) * 0.5f, glm::length(amount) * 0.5f + CAMERA_RADIUS);
+    objectBvh.spheres(&reach, 1, [&](size_t, uint32_t item) {
+        fraction = std::min(fraction, (*sceneObjects)[item].sweep(from, to, CAMERA_RADIUS));
+    });
+    camera->move(amount * fraction);
+}
+
+// Picks along the view ray through the cursor: a straight ray in the flat
+// spaces, a geodesic through the traced scene in the curved ones
+template <class Geometry>
+void pickObject(const glm::vec2& ndc)
+{
+    std::vector<Object>& objects = *sceneObjects;
+    float best = FLT_MAX;
+    uint32_t object = UINT32_MAX, triangle = UINT32_MAX;
+    if constexpr (Geometry::curvature == 0)
+    {
+        glm::mat4x4 unproject = glm::inverse(camera->getProjectionMatrix() * camera->getViewMatrix());
+        glm::vec4 near = unproject * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f), far = unproject * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+        glm::vec3 origin = glm::vec3(near) / near.w;
+        Bvh::Ray ray = { origin, glm::normalize(glm::vec3(far) / far.w - origin), FLT_MAX };
+        Bvh::Hit hit;
+        objectBvh.rays(&ray, 1, &hit, [&](const Bvh::Ray& query, uint32_t item) {
+            uint32_t local;
+            float t = objects[item].raycast(query, &local);
+            if (t < query.tMax && t < best)
+            {
+                best = t;
+                triangle = local;
+            }
+            return t;
+        });
+        object = hit.item;
+    }
+    else
+    {
+        // The view matrix is an isometry of R^4: its inverse maps the view
+        // space eye (0, 0, 0, 1) and the cursor direction back to the world
+        glm::mat4x4 toWorld = glm::inverse(camera->getViewMatrix());
+        const glm::mat4x4& projection = camera->getProjectionMatrix();
+        glm::vec3 direction = glm::normalize(glm::vec3(ndc.x / projection[0][0], ndc.y / projection[1][1], -1.0f));
+        std::vector<std::shared_ptr<const Model::CpuMesh>> meshes;
+        float tMax = loadRayScene<Geometry>(meshes);
+        RayTracer::Hit hit = rayTracer.trace<Geometry>(toWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), toWorld * glm::vec4(direction, 0.0f), tMax);
+        rayTracer.clear();
+        object = hit.instance;
+        triangle = hit.triangle;
+        best = hit.t / GLOBAL_SCALE;
+    }
+    if (object == UINT32_MAX)
+        std::cout << "Picked nothing\n";
+    else
+        std::cout << "Picked object " << object << ", triangle " << triangle << " at distance " << best << "\n";
+}
+
+void processMouseInput(GLFWwindow* window, int button, int action, int /*mods*/)
+{
+    if (action != GLFW_PRESS || button != GLFW_MOUSE_BUTTON_LEFT)
+        return;
+    double x, y;
+    int width, height;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &width, &height);
+    glm::vec2 ndc(float(2.0 * x / width - 1.0), float(1.0 - 2.0 * y / height));
+    dispatchGeometry(mode, [&](auto geometry) { pickObject<decltype(geometry)>(ndc); });
+}
+
 void processKeyInput(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if (action == GLFW_PRESS && key == GLFW_KEY_ESCAPE)
         glfwSetWindowShouldClose(window, true);
 
     if (action == GLFW_PRESS && key == GLFW_KEY_LEFT)
-        camera->move(-1.0f * CAMERA_STEP * glm::normalize(glm::cross(camera->getCenter() - camera->getPosition(), glm::vec3(0.0f, 1.0f, 0.0f))));
+        moveCamera(-1.0f * CAMERA_STEP * glm::normalize(glm::cross(camera->getCenter() - camera->getPosition(), glm::vec3(0.0f, 1.0f, 0.0f))));
     if (action == GLFW_PRESS && key == GLFW_KEY_RIGHT)
-        camera->move(CAMERA_STEP * glm::normalize(glm::cross(camera->getCenter() - camera->getPosition(), glm::vec3(0.0f, 1.0f, 0.0f))));
+        moveCamera(CAMERA_STEP * glm::normalize(glm::cross(camera->getCenter() - camera->getPosition(), glm::vec3(0.0f, 1.0f, 0.0f))));
     if (action == GLFW_PRESS && key == GLFW_KEY_UP)
-        camera->move(CAMERA_STEP * glm::normalize(camera->getCenter() - camera->getPosition()));
+        moveCamera(CAMERA_STEP * glm::normalize(camera->getCenter() - camera->getPosition()));
     if (action == GLFW_PRESS && key == GLFW_KEY_DOWN)
-        camera->move(-1.0f * CAMERA_STEP * glm::normalize(camera->getCenter() - camera->getPosition()));
+        moveCamera(-1.0f * CAMERA_STEP * glm::normalize(camera->getCenter() - camera->getPosition()));
     if (action == GLFW_PRESS && key == GLFW_KEY_W)
-        camera->move(10.0f * CAMERA_STEP * glm::vec3(0.0f, 0.1f, 0.0f));
+        moveCamera(10.0f * CAMERA_STEP * glm::vec3(0.0f, 0.1f, 0.0f));
     if (action == GLFW_PRESS && key == GLFW_KEY_S)
-        camera->move(10.0f * CAMERA_STEP * glm::vec3(0.0f, -0.1f, 0.0f));
+        moveCamera(10.0f * CAMERA_STEP * glm::vec3(0.0f, -0.1f, 0.0f));
     
     if (action == GLFW_PRESS && key == GLFW_KEY_A)
         camera->turn(-0.5f * CAMERA_STEP * glm::normalize(glm::cross(camera->getCenter() - camera->getPosition(), glm::vec3(0.0f, 1.0f, 0.0f))));
     if (action == GLFW_PRESS && key == GLFW_KEY_D)
         camera->turn(0.5f * CAMERA_STEP * glm::normalize(glm::cross(camera->getCenter() - camera->getPosition(), glm::vec3(0.0f, 1.0f, 0.0f))));
 
-    if (action == GLFW_PRESS && key == GLFW_KEY_M) // WIP NOT WORKING
+    if (action == GLFW_PRESS && key == GLFW_KEY_R)
+        dispatchGeometry(mode, [](auto geometry) { raytraceView<decltype(geometry)>("raytrace.png", 0); });
+    if (action == GLFW_PRESS && key == GLFW_KEY_P)
+        dumpProfile();
+
+    if (action == GLFW_PRESS && key == GLFW_KEY_B)
+    {
+        bakeStatic = !bakeStatic;
+        std::cout << "Baked S3 positions " << (bakeStatic ? "on" : "off") << " (compare opaque/antipodal rows with P)\n";
+    }
+
+    if (action == GLFW_PRESS && key == GLFW_KEY_E)
     {
-        mode = !mode; // change Geometry
+        mode = mode == SPACE_ELLIPTIC ? SPACE_SPHERICAL : SPACE_ELLIPTIC;
         camera->update();
-        std::cout << "Changed Geometry\n";
+        std::cout << "Changed Geometry (" << (mode == SPACE_ELLIPTIC ? "elliptic" : "S3") << ")\n";
     }
-}
 
-GLuint loadShader(GLenum type, const char* source)
-{
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
+    if (action == GLFW_PRESS && key == GLFW_KEY_H)
+    {
+        mode = mode == SPACE_HYPERBOLIC ? SPACE_EUCLIDEAN : SPACE_HYPERBOLIC;
+        camera->update();
+        std::cout << "Changed Geometry (H3)\n";
+    }
+
+    if (action == GLFW_PRESS && key == GLFW_KEY_T)
+    {
+        mode = mode == SPACE_TORUS ? SPACE_EUCLIDEAN : SPACE_TORUS;
+        camera->update();
+        std::cout << "Changed Geometry (3-torus, box " << torusSpace.getSize() << ")\n";
+    }
 
+    if (action == GLFW_PRESS && key == GLFW_KEY_O)
+    {
+        mode = mode == SPACE_PORTALS ? SPACE_EUCLIDEAN : SPACE_PORTALS;
+        camera->update();
+        std::cout << "Changed Geometry (portals)\n";
+    }
 
-    int success;
-    char infoLog[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
+    if (action == GLFW_PRESS && key == GLFW_KEY_M) // WIP NOT WORKING
+    {
+        mode = mode == SPACE_SPHERICAL ? SPACE_EUCLIDEAN : SPACE_SPHERICAL; // change Geometry
+        camera->update();
+        std::cout << "Changed Geometry\n";
     }
+}
 
-    return shader;
+// One level into the bound texture
+void Texture::uploadLevel(const TextureData& texture, size_t level)
+{
+    const TextureLevel& data = texture.levels[level];
+    GLenum format = texture.format == BAKED_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    if (texture.format == 0)
+        glTexImage2D(GL_TEXTURE_2D, GLint(level), GL_RGBA, data.width, data.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data.data());
+    else
+        glCompressedTexImage2D(GL_TEXTURE_2D, GLint(level), format, data.width, data.height, 0, GLsizei(data.data.size()), data.data.data());
 }
 
-GLuint loadTexture(const std::string& path)
-{
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-    if (data) {
-        GLenum format;
-        if (nrChannels == 1)
-            format = GL_RED;
-        else if (nrChannels == 3)
-            format = GL_RGB;
-        else if (nrChannels == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    } else {
-        std::cerr << "Error al cargar la textura: " << path << std::endl;
-        stbi_image_free(data);
-        exit(1);
-    }
-
-    return textureID;
+void Texture::upload(const TextureData& texture, GLint first)
+{
+    TRACE_SCOPE("Texture::upload");
+    object = GlTexture::create();
+
+    glBindTexture(GL_TEXTURE_2D, object.get());
+    for (size_t level = size_t(first); level < texture.levels.size(); level++)
+        uploadLevel(texture, level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(texture.levels.size()) - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    width = texture.levels[0].width;
+    levelBytes.clear();
+    gpuBytes = 0;
+    for (size_t level = 0; level < texture.levels.size(); level++)
+    {
+        levelBytes.push_back(texture.levels[level].data.size());
+        if (GLint(level) >= first)
+            gpuBytes += levelBytes.back();
+    }
+    baseLevel = first;
+    minLod = 0.0f;
+    setWanted(first);
 }
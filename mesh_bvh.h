@@ -0,0 +1,590 @@
+#pragma once
+
+// Triangle BVH of one model for ray casts (picking) and sphere sweeps (camera
+// collision), in model space. The tree is a Bvh over the triangles' boxes,
+// built in parallel at load and kept in the derived data cache under a hash
+// of the mesh, so later runs only read it back.
+//
+// In S3 and H3 a triangle is drawn as the geodesic triangle spanned by its
+// ported vertices (in S3 again at their antipodes). geodesicRay() intersects
+// a geodesic with those exactly in R^4; the tree only supplies candidates,
+// found by walking the geodesic in short steps and pulling each step back
+// into the model's chart, restricted to the stretches that pass near the
+// mesh.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "derived_cache.h"
+#include "geometry.h"
+#include "parallel.h"
+
+#define MESH_BVH_VERSION 1
+#define MESH_BVH_GEODESIC_STEP 2.0f // world units per step along a geodesic ray
+#define MESH_BVH_GEODESIC_MARGIN 0.5f // chart distortion allowance, world units
+
+class MeshBvh
+{
+    struct Triangle
+    {
+        glm::vec3 v0, e1, e2;
+    };
+
+    std::vector<Triangle> triangles;
+    Bvh bvh;
+    glm::vec4 sphere = glm::vec4(0.0f); // model space bounds
+    double buildMs = 0.0;
+    bool cached = false;
+
+    // Moller-Trumbore; +inf on a miss
+    static float rayTriangle(const Bvh::Ray& ray, const Triangle& tri)
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        glm::vec3 p = glm::cross(ray.direction, tri.e2);
+        float det = glm::dot(tri.e1, p);
+        if (std::fabs(det) < 1e-12f)
+            return inf;
+        float inverse = 1.0f / det;
+        glm::vec3 s = ray.origin - tri.v0;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return inf;
+        glm::vec3 q = glm::cross(s, tri.e1);
+        float v = glm::dot(ray.direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return inf;
+        float t = glm::dot(tri.e2, q) * inverse;
+        return t >= 0.0f ? t : inf;
+    }
+
+    // Ericson, Real-Time Collision Detection 5.1.5
+    static glm::vec3 closestPoint(const glm::vec3& p, const Triangle& tri)
+    {
+        glm::vec3 a = tri.v0, b = tri.v0 + tri.e1, c = tri.v0 + tri.e2;
+        glm::vec3 ap = p - a;
+        float d1 = glm::dot(tri.e1, ap), d2 = glm::dot(tri.e2, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return a;
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(tri.e1, bp), d4 = glm::dot(tri.e2, bp);
+        if (d3 >= 0.0f && d4 <= d3)
+            return b;
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            return a + tri.e1 * (d1 / (d1 - d3));
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(tri.e1, cp), d6 = glm::dot(tri.e2, cp);
+        if (d6 >= 0.0f && d5 <= d6)
+            return c;
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            return a + tri.e2 * (d2 / (d2 - d6));
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        float denom = 1.0f / (va + vb + vc);
+        return a + tri.e1 * (vb * denom) + tri.e2 * (vc * denom);
+    }
+
+    static bool overlaps(const glm::vec3& center, float radius, const Triangle& tri)
+    {
+        glm::vec3 d = closestPoint(center, tri) - center;
+        return glm::dot(d, d) < radius * radius;
+    }
+
+    static double det3(const double m[4][5], int r0, int r1, int r2, int c0, int c1, int c2)
+    {
+        return m[r0][c0] * (m[r1][c1] * m[r2][c2] - m[r1][c2] * m[r2][c1]) -
+               m[r0][c1] * (m[r1][c0] * m[r2][c2] - m[r1][c2] * m[r2][c0]) +
+               m[r0][c2] * (m[r1][c0] * m[r2][c1] - m[r1][c1] * m[r2][c0]);
+    }
+
+    // Parameter at which the geodesic cos t P + sin t D (cosh and sinh in
+    // H3) meets the cone over the triangle (a, b, c) of R^4, or +inf. The
+    // five columns P, D, a, b, c are dependent; the 4x4 minors give the
+    // combination x P + y D = wa a + wb b + wc c, which is on the triangle
+    // when the weights share a sign. They are also the hit's barycentrics on
+    // the flat triangle abc, the one the rasterizer interpolates over.
+    template <int Curvature>
+    static float geodesicTriangle(const glm::vec4& p, const glm::vec4& d, const glm::vec4& a, const glm::vec4& b, const glm::vec4& c,
+                                  glm::vec3* barycentric)
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        const glm::vec4* columns[5] = { &p, &d, &a, &b, &c };
+        double m[4][5];
+        for (int r = 0; r < 4; r++)
+            for (int k = 0; k < 5; k++)
+                m[r][k] = (*columns[k])[r];
+
+        double n[5];
+        for (int skip = 0; skip < 5; skip++)
+        {
+            int cols[4], count = 0;
+            for (int k = 0; k < 5; k++)
+                if (k != skip)
+                    cols[count++] = k;
+            // Laplace expansion along row 0
+            double det = m[0][cols[0]] * det3(m, 1, 2, 3, cols[1], cols[2], cols[3]) -
+                         m[0][cols[1]] * det3(m, 1, 2, 3, cols[0], cols[2], cols[3]) +
+                         m[0][cols[2]] * det3(m, 1, 2, 3, cols[0], cols[1], cols[3]) -
+                         m[0][cols[3]] * det3(m, 1, 2, 3, cols[0], cols[1], cols[2]);
+            n[skip] = (skip % 2) ? -det : det;
+        }
+        // x P + y D + n2 a + n3 b + n4 c = 0
+        double sign = n[2] < 0.0 ? 1.0 : -1.0;
+        double wa = -sign * n[2], wb = -sign * n[3], wc = -sign * n[4];
+        if (wb < 0.0 || wc < 0.0 || wa + wb + wc == 0.0)
+            return inf;
+        double x = sign * n[0], y = sign * n[1], t;
+        if (Curvature > 0)
+        {
+            if (x == 0.0 && y == 0.0)
+                return inf;
+            t = std::atan2(y, x);
+            if (t < 0.0)
+                t += 2.0 * 3.14159265358979324;
+        }
+        else
+        {
+            if (x <= std::fabs(y))
+                return inf;
+            t = std::atanh(y / x);
+            if (t < 0.0)
+                return inf;
+        }
+        if (barycentric)
+            *barycentric = glm::vec3(float(wa), float(wb), float(wc)) / float(wa + wb + wc);
+        return float(t);
+    }
+
+    // Inverse of port: the chart point drawn at q
+    template <int Curvature>
+    static glm::vec3 chartPoint(const glm::vec4& q, float scale)
+    {
+        glm::vec3 v(q);
+        float s = glm::length(v);
+        if (s < 1e-7f)
+            return glm::vec3(0.0f);
+        return v * ((Curvature > 0 ? std::atan2(s, q.w) : std::asinh(s)) / (s * scale));
+    }
+
+    // Where the geodesic through p with tangent d comes within reach of the
+    // point center: the parameters middle +- half. False if it never does.
+    template <int Curvature>
+    static bool window(const glm::vec4& p, const glm::vec4& d, const glm::vec4& center, float reach, float& middle, float& half)
+    {
+        float cp = center.w * p.w + Curvature * glm::dot(glm::vec3(center), glm::vec3(p));
+        float cd = center.w * d.w + Curvature * glm::dot(glm::vec3(center), glm::vec3(d));
+        if (Curvature > 0)
+        {
+            // <center, q(t)> = r cos(t - middle) must reach cos(reach)
+            float r = std::sqrt(cp * cp + cd * cd);
+            if (r < std::cos(reach))
+                return false;
+            middle = std::atan2(cd, cp);
+            half = r > 1e-6f ? std::acos(std::clamp(std::cos(reach) / r, -1.0f, 1.0f)) : 3.14159265f;
+            return true;
+        }
+        // <center, q(t)> = m cosh(t - middle) must stay under cosh(reach)
+        float m = std::sqrt(std::max(cp * cp - cd * cd, 1.0f));
+        if (m > std::cosh(reach))
+            return false;
+        middle = -std::atanh(std::clamp(cd / cp, -0.999999f, 0.999999f));
+        half = std::acosh(std::max(std::cosh(reach) / m, 1.0f));
+        return true;
+    }
+
+    static DerivedKey meshKey(const std::vector<float>& vertices, size_t stride, const std::vector<unsigned int>& indices)
+    {
+        uint64_t layout = stride;
+        return DerivedKey("bvh", MESH_BVH_VERSION).add(&layout, sizeof(layout)).add(vertices).add(indices);
+    }
+
+    friend void benchmarkMeshBvh(std::ostream&, const std::vector<float>&, size_t, const std::vector<unsigned int>&, float);
+
+public:
+    // vertices: stride floats per vertex, position first; three indices per
+    // triangle. cache nullptr: always built.
+    void build(const std::vector<float>& vertices, size_t stride, const std::vector<unsigned int>& indices, DerivedCache* cache)
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t count = indices.size() / 3;
+        triangles.resize(count);
+        std::vector<Bvh::Box> boxes(count);
+        parallelFor(count, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                glm::vec3 v[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    const float* p = &vertices[indices[i * 3 + k] * stride];
+                    v[k] = glm::vec3(p[0], p[1], p[2]);
+                }
+                triangles[i] = { v[0], v[1] - v[0], v[2] - v[0] };
+                boxes[i] = { glm::min(v[0], glm::min(v[1], v[2])), glm::max(v[0], glm::max(v[1], v[2])) };
+            }
+        });
+
+        glm::vec3 low(std::numeric_limits<float>::infinity()), high(-std::numeric_limits<float>::infinity());
+        for (const Bvh::Box& box : boxes)
+        {
+            low = glm::min(low, box.low);
+            high = glm::max(high, box.high);
+        }
+        sphere = count ? glm::vec4((low + high) * 0.5f, glm::length(high - low) * 0.5f) : glm::vec4(0.0f);
+
+        cached = false;
+        DerivedKey key;
+        if (cache)
+        {
+            key = meshKey(vertices, stride, indices);
+            std::vector<unsigned char> bytes;
+            if (cache->get(key, bytes))
+            {
+                std::istringstream image(std::string(bytes.begin(), bytes.end()));
+                cached = bvh.read(image) && bvh.size() == count;
+            }
+        }
+        if (!cached)
+        {
+            bvh.build(boxes);
+            if (cache)
+            {
+                std::ostringstream image;
+                bvh.write(image);
+                std::string bytes = image.str();
+                cache->put(key, bytes.data(), bytes.size());
+            }
+        }
+        buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t size() const
+    {
+        return triangles.size();
+    }
+
+    double getBuildMs() const
+    {
+        return buildMs;
+    }
+
+    bool wasCached() const
+    {
+        return cached;
+    }
+
+    // Model space bounding sphere: center xyz, radius w
+    const glm::vec4& getSphere() const
+    {
+        return sphere;
+    }
+
+    // Closest hit distance along the ray (in units of ray.direction), or
+    // ray.tMax
+    float ray(const Bvh::Ray& ray, uint32_t* triangle = nullptr) const
+    {
+        Bvh::Hit hit;
+        rays(&ray, 1, &hit);
+        if (triangle)
+            *triangle = hit.item;
+        return hit.t;
+    }
+
+    void rays(const Bvh::Ray* queries, size_t count, Bvh::Hit* hits) const
+    {
+        bvh.rays(queries, count, hits, [&](const Bvh::Ray& ray, uint32_t item) { return rayTriangle(ray, triangles[item]); });
+    }
+
+    // Fraction of the motion from -> to a sphere of radius can make before
+    // touching a triangle. Triangles it already touches at from are ignored,
+    // so a sphere that starts inside geometry can move out of it.
+    float sweepSphere(const glm::vec3& from, const glm::vec3& to, float radius) const
+    {
+        glm::vec3 motion = to - from;
+        float length = glm::length(motion);
+        glm::vec4 reach((from + to) * 0.5f, length * 0.5f + radius);
+        std::vector<uint32_t> candidates;
+        bvh.spheres(&reach, 1, [&](size_t, uint32_t item) {
+            if (!overlaps(from, radius, triangles[item]))
+                candidates.push_back(item);
+        });
+        if (candidates.empty() || length == 0.0f)
+            return 1.0f;
+
+        auto blocked = [&](float f) {
+            glm::vec3 center = from + motion * f;
+            for (uint32_t item : candidates)
+                if (overlaps(center, radius, triangles[item]))
+                    return true;
+            return false;
+        };
+        // Steps of half a radius cannot jump over a triangle
+        int steps = std::max(1, int(std::ceil(length / (radius * 0.5f))));
+        for (int k = 1; k <= steps; k++)
+        {
+            float f = float(k) / steps;
+            if (!blocked(f))
+                continue;
+            float free = float(k - 1) / steps;
+            for (int i = 0; i < 12; i++)
+            {
+                float middle = (free + f) * 0.5f;
+                (blocked(middle) ? f : free) = middle;
+            }
+            return free;
+        }
+        return 1.0f;
+    }
+
+    // The mesh drawn with model at scale in a curved space: what
+    // geodesicRay() needs besides the ray, computed once per transform
+    struct Placement
+    {
+        glm::mat4x4 toModel;
+        glm::vec4 center; // ported bounding sphere center
+        float reach, shrink, scale;
+        std::vector<glm::vec4> corners; // ported triangle corners, three per triangle
+    };
+
+    template <class Geometry>
+    Placement place(const glm::mat4x4& model, float scale) const
+    {
+        Placement placement;
+        float stretch = 0.0f;
+        placement.shrink = std::numeric_limits<float>::infinity();
+        for (int c = 0; c < 3; c++)
+        {
+            stretch = std::max(stretch, glm::length(glm::vec3(model[c])));
+            placement.shrink = std::min(placement.shrink, glm::length(glm::vec3(model[c])));
+        }
+        placement.toModel = glm::inverse(model);
+        placement.center = Geometry::port(glm::vec3(model * glm::vec4(glm::vec3(sphere), 1.0f)), scale);
+        placement.reach = (sphere.w * stretch + MESH_BVH_GEODESIC_MARGIN) * scale;
+        if (Geometry::curvature > 0)
+            placement.reach = std::min(placement.reach, 3.14159265f);
+        placement.scale = scale;
+        placement.corners.resize(triangles.size() * 3);
+        parallelFor(triangles.size(), 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                const Triangle& tri = triangles[i];
+                placement.corners[i * 3] = Geometry::port(glm::vec3(model * glm::vec4(tri.v0, 1.0f)), scale);
+                placement.corners[i * 3 + 1] = Geometry::port(glm::vec3(model * glm::vec4(tri.v0 + tri.e1, 1.0f)), scale);
+                placement.corners[i * 3 + 2] = Geometry::port(glm::vec3(model * glm::vec4(tri.v0 + tri.e2, 1.0f)), scale);
+            }
+        });
+        return placement;
+    }
+
+    // Closest hit of the geodesic cos t eye + sin t direction (cosh and sinh
+    // in H3; eye and direction orthonormal in the model's metric) with the
+    // placed mesh, counting the antipodal copy in S3. t in radians, tMax if
+    // nothing is hit before it.
+    template <class Geometry>
+    float geodesicRay(const Placement& placement, const glm::vec4& eye, const glm::vec4& direction, float tMax, uint32_t* triangle = nullptr,
+                      glm::vec3* barycentric = nullptr) const
+    {
+        const int curvature = Geometry::curvature;
+        const float pi = 3.14159265f;
+        float best = tMax;
+        if (triangle)
+            *triangle = UINT32_MAX;
+        if (triangles.empty())
+            return best;
+
+        float step = MESH_BVH_GEODESIC_STEP * placement.scale;
+        float queryRadius = (MESH_BVH_GEODESIC_STEP * 0.5f + MESH_BVH_GEODESIC_MARGIN) / placement.shrink;
+        auto along = [&](float t) {
+            if (curvature > 0)
+                return eye * std::cos(t) + direction * std::sin(t);
+            return eye * std::cosh(t) + direction * std::sinh(t);
+        };
+        auto march = [&](float copy, float begin, float end) {
+            end = std::min(end, best);
+            for (float t = std::max(begin, 0.0f); t < end && t < best; t += step)
+            {
+                glm::vec4 q = along(std::min(t + step * 0.5f, end)) * copy;
+                glm::vec3 chart = glm::vec3(placement.toModel * glm::vec4(chartPoint<curvature>(q, placement.scale), 1.0f));
+                glm::vec4 query(chart, queryRadius);
+                bvh.spheres(&query, 1, [&](size_t, uint32_t item) {
+                    const glm::vec4* corners = &placement.corners[item * 3];
+                    glm::vec3 weights;
+                    float hit = geodesicTriangle<curvature>(eye, direction, corners[0] * copy, corners[1] * copy, corners[2] * copy, &weights);
+                    if (hit < best)
+                    {
+                        best = hit;
+                        if (triangle)
+                            *triangle = item;
+                        if (barycentric)
+                            *barycentric = weights;
+                    }
+                });
+            }
+        };
+
+        float middle, half;
+        if (curvature < 0)
+        {
+            if (window<curvature>(eye, direction, placement.center, placement.reach, middle, half))
+                march(1.0f, middle - half, middle + half);
+            return best;
+        }
+        for (float copy : { 1.0f, -1.0f })
+        {
+            if (!window<curvature>(eye, direction, placement.center * copy, placement.reach, middle, half))
+                continue;
+            if (middle < 0.0f)
+                middle += 2.0f * pi;
+            march(copy, middle - half, middle + half);
+            march(copy, middle - 2.0f * pi - half, middle - 2.0f * pi + half);
+        }
+        return best;
+    }
+};
+
+// Query throughput on one mesh (--bench-mesh-bvh): build with and without
+// threads, cache round trip, Euclidean rays against a linear scan, sphere
+// sweeps, and S3 and H3 geodesic rays through the origin, where they are straight
+// in the chart and must agree with the Euclidean distance
+inline void benchmarkMeshBvh(std::ostream& os, const std::vector<float>& vertices, size_t stride, const std::vector<unsigned int>& indices,
+                             float scale)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+    size_t count = indices.size() / 3;
+    std::vector<Bvh::Box> boxes(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 v[3];
+        for (int k = 0; k < 3; k++)
+            v[k] = glm::vec3(vertices[indices[i * 3 + k] * stride], vertices[indices[i * 3 + k] * stride + 1], vertices[indices[i * 3 + k] * stride + 2]);
+        boxes[i] = { glm::min(v[0], glm::min(v[1], v[2])), glm::max(v[0], glm::max(v[1], v[2])) };
+    }
+    Bvh tree;
+    auto start = Clock::now();
+    tree.build(boxes, false);
+    double serialMs = seconds(start) * 1000.0;
+    start = Clock::now();
+    tree.build(boxes, true);
+    double parallelMs = seconds(start) * 1000.0;
+    std::stringstream image;
+    start = Clock::now();
+    tree.write(image);
+    tree.read(image);
+    double cacheMs = seconds(start) * 1000.0;
+    os << "Mesh BVH: " << count << " triangles, " << tree.nodeCount() << " nodes, depth " << tree.getDepth() << "; build " << serialMs
+       << " ms (1 thread), " << parallelMs << " ms (parallel), cache round trip " << cacheMs << " ms\n";
+
+    MeshBvh mesh;
+    mesh.build(vertices, stride, indices, nullptr);
+    glm::vec4 bounds = mesh.getSphere();
+    glm::vec3 center(bounds);
+    std::mt19937 random(99);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto inBall = [&](float radius) {
+        glm::vec3 p;
+        do
+            p = glm::vec3(unit(random), unit(random), unit(random));
+        while (glm::dot(p, p) > 1.0f);
+        return center + p * radius;
+    };
+
+    // Rays from outside towards points inside the bounds
+    const size_t rayCount = 100000;
+    std::vector<Bvh::Ray> rays(rayCount);
+    for (Bvh::Ray& ray : rays)
+    {
+        glm::vec3 origin = center + glm::normalize(inBall(1.0f) - center) * (bounds.w * 2.0f);
+        ray = { origin, glm::normalize(inBall(bounds.w) - origin), bounds.w * 4.0f };
+    }
+    std::vector<Bvh::Hit> hits(rayCount);
+    start = Clock::now();
+    for (size_t i = 0; i < rayCount; i++)
+        hits[i].t = mesh.ray(rays[i], &hits[i].item);
+    double single = rayCount / seconds(start);
+    start = Clock::now();
+    parallelFor(rayCount, BVH_BATCH * 16, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i += BVH_BATCH)
+            mesh.rays(&rays[i], std::min<size_t>(BVH_BATCH, end - i), &hits[i]);
+    });
+    double batched = rayCount / seconds(start);
+    size_t hitCount = 0, mismatches = 0;
+    for (const Bvh::Hit& hit : hits)
+        hitCount += hit.item != UINT32_MAX;
+    for (size_t i = 0; i < 64; i++)
+    {
+        float linear = rays[i].tMax;
+        for (size_t k = 0; k < count; k++)
+        {
+            const float* a = &vertices[indices[k * 3] * stride];
+            const float* b = &vertices[indices[k * 3 + 1] * stride];
+            const float* c = &vertices[indices[k * 3 + 2] * stride];
+            glm::vec3 v0(a[0], a[1], a[2]);
+            float t = MeshBvh::rayTriangle(rays[i], { v0, glm::vec3(b[0], b[1], b[2]) - v0, glm::vec3(c[0], c[1], c[2]) - v0 });
+            linear = std::min(linear, t);
+        }
+        mismatches += std::fabs(linear - hits[i].t) > 1e-4f * bounds.w;
+    }
+    os << "rays: " << 100.0 * hitCount / rayCount << "% hit, " << single / 1e6 << " Mrays/s (1 thread), " << batched / 1e6
+       << " Mrays/s (batches of " << BVH_BATCH << ", " << jobSystem.size() << " threads); " << mismatches << " of 64 differ from a linear scan\n";
+
+    // Short sphere sweeps around the mesh
+    const size_t sweepCount = 20000;
+    size_t stopped = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < sweepCount; i++)
+    {
+        glm::vec3 from = inBall(bounds.w * 1.5f);
+        glm::vec3 to = from + glm::normalize(glm::vec3(unit(random), unit(random), unit(random))) * (bounds.w * 0.2f);
+        stopped += mesh.sweepSphere(from, to, bounds.w * 0.02f) < 1.0f;
+    }
+    os << "sphere sweeps: " << 100.0 * stopped / sweepCount << "% stopped, " << sweepCount / seconds(start) / 1e3 << " ksweeps/s\n";
+
+    // Geodesic rays aimed through the chart origin
+    auto geodesics = [&](auto geometry, const char* name) {
+        typedef decltype(geometry) Geometry;
+        const size_t geodesicCount = 2000;
+        const float tMax = Geometry::curvature > 0 ? 2.0f * 3.14159265f : 10.0f;
+        float worst = 0.0f;
+        size_t geodesicHits = 0;
+        MeshBvh::Placement placement = mesh.place<Geometry>(glm::mat4x4(1.0f), scale);
+        auto begin = Clock::now();
+        for (size_t i = 0; i < geodesicCount; i++)
+        {
+            glm::vec3 from = glm::normalize(glm::vec3(unit(random), unit(random), unit(random))) * (bounds.w * 2.0f + glm::length(center));
+            glm::vec4 eye = Geometry::port(from, scale);
+            // Unit tangent at eye towards the origin: the radial direction,
+            // flipped, in the ambient coordinates
+            glm::vec3 radial = glm::normalize(from);
+            float distance = glm::length(from) * scale;
+            glm::vec4 direction = Geometry::curvature > 0 ? glm::vec4(-radial * std::cos(distance), std::sin(distance))
+                                                          : glm::vec4(-radial * std::cosh(distance), -std::sinh(distance));
+            float t = mesh.geodesicRay<Geometry>(placement, eye, direction, tMax);
+            if (t >= tMax)
+                continue;
+            geodesicHits++;
+            Bvh::Ray straight = { from, -radial, bounds.w * 4.0f + glm::length(from) };
+            float euclidean = mesh.ray(straight);
+            if (euclidean < straight.tMax)
+                worst = std::max(worst, std::fabs(t / scale - euclidean));
+        }
+        os << name << " geodesic rays: " << 100.0 * geodesicHits / geodesicCount << "% hit, " << geodesicCount / seconds(begin) / 1e3
+           << " krays/s; largest difference from the straight ray " << worst << " units\n";
+    };
+    geodesics(Spherical(), "S3");
+    geodesics(Hyperbolic(), "H3");
+}
@@ -0,0 +1,551 @@
+#pragma once
+
+// Asset pack: every file under Models/ in one archive that is mapped into
+// memory at startup (open, fstat, mmap, madvise, close), so the I/O syscall
+// count does not grow with the number of assets.
+//
+//   header | entry data, each at a PACK_ALIGNMENT boundary | TOC | names
+//
+// An entry is a table of PackBlocks followed by their payloads. Each block
+// covers PACK_BLOCK_SIZE bytes of the file, compressed in the LZ4 block
+// format or stored raw when that does not pay (PNG, JPG), with a checksum of
+// its stored bytes. Blocks are independent, so one entry is decompressed by
+// several jobs. The TOC is sorted by name hash for binary search and is
+// covered by its own checksum.
+// The packer is tools/asset_packer.cpp; readAsset() falls back to the loose
+// files when no pack is open or it lacks a name.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "assets.h"
+#include "jobs.h"
+
+#define PACK_MAGIC 0x4B415033u // "3PAK"
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 64
+#define PACK_BLOCK_SIZE (256u * 1024u)
+#define PACK_BLOCK_RAW 0x80000000u // in PackBlock::storedSize
+#define PACK_MIN_SAVING 16 // percent a block must shrink by to stay compressed
+
+struct PackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t blockSize;
+    uint64_t tocOffset; // entries, then their names
+    uint64_t tocChecksum;
+};
+
+struct PackEntry
+{
+    uint64_t nameHash;
+    uint64_t offset; // of the block table
+    uint64_t size; // decompressed
+    uint64_t storedSize; // block table and payloads
+    uint32_t blockCount;
+    uint32_t nameOffset; // into the names after the TOC
+    uint32_t nameLength;
+    uint32_t raw; // every block stored: the payloads are the file itself
+};
+
+struct PackBlock
+{
+    uint32_t storedSize; // | PACK_BLOCK_RAW
+    uint32_t checksum;
+};
+
+static_assert(sizeof(PackHeader) == 32 && sizeof(PackEntry) == 48 && sizeof(PackBlock) == 8, "pack layout");
+
+// Word-at-a-time multiplicative hash; detects corruption, not tampering
+inline uint64_t packChecksum(const void* data, size_t size, uint64_t hash = 0x9E3779B97F4A7C15ull)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001B3ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    return hash ^ (hash >> 32);
+}
+
+inline uint64_t packNameHash(const std::string& name)
+{
+    return packChecksum(name.data(), name.size());
+}
+
+// LZ4 block format: sequences of literals followed by a back reference of at
+// least 4 bytes within 64 KiB; the last 5 bytes are always literals
+namespace lz4
+{
+    inline uint32_t read32(const unsigned char* p)
+    {
+        uint32_t value;
+        std::memcpy(&value, p, 4);
+        return value;
+    }
+
+    inline void writeLength(std::vector<unsigned char>& out, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+            out.push_back(255);
+        out.push_back((unsigned char)length);
+    }
+
+    inline void compress(const unsigned char* in, size_t size, std::vector<unsigned char>& out)
+    {
+        const size_t minMatch = 4, lastLiterals = 5, matchLimit = 12;
+        std::vector<int32_t> table(1 << 16, -1);
+        size_t anchor = 0, i = 0;
+        while (size >= matchLimit && i + matchLimit <= size)
+        {
+            uint32_t sequence = read32(in + i);
+            int32_t& slot = table[(sequence * 2654435761u) >> 16];
+            int32_t candidate = slot;
+            slot = int32_t(i);
+            if (candidate < 0 || i - size_t(candidate) > 65535 || read32(in + candidate) != sequence)
+            {
+                i++;
+                continue;
+            }
+
+            size_t length = minMatch, limit = size - lastLiterals - i;
+            while (length < limit && in[candidate + length] == in[i + length])
+                length++;
+            size_t literals = i - anchor;
+            out.push_back((unsigned char)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(length - minMatch, 15)));
+            if (literals >= 15)
+                writeLength(out, literals - 15);
+            out.insert(out.end(), in + anchor, in + i);
+            size_t offset = i - size_t(candidate);
+            out.push_back((unsigned char)offset);
+            out.push_back((unsigned char)(offset >> 8));
+            if (length - minMatch >= 15)
+                writeLength(out, length - minMatch - 15);
+            i += length;
+            anchor = i;
+        }
+        size_t literals = size - anchor;
+        out.push_back((unsigned char)(std::min<size_t>(literals, 15) << 4));
+        if (literals >= 15)
+            writeLength(out, literals - 15);
+        out.insert(out.end(), in + anchor, in + size);
+    }
+
+    // Bounds-checked; false unless the input decodes to exactly size bytes
+    inline bool decompress(const unsigned char* in, size_t inSize, unsigned char* out, size_t size)
+    {
+        const unsigned char* inEnd = in + inSize;
+        unsigned char* begin = out;
+        unsigned char* outEnd = out + size;
+        auto length = [&](size_t value, size_t& result) {
+            if (value == 15)
+            {
+                unsigned char extra;
+                do
+                {
+                    if (in >= inEnd)
+                        return false;
+                    extra = *in++;
+                    value += extra;
+                } while (extra == 255);
+            }
+            result = value;
+            return true;
+        };
+
+        while (in < inEnd)
+        {
+            unsigned char token = *in++;
+            size_t literals, match;
+            if (!length(token >> 4, literals) || size_t(inEnd - in) < literals || size_t(outEnd - out) < literals)
+                return false;
+            std::memcpy(out, in, literals);
+            in += literals;
+            out += literals;
+            if (in == inEnd)
+                break;
+
+            if (inEnd - in < 2)
+                return false;
+            size_t offset = size_t(in[0]) | size_t(in[1]) << 8;
+            in += 2;
+            if (offset == 0 || offset > size_t(out - begin) || !length(token & 15, match))
+                return false;
+            match += 4;
+            if (size_t(outEnd - out) < match)
+                return false;
+            const unsigned char* from = out - offset;
+            if (offset >= match)
+                std::memcpy(out, from, match);
+            else
+                for (size_t k = 0; k < match; k++)
+                    out[k] = from[k];
+            out += match;
+        }
+        return out == outEnd;
+    }
+}
+
+// Builds a pack in memory; compression of all blocks runs on the job system
+class PackWriter
+{
+public:
+    struct Report
+    {
+        std::string name;
+        uint64_t size, storedSize;
+    };
+
+private:
+    struct Pending
+    {
+        std::string name;
+        std::vector<unsigned char> data;
+    };
+    std::vector<Pending> files;
+
+public:
+    void add(const std::string& name, std::vector<unsigned char> data)
+    {
+        files.push_back({ name, std::move(data) });
+    }
+
+    // compress false stores every block raw
+    std::vector<unsigned char> build(bool compress, std::vector<Report>& reports) const
+    {
+        struct Block
+        {
+            size_t file, begin, end;
+            std::vector<unsigned char> stored;
+            bool raw;
+        };
+        std::vector<Block> blocks;
+        for (size_t f = 0; f < files.size(); f++)
+            for (size_t begin = 0; begin < files[f].data.size() || begin == 0; begin += PACK_BLOCK_SIZE)
+            {
+                blocks.push_back({ f, begin, std::min<size_t>(begin + PACK_BLOCK_SIZE, files[f].data.size()), {}, true });
+                if (files[f].data.empty())
+                    break;
+            }
+
+        jobSystem.parallelFor(blocks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t b = first; b < last; b++)
+            {
+                Block& block = blocks[b];
+                const unsigned char* in = files[block.file].data.data() + block.begin;
+                size_t size = block.end - block.begin;
+                if (compress && size > 0)
+                    lz4::compress(in, size, block.stored);
+                block.raw = !compress || size == 0 || block.stored.size() * 100 > size * (100 - PACK_MIN_SAVING);
+                if (block.raw)
+                    block.stored.assign(in, in + size);
+            }
+        });
+
+        std::vector<unsigned char> pack(sizeof(PackHeader));
+        std::vector<PackEntry> entries;
+        std::string names;
+        auto align = [&]() { pack.resize((pack.size() + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT); };
+        reports.clear();
+        for (size_t f = 0, b = 0; f < files.size(); f++)
+        {
+            align();
+            PackEntry entry = {};
+            entry.nameHash = packNameHash(files[f].name);
+            entry.offset = pack.size();
+            entry.size = files[f].data.size();
+            entry.nameOffset = uint32_t(names.size());
+            entry.nameLength = uint32_t(files[f].name.size());
+            entry.raw = 1;
+            names += files[f].name;
+
+            size_t first = b;
+            while (b < blocks.size() && blocks[b].file == f)
+                b++;
+            entry.blockCount = uint32_t(b - first);
+            size_t table = pack.size();
+            pack.resize(table + entry.blockCount * sizeof(PackBlock));
+            for (size_t k = first; k < b; k++)
+            {
+                PackBlock block = { uint32_t(blocks[k].stored.size()) | (blocks[k].raw ? PACK_BLOCK_RAW : 0u),
+                                    uint32_t(packChecksum(blocks[k].stored.data(), blocks[k].stored.size())) };
+                std::memcpy(&pack[table + (k - first) * sizeof(PackBlock)], &block, sizeof(block));
+                pack.insert(pack.end(), blocks[k].stored.begin(), blocks[k].stored.end());
+                entry.raw &= blocks[k].raw ? 1u : 0u;
+            }
+            entry.storedSize = pack.size() - entry.offset;
+            entries.push_back(entry);
+            reports.push_back({ files[f].name, entry.size, entry.storedSize });
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const PackEntry& a, const PackEntry& b) { return a.nameHash < b.nameHash; });
+        align();
+        PackHeader header = { PACK_MAGIC, PACK_VERSION, uint32_t(entries.size()), PACK_BLOCK_SIZE, pack.size(), 0 };
+        const unsigned char* toc = (const unsigned char*)entries.data();
+        pack.insert(pack.end(), toc, toc + entries.size() * sizeof(PackEntry));
+        pack.insert(pack.end(), names.begin(), names.end());
+        header.tocChecksum = packChecksum(&pack[size_t(header.tocOffset)], pack.size() - size_t(header.tocOffset));
+        std::memcpy(pack.data(), &header, sizeof(header));
+        return pack;
+    }
+};
+
+// Read-only view of a mapped pack
+class AssetPack
+{
+    const unsigned char* base = nullptr;
+    size_t length = 0;
+    const PackEntry* entries = nullptr;
+    const char* names = nullptr;
+    uint32_t count = 0;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+
+    const PackEntry* find(const std::string& name) const
+    {
+        uint64_t hash = packNameHash(name);
+        const PackEntry* found = std::lower_bound(entries, entries + count, hash,
+                                                  [](const PackEntry& entry, uint64_t key) { return entry.nameHash < key; });
+        for (; found != entries + count && found->nameHash == hash; found++)
+            if (name.compare(0, std::string::npos, names + found->nameOffset, found->nameLength) == 0)
+                return found;
+        return nullptr;
+    }
+
+    bool map(const std::string& path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+        base = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        length = size_t(size.QuadPart);
+        return base != nullptr;
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        void* view = MAP_FAILED;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+            view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+        if (view == MAP_FAILED)
+            return false;
+        base = (const unsigned char*)view;
+        length = size_t(info.st_size);
+        madvise(view, length, MADV_WILLNEED); // read ahead now, not on first touch
+        return true;
+#endif
+    }
+
+public:
+    AssetPack() = default;
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+    ~AssetPack() { close(); }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        if (base)
+            munmap((void*)base, length);
+#endif
+        base = nullptr;
+        length = 0;
+        entries = nullptr;
+        names = nullptr;
+        count = 0;
+    }
+
+    // Maps the pack and checks its TOC; the number of entries
+    Expected<size_t> open(const std::string& path)
+    {
+        close();
+        if (!map(path))
+            return AssetError{ "Error al abrir el paquete de recursos: " + path };
+        PackHeader header;
+        bool valid = length >= sizeof(header);
+        if (valid)
+        {
+            std::memcpy(&header, base, sizeof(header));
+            valid = header.magic == PACK_MAGIC && header.version == PACK_VERSION && header.blockSize == PACK_BLOCK_SIZE &&
+                    header.tocOffset % PACK_ALIGNMENT == 0 && header.tocOffset <= length &&
+                    (length - header.tocOffset) / sizeof(PackEntry) >= header.entryCount &&
+                    packChecksum(base + header.tocOffset, length - size_t(header.tocOffset)) == header.tocChecksum;
+        }
+        if (!valid)
+        {
+            close();
+            return AssetError{ "Paquete de recursos no valido: " + path };
+        }
+        count = header.entryCount;
+        entries = (const PackEntry*)(base + header.tocOffset);
+        names = (const char*)(entries + count);
+        return size_t(count);
+    }
+
+    bool isOpen() const { return base != nullptr; }
+    bool contains(const std::string& name) const { return base && find(name); }
+
+    // The entry's bytes in the mapping when it is stored raw (no copy), else
+    // nullptr
+    const unsigned char* view(const std::string& name, size_t& size) const
+    {
+        const PackEntry* entry = base ? find(name) : nullptr;
+        if (!entry || !entry->raw)
+            return nullptr;
+        size = size_t(entry->size);
+        return base + entry->offset + entry->blockCount * sizeof(PackBlock);
+    }
+
+    // Verifies and decompresses the entry's blocks in parallel
+    Expected<std::vector<unsigned char>> read(const std::string& name) const
+    {
+        const PackEntry* entry = base ? find(name) : nullptr;
+        if (!entry)
+            return AssetError{ "Recurso no encontrado en el paquete: " + name };
+        std::vector<size_t> offsets;
+        if (!blockOffsets(*entry, offsets))
+            return AssetError{ "Recurso danado en el paquete: " + name };
+
+        std::vector<unsigned char> data(size_t(entry->size));
+        std::atomic<bool> failed{ false };
+        jobSystem.parallelFor(entry->blockCount, 1, [&](size_t first, size_t last) {
+            for (size_t b = first; b < last; b++)
+                if (!readBlock(*entry, offsets, b, data.data() + b * PACK_BLOCK_SIZE))
+                    failed = true;
+        });
+        if (failed)
+            return AssetError{ "Recurso danado en el paquete: " + name };
+        return data;
+    }
+
+    // size bytes of the entry from offset on, decompressing only the blocks
+    // that cover them; on the calling thread
+    Expected<std::vector<unsigned char>> read(const std::string& name, uint64_t offset, size_t size) const
+    {
+        const PackEntry* entry = base ? find(name) : nullptr;
+        if (!entry)
+            return AssetError{ "Recurso no encontrado en el paquete: " + name };
+        std::vector<size_t> offsets;
+        if (!blockOffsets(*entry, offsets) || offset > entry->size || size > entry->size - offset)
+            return AssetError{ "Recurso danado en el paquete: " + name };
+
+        std::vector<unsigned char> data(size), block;
+        for (uint64_t at = offset; at < offset + size;)
+        {
+            size_t b = size_t(at / PACK_BLOCK_SIZE), begin = size_t(at % PACK_BLOCK_SIZE);
+            size_t count = std::min<size_t>(PACK_BLOCK_SIZE - begin, size_t(offset + size - at));
+            block.resize(std::min<size_t>(PACK_BLOCK_SIZE, size_t(entry->size) - b * PACK_BLOCK_SIZE));
+            if (!readBlock(*entry, offsets, b, block.data()))
+                return AssetError{ "Recurso danado en el paquete: " + name };
+            std::memcpy(data.data() + (at - offset), block.data() + begin, count);
+            at += count;
+        }
+        return data;
+    }
+
+private:
+    // Where each block's payload starts in the mapping, and where the last
+    // ends; false if the entry does not fit the pack
+    bool blockOffsets(const PackEntry& entry, std::vector<size_t>& offsets) const
+    {
+        if (entry.offset > length || entry.storedSize > length - entry.offset ||
+            uint64_t(entry.blockCount) * sizeof(PackBlock) > entry.storedSize || entry.size > uint64_t(entry.blockCount) * PACK_BLOCK_SIZE)
+            return false;
+        const unsigned char* table = base + entry.offset;
+        offsets.assign(entry.blockCount + 1, size_t(entry.offset) + entry.blockCount * sizeof(PackBlock));
+        for (uint32_t b = 0; b < entry.blockCount; b++)
+        {
+            PackBlock block;
+            std::memcpy(&block, table + b * sizeof(PackBlock), sizeof(block));
+            offsets[b + 1] = offsets[b] + (block.storedSize & ~PACK_BLOCK_RAW);
+        }
+        return offsets.back() <= size_t(entry.offset + entry.storedSize);
+    }
+
+    // Verifies block b and writes its bytes to out
+    bool readBlock(const PackEntry& entry, const std::vector<size_t>& offsets, size_t b, unsigned char* out) const
+    {
+        PackBlock block;
+        std::memcpy(&block, base + entry.offset + b * sizeof(PackBlock), sizeof(block));
+        const unsigned char* stored = base + offsets[b];
+        size_t storedSize = offsets[b + 1] - offsets[b];
+        size_t begin = b * PACK_BLOCK_SIZE, size = std::min<size_t>(PACK_BLOCK_SIZE, size_t(entry.size) - std::min<size_t>(begin, size_t(entry.size)));
+        if (uint32_t(packChecksum(stored, storedSize)) != block.checksum)
+            return false;
+        if (!(block.storedSize & PACK_BLOCK_RAW))
+            return lz4::decompress(stored, storedSize, out, size);
+        if (storedSize != size)
+            return false;
+        std::memcpy(out, stored, size);
+        return true;
+    }
+};
+
+inline AssetPack assetPack;
+
+// Bytes of an asset: from assetPack when it has the name, else the loose file
+// directory + name
+inline Task<Expected<std::vector<unsigned char>>> readAsset(std::string directory, std::string name)
+{
+    if (assetPack.contains(name))
+    {
+        co_await resumeOnJobs();
+        co_return assetPack.read(name);
+    }
+    co_return co_await ioPool.read(directory + name);
+}
+
+// size bytes of an asset from offset on, without reading the rest: a range
+// of the pack entry or of the loose file. Resumes on a job system worker.
+inline Task<Expected<std::vector<unsigned char>>> readAsset(std::string directory, std::string name, uint64_t offset, size_t size)
+{
+    if (assetPack.contains(name))
+    {
+        co_await resumeOnJobs();
+        co_return assetPack.read(name, offset, size);
+    }
+    co_return co_await ioPool.read(directory + name, offset, size);
+}
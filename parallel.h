@@ -0,0 +1,12 @@
+#pragma once
+
+// Splits [0, count) into ranges of at most grain items and runs them on the
+// job system's workers, the calling thread helping until all are done.
+
+#include "jobs.h"
+
+template <class Function>
+void parallelFor(size_t count, size_t grain, const Function& function)
+{
+    jobSystem.parallelFor(count, grain, function);
+}
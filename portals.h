@@ -0,0 +1,374 @@
+#pragma once
+
+// Portal scenes: rectangular portals join places of the same Euclidean world
+// with arbitrary rigid transforms, so a doorway can open anywhere, including
+// onto itself. Looking into a portal shows the world as seen out of its
+// target, whose contents are mapped into the portal's frame by
+//   transform = frame * flip * inverse(target.frame)
+// (flip turns the exit around to face back through the entrance).
+//
+// Rendering is a depth-first recursion on the stencil buffer. A level is the
+// region where stencil == level; for each portal visible in it the portal is
+// marked (stencil + 1), its region reset to the background at the far plane,
+// the next level drawn inside, and the portal's own depth written back as the
+// stencil is restored. Inner levels use an oblique projection whose near plane
+// is the portal plane, so nothing between the eye and the portal leaks in, and
+// their frustum is narrowed to the portal's screen rectangle (also used as the
+// scissor), which culls objects and portals outside it.
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "frustum.h"
+
+#define PORTAL_MAX_DEPTH 8 // levels below the camera's, bounded by 8 stencil bits
+
+class PortalScene
+{
+public:
+    struct Portal
+    {
+        glm::mat4x4 frame; // quad in the local xy plane, front facing +z
+        glm::vec2 size;
+        int target; // portal the view comes out of
+    };
+
+    // Accumulated since the last dump()
+    struct LevelStats
+    {
+        size_t views = 0; // times the level was entered
+        size_t drawn = 0;
+        size_t culled = 0;
+        double cpuMs = 0.0; // excluding deeper levels
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<Portal> portals;
+    int maxDepth = 4;
+    GLuint vao = 0, vbo = 0;
+    bool dirty = true;
+    LevelStats levels[PORTAL_MAX_DEPTH + 1];
+    size_t frames = 0, viewsThisFrame = 0;
+
+    // State of one render() call
+    struct Pass
+    {
+        glm::vec3 eye;
+        glm::mat4x4 view, projection;
+        GLuint quadProgram, sceneProgram;
+        glm::vec4 background;
+        glm::ivec4 viewport;
+    };
+
+    static glm::mat4x4 flip()
+    {
+        return glm::rotate(glm::mat4x4(1.0f), 3.14159265f, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    glm::vec4 corner(const Portal& portal, int i) const
+    {
+        float x = (i == 1 || i == 2) ? 0.5f : -0.5f;
+        float y = (i >= 2) ? 0.5f : -0.5f;
+        return portal.frame * glm::vec4(x * portal.size.x, y * portal.size.y, 0.0f, 1.0f);
+    }
+
+    void upload()
+    {
+        std::vector<float> vertices;
+        for (const Portal& portal : portals)
+            for (int i = 0; i < 4; i++)
+            {
+                glm::vec4 p = corner(portal, i);
+                vertices.insert(vertices.end(), { p.x, p.y, p.z, 0.0f, 0.0f });
+            }
+
+        if (!vao)
+        {
+            glGenVertexArrays(1, &vao);
+            glGenBuffers(1, &vbo);
+        }
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+        dirty = false;
+    }
+
+    // Screen bounds (NDC x0, y0, x1, y1) of a clip-space quad, cut at the
+    // eye plane; false if nothing of it is in front of the eye
+    static bool screenRect(const glm::vec4 clip[4], glm::vec4& rect)
+    {
+        const float nearW = 1e-4f;
+        glm::vec2 low(1.0f), high(-1.0f);
+        bool any = false;
+        for (int i = 0; i < 4; i++)
+        {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 4];
+            glm::vec4 points[2];
+            int count = 0;
+            if (a.w >= nearW)
+                points[count++] = a;
+            if ((a.w >= nearW) != (b.w >= nearW))
+                points[count++] = a + (b - a) * ((nearW - a.w) / (b.w - a.w));
+            for (int k = 0; k < count; k++)
+            {
+                glm::vec2 ndc = glm::vec2(points[k]) / points[k].w;
+                low = any ? glm::min(low, ndc) : ndc;
+                high = any ? glm::max(high, ndc) : ndc;
+                any = true;
+            }
+        }
+        rect = glm::vec4(glm::max(low, glm::vec2(-1.0f)), glm::min(high, glm::vec2(1.0f)));
+        return any;
+    }
+
+    // Lengyel's oblique near plane: projection whose near plane is the
+    // view-space plane (camera on its negative side)
+    static glm::mat4x4 obliqueProjection(glm::mat4x4 projection, const glm::vec4& plane)
+    {
+        glm::vec4 q((glm::sign(plane.x) + projection[2][0]) / projection[0][0],
+                    (glm::sign(plane.y) + projection[2][1]) / projection[1][1],
+                    -1.0f,
+                    (1.0f + projection[2][2]) / projection[3][2]);
+        glm::vec4 c = plane * (2.0f / glm::dot(plane, q));
+        for (int col = 0; col < 4; col++)
+            projection[col][2] = c[col] - projection[col][3];
+        return projection;
+    }
+
+    void scissor(const Pass& pass, const glm::vec4& rect) const
+    {
+        int x0 = pass.viewport.x + int(std::floor((rect.x * 0.5f + 0.5f) * pass.viewport.z));
+        int y0 = pass.viewport.y + int(std::floor((rect.y * 0.5f + 0.5f) * pass.viewport.w));
+        int x1 = pass.viewport.x + int(std::ceil((rect.z * 0.5f + 0.5f) * pass.viewport.z));
+        int y1 = pass.viewport.y + int(std::ceil((rect.w * 0.5f + 0.5f) * pass.viewport.w));
+        glScissor(x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0));
+    }
+
+    void drawQuad(const Pass& pass, size_t index, const glm::mat4x4& view, const glm::mat4x4& projection) const
+    {
+        glUseProgram(pass.quadProgram);
+        glUniformMatrix4fv(glGetUniformLocation(pass.quadProgram, "model"), 1, GL_FALSE, glm::value_ptr(glm::mat4x4(1.0f)));
+        glUniformMatrix4fv(glGetUniformLocation(pass.quadProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(pass.quadProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform4fv(glGetUniformLocation(pass.quadProgram, "color"), 1, glm::value_ptr(pass.background));
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLE_FAN, GLint(index * 4), 4);
+        glBindVertexArray(0);
+    }
+
+    // Draws the level whose world is mapped by `transform` and seen through
+    // `rect` with `projection`; recurses into the portals visible in it
+    template <class DrawObject>
+    void renderLevel(const Pass& pass, int level, const glm::mat4x4& transform, const glm::mat4x4& projection, const glm::vec4& rect,
+                     const std::vector<glm::vec4>& spheres, const DrawObject& drawObject)
+    {
+        LevelStats& stats = levels[level];
+        stats.views++;
+        viewsThisFrame++;
+        Clock::time_point start = Clock::now();
+
+        glm::mat4x4 view = pass.view * transform;
+        scissor(pass, rect);
+
+        if (level < maxDepth)
+        {
+            for (size_t i = 0; i < portals.size(); i++)
+            {
+                const Portal& portal = portals[i];
+                glm::vec4 c[4];
+                glm::vec3 center(0.0f);
+                for (int k = 0; k < 4; k++)
+                {
+                    glm::vec4 p = transform * corner(portal, k);
+                    center += glm::vec3(p) * 0.25f;
+                    c[k] = projection * pass.view * p;
+                }
+                glm::vec3 normal = glm::vec3(transform * portal.frame[2]);
+                if (glm::dot(pass.eye - center, normal) <= 0.0f)
+                    continue;
+                // Entirely behind the near (portal) plane: clipped away
+                bool inFront = false;
+                for (int k = 0; k < 4 && !inFront; k++)
+                    inFront = c[k].z >= -c[k].w;
+                glm::vec4 inner;
+                if (!inFront || !screenRect(c, inner))
+                    continue;
+                inner = glm::vec4(glm::max(glm::vec2(inner), glm::vec2(rect)), glm::min(glm::vec2(inner.z, inner.w), glm::vec2(rect.z, rect.w)));
+                if (inner.x >= inner.z || inner.y >= inner.w)
+                    continue;
+
+                // Mark the visible part of the portal
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                glDepthMask(GL_FALSE);
+                glStencilFunc(GL_EQUAL, level, 0xFF);
+                glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+                drawQuad(pass, i, view, projection);
+
+                // Background at the far plane inside it
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthMask(GL_TRUE);
+                glDepthFunc(GL_ALWAYS);
+                glDepthRange(1.0, 1.0);
+                glStencilFunc(GL_EQUAL, level + 1, 0xFF);
+                glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+                drawQuad(pass, i, view, projection);
+                glDepthRange(0.0, 1.0);
+                glDepthFunc(GL_LESS);
+
+                glm::mat4x4 inside = transform * portal.frame * flip() * glm::inverse(portals[portal.target].frame);
+                // Portal plane in view space, facing away from the eye
+                glm::vec4 plane = glm::transpose(glm::inverse(pass.view)) * glm::vec4(-normal, glm::dot(normal, center));
+                stats.cpuMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                renderLevel(pass, level + 1, inside, obliqueProjection(pass.projection, plane), inner, spheres, drawObject);
+                start = Clock::now();
+                scissor(pass, rect);
+
+                // Restore the stencil and leave the portal's depth
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                glDepthFunc(GL_ALWAYS);
+                glStencilFunc(GL_EQUAL, level + 1, 0xFF);
+                glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
+                drawQuad(pass, i, view, projection);
+                glDepthFunc(GL_LESS);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            }
+        }
+
+        // This level's objects, culled to the narrowed frustum
+        Frustum frustum(projection * view, rect);
+        glStencilFunc(GL_EQUAL, level, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        glUseProgram(pass.sceneProgram);
+        glUniformMatrix4fv(glGetUniformLocation(pass.sceneProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(pass.sceneProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        for (size_t i = 0; i < spheres.size(); i++)
+        {
+            // Spheres are in world space, the frustum in this level's
+            if (frustum.intersects(spheres[i]))
+            {
+                drawObject(i);
+                stats.drawn++;
+            }
+            else
+                stats.culled++;
+        }
+        stats.cpuMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+public:
+    PortalScene()
+    {
+        // A corridor folded onto itself: the portal in front of the house
+        // opens out of the one 30 units behind it, facing back, and the other
+        // way round, so each one shows the house again, further away
+        portals.push_back({ glm::translate(glm::mat4x4(1.0f), glm::vec3(0.0f, 0.0f, 15.0f)), glm::vec2(8.0f, 10.0f), 1 });
+        portals.push_back({ glm::translate(glm::mat4x4(1.0f), glm::vec3(0.0f, 0.0f, 45.0f)) * flip(), glm::vec2(8.0f, 10.0f), 0 });
+    }
+
+    // One portal per line: "cx cy cz yaw width height target", yaw in degrees
+    // about +y, '#' starts a comment
+    bool load(const std::string& file)
+    {
+        std::ifstream in(file);
+        if (!in)
+            return false;
+        std::vector<Portal> loaded;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream words(line);
+            glm::vec3 center;
+            float yaw;
+            Portal portal;
+            if (!(words >> center.x >> center.y >> center.z >> yaw >> portal.size.x >> portal.size.y >> portal.target))
+                continue;
+            portal.frame = glm::rotate(glm::translate(glm::mat4x4(1.0f), center), glm::radians(yaw), glm::vec3(0.0f, 1.0f, 0.0f));
+            loaded.push_back(portal);
+        }
+        for (const Portal& portal : loaded)
+            if (portal.target < 0 || portal.target >= int(loaded.size()))
+                return false;
+        portals = loaded;
+        dirty = true;
+        return true;
+    }
+
+    void setMaxDepth(int depth)
+    {
+        maxDepth = std::clamp(depth, 0, PORTAL_MAX_DEPTH);
+    }
+
+    // Draws the scene through the portals. spheres are the objects' world
+    // bounding spheres; drawObject(i) draws object i with the scene program
+    // (its view and projection are set here per level). quadProgram is an
+    // untextured program with a color uniform. Needs a stencil buffer; the
+    // stencil must be cleared to 0.
+    template <class DrawObject>
+    void render(const glm::vec3& eye, const glm::mat4x4& view, const glm::mat4x4& projection, GLuint quadProgram, GLuint sceneProgram,
+                const glm::vec4& background, const std::vector<glm::vec4>& spheres, const DrawObject& drawObject)
+    {
+        if (dirty)
+            upload();
+        Pass pass = { eye, view, projection, quadProgram, sceneProgram, background, glm::ivec4(0, 0, 0, 0) };
+        glGetIntegerv(GL_VIEWPORT, glm::value_ptr(pass.viewport));
+
+        frames++;
+        viewsThisFrame = 0;
+        glEnable(GL_STENCIL_TEST);
+        glEnable(GL_SCISSOR_TEST);
+        renderLevel(pass, 0, glm::mat4x4(1.0f), projection, glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f), spheres, drawObject);
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_STENCIL_TEST);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+    }
+
+    // Levels drawn by the last render()
+    size_t getViews() const
+    {
+        return viewsThisFrame;
+    }
+
+    // Per-level averages since the last dump, then resets them
+    void dump(std::ostream& os)
+    {
+        if (frames == 0)
+            return;
+        std::ios::fmtflags flags = os.flags();
+        os << "Portals: " << portals.size() << " portals, depth " << maxDepth << ", " << frames << " frames\n";
+        os << "  level     views/frame  drawn/frame culled/frame   cpu ms\n";
+        for (int level = 0; level <= maxDepth; level++)
+        {
+            const LevelStats& s = levels[level];
+            os << std::fixed << std::setprecision(3) << "  " << std::setw(5) << level << std::setw(16) << double(s.views) / frames
+               << std::setw(13) << double(s.drawn) / frames << std::setw(13) << double(s.culled) / frames
+               << std::setw(9) << s.cpuMs / frames << '\n';
+            levels[level] = LevelStats();
+        }
+        frames = 0;
+        os.flags(flags);
+    }
+};
+
+inline PortalScene portalScene;
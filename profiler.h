@@ -0,0 +1,195 @@
+#pragma once
+
+// Frame profiler: named scopes measured on the CPU with steady_clock and on the
+// GPU with a pair of GL_TIMESTAMP queries (glQueryCounter), so scopes may nest.
+// Query sets live in a ring of PROFILER_FRAMES frames and are only read back
+// once GL_QUERY_RESULT_AVAILABLE says so; a frame whose results are still in
+// flight when its slot comes around again is dropped instead of stalling.
+
+#include <glad/gl.h>
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define PROFILER_FRAMES 4
+#define PROFILER_MAX_SCOPES 32
+#define PROFILER_HISTORY 120
+
+class Profiler
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct ScopeRecord
+    {
+        const char* name;
+        int depth;
+        Clock::time_point cpuStart;
+        double cpuMs;
+    };
+
+    struct FrameRecord
+    {
+        GLuint queries[PROFILER_MAX_SCOPES][2];
+        ScopeRecord scopes[PROFILER_MAX_SCOPES];
+        int count = 0;
+        bool pending = false;
+    };
+
+    // Rolling window per scope name
+    struct ScopeStats
+    {
+        std::string name;
+        int depth;
+        double cpu[PROFILER_HISTORY];
+        double gpu[PROFILER_HISTORY];
+        int samples = 0;
+        int head = 0;
+    };
+
+    FrameRecord frames[PROFILER_FRAMES];
+    std::vector<ScopeStats> stats;
+    int current = -1;
+    int depth = 0;
+    size_t dropped = 0;
+    bool enabled = true;
+
+    ScopeStats& statsFor(const char* name, int scopeDepth)
+    {
+        for (ScopeStats& s : stats)
+            if (s.name == name && s.depth == scopeDepth)
+                return s;
+        stats.push_back(ScopeStats());
+        stats.back().name = name;
+        stats.back().depth = scopeDepth;
+        return stats.back();
+    }
+
+    void resolve(FrameRecord& frame)
+    {
+        if (!frame.pending)
+            return;
+        frame.pending = false;
+        if (frame.count == 0)
+            return;
+
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.count - 1][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            dropped++;
+            return;
+        }
+
+        for (int i = 0; i < frame.count; i++)
+        {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[i][0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame.queries[i][1], GL_QUERY_RESULT, &end);
+
+            ScopeStats& s = statsFor(frame.scopes[i].name, frame.scopes[i].depth);
+            s.cpu[s.head] = frame.scopes[i].cpuMs;
+            s.gpu[s.head] = (end - start) / 1.0e6;
+            s.head = (s.head + 1) % PROFILER_HISTORY;
+            if (s.samples < PROFILER_HISTORY)
+                s.samples++;
+        }
+    }
+
+public:
+    // Closes the previous frame and opens the next one; call once per frame
+    void newFrame()
+    {
+        if (!enabled)
+            return;
+
+        if (current < 0)
+        {
+            for (FrameRecord& frame : frames)
+                glGenQueries(2 * PROFILER_MAX_SCOPES, &frame.queries[0][0]);
+        }
+        else
+            frames[current].pending = true;
+
+        current = (current + 1) % PROFILER_FRAMES;
+        depth = 0;
+        resolve(frames[current]);
+        frames[current].count = 0;
+    }
+
+    int beginScope(const char* name)
+    {
+        if (current < 0 || frames[current].count == PROFILER_MAX_SCOPES)
+            return -1;
+
+        FrameRecord& frame = frames[current];
+        int index = frame.count++;
+        frame.scopes[index].name = name;
+        frame.scopes[index].depth = depth++;
+        frame.scopes[index].cpuStart = Clock::now();
+        glQueryCounter(frame.queries[index][0], GL_TIMESTAMP);
+        return index;
+    }
+
+    void endScope(int index)
+    {
+        if (index < 0)
+            return;
+
+        FrameRecord& frame = frames[current];
+        glQueryCounter(frame.queries[index][1], GL_TIMESTAMP);
+        frame.scopes[index].cpuMs = std::chrono::duration<double, std::milli>(Clock::now() - frame.scopes[index].cpuStart).count();
+        depth--;
+    }
+
+    void setEnabled(bool value)
+    {
+        enabled = value;
+    }
+
+    void dump(std::ostream& os) const
+    {
+        std::ios::fmtflags flags = os.flags();
+        std::streamsize precision = os.precision();
+        os << "Profiler: rolling average over " << PROFILER_HISTORY << " frames, " << dropped << " frames dropped\n";
+        os << std::left << std::setw(28) << "  scope" << std::right << std::setw(10) << "cpu ms" << std::setw(10) << "gpu ms" << '\n';
+        for (const ScopeStats& s : stats)
+        {
+            double cpu = 0.0, gpu = 0.0;
+            for (int i = 0; i < s.samples; i++)
+            {
+                cpu += s.cpu[i];
+                gpu += s.gpu[i];
+            }
+            os << std::left << std::setw(28) << (std::string(2 + 2 * s.depth, ' ') + s.name)
+               << std::right << std::fixed << std::setprecision(3)
+               << std::setw(10) << cpu / s.samples << std::setw(10) << gpu / s.samples << '\n';
+        }
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+inline Profiler profiler;
+
+// RAII scope on the global profiler
+class ProfileScope
+{
+    int index;
+
+public:
+    ProfileScope(const char* name) :
+        index(profiler.beginScope(name))
+    {
+    }
+
+    ~ProfileScope()
+    {
+        profiler.endScope(index);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
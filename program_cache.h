@@ -0,0 +1,245 @@
+#pragma once
+
+// Linked program binaries (GL 4.1 / ARB_get_program_binary) kept in the
+// derived data cache. Entries are keyed by the shader sources and the
+// driver's vendor, renderer and version strings, so a driver update simply
+// misses. A binary the driver rejects falls back to compiling from source and
+// rewrites the entry.
+
+#include <glad/gl.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "derived_cache.h"
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#define PROGRAM_CACHE_VERSION 2
+
+class ProgramCache
+{
+    typedef void (GLAD_API_PTR* GetProgramBinaryFn)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+    typedef void (GLAD_API_PTR* ProgramBinaryFn)(GLuint, GLenum, const void*, GLsizei);
+    typedef void (GLAD_API_PTR* ProgramParameteriFn)(GLuint, GLenum, GLint);
+
+    struct Header
+    {
+        uint32_t format;
+        uint32_t length;
+        double compileMs;
+    };
+
+    GetProgramBinaryFn getProgramBinary = nullptr;
+    ProgramBinaryFn programBinary = nullptr;
+    ProgramParameteriFn programParameteri = nullptr;
+    DerivedCache* cache = nullptr;
+    std::string driver;
+    double savedMs = 0.0;
+
+    typedef std::chrono::steady_clock Clock;
+
+    static double since(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    DerivedKey entryKey(const char* vertexSource, const char* fragmentSource) const
+    {
+        return DerivedKey("program", PROGRAM_CACHE_VERSION)
+            .add(vertexSource, std::strlen(vertexSource))
+            .add(fragmentSource, std::strlen(fragmentSource))
+            .add(driver);
+    }
+
+    // No status query here: checking would block on a parallel compile
+    static GLuint compileShader(GLenum type, const char* source)
+    {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    static void reportShader(GLuint shader)
+    {
+        int success;
+        char infoLog[512];
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, 512, NULL, infoLog);
+            std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
+        }
+    }
+
+    static bool linked(GLuint program)
+    {
+        int success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        return success;
+    }
+
+    GLuint loadBinary(const DerivedKey& key, double& compileMs)
+    {
+        std::vector<unsigned char> bytes;
+        Header header;
+        if (!cache->get(key, bytes) || bytes.size() < sizeof(header))
+            return 0;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (header.length != bytes.size() - sizeof(header))
+            return 0;
+
+        GLuint program = glCreateProgram();
+        programBinary(program, header.format, bytes.data() + sizeof(header), header.length);
+        if (!linked(program))
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        compileMs = header.compileMs;
+        return program;
+    }
+
+    void storeBinary(GLuint program, const DerivedKey& key, double compileMs)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<unsigned char> bytes(sizeof(Header) + length);
+        Header header = { 0, 0, compileMs };
+        GLenum format = 0;
+        GLsizei written = 0;
+        getProgramBinary(program, length, &written, &format, bytes.data() + sizeof(header));
+        header.format = format;
+        header.length = written;
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        bytes.resize(sizeof(header) + written);
+        cache->put(key, bytes);
+    }
+
+public:
+    // load resolves GL entry points (glfwGetProcAddress); the cache stays
+    // disabled when the driver exposes no binary formats or _cache is not
+    // enabled.
+    void init(GLADloadfunc load, DerivedCache& _cache)
+    {
+        cache = &_cache;
+        driver = std::string((const char*)glGetString(GL_VENDOR)) + '\n' +
+                 (const char*)glGetString(GL_RENDERER) + '\n' +
+                 (const char*)glGetString(GL_VERSION);
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        glGetError(); // GL_INVALID_ENUM before 4.1 without the extension
+        if (formats <= 0 || !cache->isEnabled())
+            return;
+
+        getProgramBinary = (GetProgramBinaryFn)load("glGetProgramBinary");
+        programBinary = (ProgramBinaryFn)load("glProgramBinary");
+        programParameteri = (ProgramParameteriFn)load("glProgramParameteri");
+        if (!getProgramBinary || !programBinary || !programParameteri)
+            getProgramBinary = nullptr, programBinary = nullptr, programParameteri = nullptr;
+    }
+
+    bool isEnabled() const
+    {
+        return programBinary != nullptr;
+    }
+
+    // A program whose compile and link have been issued but not checked yet,
+    // so drivers with parallel compilation can work on several at once. The
+    // compile time stored with its binary is what begin() and finish() block
+    // for, not the time in between, when the program may wait for first use.
+    struct Pending
+    {
+        GLuint program;
+        bool cached;
+        DerivedKey key;
+        double issueMs; // spent in begin()
+    };
+
+    Pending begin(const char* vertexSource, const char* fragmentSource)
+    {
+        Clock::time_point start = Clock::now();
+        Pending pending = { 0, false, entryKey(vertexSource, fragmentSource), 0.0 };
+        if (isEnabled())
+        {
+            double compileMs = 0.0;
+            pending.program = loadBinary(pending.key, compileMs);
+            if (pending.program)
+            {
+                double loadMs = since(start);
+                savedMs += compileMs - loadMs;
+                pending.cached = true;
+                std::cout << "Program cache hit " << pending.key.fileName() << ": " << loadMs
+                          << " ms (compile+link took " << compileMs << " ms)\n";
+                return pending;
+            }
+        }
+
+        start = Clock::now();
+        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+        pending.program = glCreateProgram();
+        glAttachShader(pending.program, vertexShader);
+        glAttachShader(pending.program, fragmentShader);
+        if (isEnabled())
+            programParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(pending.program);
+        // Flagged for deletion, freed with the program
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        pending.issueMs = since(start);
+        return pending;
+    }
+
+    GLuint finish(const Pending& pending)
+    {
+        if (pending.cached)
+            return pending.program;
+
+        // Comprobar errores de enlace
+        Clock::time_point start = Clock::now();
+        if (!linked(pending.program))
+        {
+            GLuint shaders[2];
+            GLsizei count = 0;
+            glGetAttachedShaders(pending.program, 2, &count, shaders);
+            for (GLsizei i = 0; i < count; i++)
+                reportShader(shaders[i]);
+
+            char infoLog[512];
+            glGetProgramInfoLog(pending.program, 512, NULL, infoLog);
+            std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        }
+        else if (isEnabled())
+            storeBinary(pending.program, pending.key, pending.issueMs + since(start));
+        return pending.program;
+    }
+
+    GLuint build(const char* vertexSource, const char* fragmentSource)
+    {
+        return finish(begin(vertexSource, fragmentSource));
+    }
+
+    double getSavedMs() const
+    {
+        return savedMs;
+    }
+};
+
+inline ProgramCache programCache;
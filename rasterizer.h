@@ -0,0 +1,369 @@
+#pragma once
+
+// Software rasterizer for render checks without a GL driver. It draws Model
+// vertex/index data under Object transforms the way the viewer's GL path
+// does: port() in the vertex stage for S3 (again at -p for the antipodal
+// copy), clipping to the near and far planes, depth test LESS, alpha
+// blending, and the texture sampled bilinearly with repeat.
+//
+// Stages, each timed:
+//   vertex  clip-space positions in parallel; S3 ports with the curved math
+//           kernels
+//   bin     the triangle stream is cut into chunks; each chunk clips, sets
+//           up and bins its triangles into RASTER_TILE tiles on its own
+//   raster  tiles in parallel, each walking the chunks' bins in order so
+//           blending keeps the submission order. Coverage is tested
+//           BestPack::width pixels at a time with the three edge functions;
+//           covered pixels interpolate depth linearly and UVs
+//           perspective-correctly.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "curved_math.h"
+#include "parallel.h"
+#include "raytracer.h" // RayTexture
+
+#define RASTER_TILE 32
+#define RASTER_CHUNKS_PER_THREAD 4
+
+class Rasterizer
+{
+public:
+    struct Item
+    {
+        const std::vector<float>* vertices; // stride floats per vertex: x y z u v
+        size_t stride;
+        const std::vector<unsigned int>* indices;
+        const RayTexture* texture;
+        glm::mat4x4 model;
+    };
+
+    struct Stats
+    {
+        double vertexMs = 0.0, binMs = 0.0, rasterMs = 0.0, totalMs = 0.0;
+        size_t triangles = 0, setUp = 0, binned = 0, fragments = 0;
+        unsigned threads = 0;
+    };
+
+private:
+    struct ClipVertex
+    {
+        glm::vec4 position;
+        glm::vec2 uv;
+    };
+
+    // Screen-space triangle, y down, pixel centers at +0.5
+    struct Triangle
+    {
+        // E_i = a x + b y + c, vertex i's barycentric times the area
+        float a[3], b[3], c[3];
+        // Covered when E_i >= bias_i: 0 on top-left edges, just above 0
+        // on the others, so shared edges are drawn once
+        float bias[3];
+        float inverseArea;
+        float z[3], inverseW[3], uOverW[3], vOverW[3];
+        int minX, minY, maxX, maxY;
+        const RayTexture* texture;
+    };
+
+    // One pass over an item: its clip-space vertices start at firstVertex
+    struct Draw
+    {
+        const Item* item;
+        size_t firstVertex, firstTriangle;
+    };
+
+    int width = 0, height = 0, tilesX = 0, tilesY = 0;
+    std::vector<unsigned char> color;
+    std::vector<float> depth;
+    std::vector<ClipVertex> clipVertices;
+    std::vector<Draw> draws;
+    std::vector<std::vector<Triangle>> chunkTriangles;
+    std::vector<std::vector<std::vector<uint32_t>>> chunkBins; // [chunk][tile]
+    std::vector<size_t> tileFragments;
+
+    static double msSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Keeps the part of the polygon where dot(plane, position) >= 0
+    static int clipPolygon(const ClipVertex* in, int count, const glm::vec4& plane, ClipVertex* out)
+    {
+        int written = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const ClipVertex& from = in[i];
+            const ClipVertex& to = in[(i + 1) % count];
+            float dFrom = glm::dot(plane, from.position), dTo = glm::dot(plane, to.position);
+            if (dFrom >= 0.0f)
+                out[written++] = from;
+            if ((dFrom >= 0.0f) != (dTo >= 0.0f))
+            {
+                float t = dFrom / (dFrom - dTo);
+                out[written++] = { from.position + (to.position - from.position) * t, from.uv + (to.uv - from.uv) * t };
+            }
+        }
+        return written;
+    }
+
+    bool setUp(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, const RayTexture* texture, Triangle& tri) const
+    {
+        const ClipVertex* v[3] = { &v0, &v1, &v2 };
+        float x[3], y[3];
+        for (int k = 0; k < 3; k++)
+        {
+            const glm::vec4& p = v[k]->position;
+            float inverseW = 1.0f / p.w;
+            x[k] = (p.x * inverseW * 0.5f + 0.5f) * width;
+            y[k] = (0.5f - p.y * inverseW * 0.5f) * height;
+            tri.z[k] = p.z * inverseW * 0.5f + 0.5f;
+            tri.inverseW[k] = inverseW;
+            tri.uOverW[k] = v[k]->uv.x * inverseW;
+            tri.vOverW[k] = v[k]->uv.y * inverseW;
+        }
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area == 0.0f || !std::isfinite(area))
+            return false;
+        float sign = area > 0.0f ? 1.0f : -1.0f; // no face culling, as in the GL path
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3, k = (i + 2) % 3;
+            tri.a[i] = -(y[k] - y[j]) * sign;
+            tri.b[i] = (x[k] - x[j]) * sign;
+            tri.c[i] = -(tri.a[i] * x[j] + tri.b[i] * y[j]);
+            bool topLeft = tri.a[i] > 0.0f || (tri.a[i] == 0.0f && tri.b[i] > 0.0f);
+            tri.bias[i] = topLeft ? 0.0f : std::numeric_limits<float>::min();
+        }
+        tri.inverseArea = 1.0f / (area * sign);
+        // Clamped as floats: x / w can be far outside the int range
+        tri.minX = int(std::clamp(std::ceil(std::min({ x[0], x[1], x[2] }) - 0.5f), 0.0f, float(width)));
+        tri.minY = int(std::clamp(std::ceil(std::min({ y[0], y[1], y[2] }) - 0.5f), 0.0f, float(height)));
+        tri.maxX = int(std::clamp(std::floor(std::max({ x[0], x[1], x[2] }) - 0.5f), -1.0f, float(width - 1)));
+        tri.maxY = int(std::clamp(std::floor(std::max({ y[0], y[1], y[2] }) - 0.5f), -1.0f, float(height - 1)));
+        tri.texture = texture;
+        return tri.minX <= tri.maxX && tri.minY <= tri.maxY;
+    }
+
+    // Clips, sets up and bins the triangles [begin, end) of the draw stream
+    void bin(size_t chunk, size_t begin, size_t end)
+    {
+        std::vector<Triangle>& triangles = chunkTriangles[chunk];
+        std::vector<std::vector<uint32_t>>& bins = chunkBins[chunk];
+        triangles.clear();
+        for (std::vector<uint32_t>& tile : bins)
+            tile.clear();
+
+        size_t d = std::upper_bound(draws.begin(), draws.end(), begin, [](size_t t, const Draw& draw) { return t < draw.firstTriangle; }) -
+                   draws.begin() - 1;
+        for (size_t t = begin; t < end; t++)
+        {
+            while (d + 1 < draws.size() && draws[d + 1].firstTriangle <= t)
+                d++;
+            const Draw& draw = draws[d];
+            const unsigned int* index = &(*draw.item->indices)[(t - draw.firstTriangle) * 3];
+            ClipVertex polygon[5], clipped[5];
+            for (int k = 0; k < 3; k++)
+                polygon[k] = clipVertices[draw.firstVertex + index[k]];
+            // Near (z >= -w) and far (z <= w); x and y are left to the
+            // bounding box clamp
+            int count = clipPolygon(polygon, 3, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), clipped);
+            count = clipPolygon(clipped, count, glm::vec4(0.0f, 0.0f, -1.0f, 1.0f), polygon);
+            for (int k = 1; k + 1 < count; k++)
+            {
+                Triangle tri;
+                if (!setUp(polygon[0], polygon[k], polygon[k + 1], draw.item->texture, tri))
+                    continue;
+                uint32_t id = uint32_t(triangles.size());
+                triangles.push_back(tri);
+                for (int ty = tri.minY / RASTER_TILE; ty <= tri.maxY / RASTER_TILE; ty++)
+                    for (int tx = tri.minX / RASTER_TILE; tx <= tri.maxX / RASTER_TILE; tx++)
+                        bins[size_t(ty) * tilesX + tx].push_back(id);
+            }
+        }
+    }
+
+    template <class P>
+    size_t rasterize(const Triangle& tri, int x0, int y0, int x1, int y1)
+    {
+        static const float offsets[8] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f };
+        const P lanes = P::load(offsets);
+        const P a0 = P::set1(tri.a[0]), a1 = P::set1(tri.a[1]), a2 = P::set1(tri.a[2]);
+        const P bias0 = P::set1(tri.bias[0]), bias1 = P::set1(tri.bias[1]), bias2 = P::set1(tri.bias[2]);
+        size_t fragments = 0;
+        for (int y = y0; y <= y1; y++)
+        {
+            float py = y + 0.5f;
+            for (int x = x0; x <= x1; x += P::width)
+            {
+                float px = x + 0.5f;
+                P e0 = P::set1(tri.a[0] * px + tri.b[0] * py + tri.c[0]) + a0 * lanes;
+                P e1 = P::set1(tri.a[1] * px + tri.b[1] * py + tri.c[1]) + a1 * lanes;
+                P e2 = P::set1(tri.a[2] * px + tri.b[2] * py + tri.c[2]) + a2 * lanes;
+                int covered = P::bits((e0 >= bias0) & (e1 >= bias1) & (e2 >= bias2));
+                if (x1 - x + 1 < P::width)
+                    covered &= (1 << (x1 - x + 1)) - 1;
+                if (!covered)
+                    continue;
+
+                float w0[P::width], w1[P::width], w2[P::width];
+                e0.store(w0);
+                e1.store(w1);
+                e2.store(w2);
+                for (int lane = 0; lane < P::width; lane++)
+                {
+                    if (!(covered & (1 << lane)))
+                        continue;
+                    float l0 = w0[lane] * tri.inverseArea, l1 = w1[lane] * tri.inverseArea, l2 = w2[lane] * tri.inverseArea;
+                    size_t pixel = size_t(y) * width + x + lane;
+                    float z = l0 * tri.z[0] + l1 * tri.z[1] + l2 * tri.z[2];
+                    if (!(z < depth[pixel]))
+                        continue;
+                    depth[pixel] = z;
+                    fragments++;
+
+                    float w = 1.0f / (l0 * tri.inverseW[0] + l1 * tri.inverseW[1] + l2 * tri.inverseW[2]);
+                    glm::vec2 uv((l0 * tri.uOverW[0] + l1 * tri.uOverW[1] + l2 * tri.uOverW[2]) * w,
+                                 (l0 * tri.vOverW[0] + l1 * tri.vOverW[1] + l2 * tri.vOverW[2]) * w);
+                    glm::vec4 texel = tri.texture ? tri.texture->sample(uv) : glm::vec4(1.0f);
+                    unsigned char* out = &color[pixel * 3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        float blended = texel[k] * 255.0f * texel.w + out[k] * (1.0f - texel.w);
+                        out[k] = (unsigned char)(std::clamp(blended, 0.0f, 255.0f) + 0.5f);
+                    }
+                }
+            }
+        }
+        return fragments;
+    }
+
+public:
+    // Draws items as the viewer does for Euclidean space or S3 (curvature
+    // >= 0, no antipodal identification) into a cleared target
+    template <class Geometry>
+    Stats draw(const std::vector<Item>& items, const glm::mat4x4& view, const glm::mat4x4& projection, float scale, const glm::vec4& background,
+               int _width, int _height)
+    {
+        static_assert(Geometry::curvature >= 0 && !Geometry::identifiesAntipodes, "Euclidean or S3 only");
+        auto start = std::chrono::steady_clock::now();
+        Stats stats;
+        stats.threads = unsigned(jobSystem.size());
+        width = _width;
+        height = _height;
+        tilesX = (width + RASTER_TILE - 1) / RASTER_TILE;
+        tilesY = (height + RASTER_TILE - 1) / RASTER_TILE;
+        unsigned char clear[3];
+        for (int k = 0; k < 3; k++)
+            clear[k] = (unsigned char)(std::clamp(background[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+        color.resize(size_t(width) * height * 3);
+        for (size_t i = 0; i < color.size(); i += 3)
+            std::copy(clear, clear + 3, &color[i]);
+        depth.assign(size_t(width) * height, 1.0f);
+
+        // Vertex stage: S3 draws everything at p, then at -p
+        const glm::mat4x4 clip = projection * view;
+        const int copies = Geometry::curvature > 0 ? 2 : 1;
+        draws.clear();
+        size_t vertexCount = 0, triangleCount = 0;
+        for (int copy = 0; copy < copies; copy++)
+            for (const Item& item : items)
+            {
+                draws.push_back({ &item, vertexCount, triangleCount });
+                vertexCount += item.vertices->size() / item.stride;
+                triangleCount += item.indices->size() / 3;
+            }
+        clipVertices.resize(vertexCount);
+        std::vector<float> ported;
+        for (size_t d = 0; d < draws.size(); d++)
+        {
+            const Item& item = *draws[d].item;
+            const float* vertices = item.vertices->data();
+            size_t count = item.vertices->size() / item.stride;
+            float anti = d < items.size() ? 1.0f : -1.0f;
+            if (Geometry::curvature > 0)
+                ported.resize(count * 4);
+            parallelFor(count, 4096, [&](size_t begin, size_t end) {
+                if (Geometry::curvature > 0)
+                    batchTransformPort<CURVED_SPHERICAL>(vertices + begin * item.stride, item.stride, end - begin, item.model, scale,
+                                                         &ported[begin * 4]);
+                for (size_t i = begin; i < end; i++)
+                {
+                    const float* v = vertices + i * item.stride;
+                    glm::vec4 p = Geometry::curvature > 0 ? glm::vec4(ported[i * 4], ported[i * 4 + 1], ported[i * 4 + 2], ported[i * 4 + 3]) * anti
+                                                          : item.model * glm::vec4(v[0], v[1], v[2], 1.0f);
+                    clipVertices[draws[d].firstVertex + i] = { clip * p, glm::vec2(v[3], v[4]) };
+                }
+            });
+        }
+        stats.triangles = triangleCount;
+        stats.vertexMs = msSince(start);
+
+        // Bin stage
+        auto binStart = std::chrono::steady_clock::now();
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(triangleCount / 256, stats.threads * RASTER_CHUNKS_PER_THREAD));
+        chunkTriangles.resize(chunks);
+        chunkBins.resize(chunks);
+        for (std::vector<std::vector<uint32_t>>& bins : chunkBins)
+            bins.resize(size_t(tilesX) * tilesY);
+        parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t chunk = begin; chunk < end; chunk++)
+                bin(chunk, triangleCount * chunk / chunks, triangleCount * (chunk + 1) / chunks);
+        });
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            stats.setUp += chunkTriangles[chunk].size();
+            for (const std::vector<uint32_t>& tile : chunkBins[chunk])
+                stats.binned += tile.size();
+        }
+        stats.binMs = msSince(binStart);
+
+        // Raster stage
+        auto rasterStart = std::chrono::steady_clock::now();
+        size_t tiles = size_t(tilesX) * tilesY;
+        tileFragments.assign(tiles, 0);
+        parallelFor(tiles, 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++)
+            {
+                int tileX = int(tile % tilesX) * RASTER_TILE, tileY = int(tile / tilesX) * RASTER_TILE;
+                for (size_t chunk = 0; chunk < chunks; chunk++)
+                    for (uint32_t id : chunkBins[chunk][tile])
+                    {
+                        const Triangle& tri = chunkTriangles[chunk][id];
+                        tileFragments[tile] += rasterize<BestPack>(tri, std::max(tri.minX, tileX), std::max(tri.minY, tileY),
+                                                                    std::min(tri.maxX, tileX + RASTER_TILE - 1),
+                                                                    std::min(tri.maxY, tileY + RASTER_TILE - 1));
+                    }
+            }
+        });
+        for (size_t fragments : tileFragments)
+            stats.fragments += fragments;
+        stats.rasterMs = msSince(rasterStart);
+        stats.totalMs = msSince(start);
+        return stats;
+    }
+
+    // RGB, top row first
+    const std::vector<unsigned char>& getColor() const
+    {
+        return color;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Rasterizer::Stats& stats)
+{
+    return os << stats.triangles << " triangles (" << stats.setUp << " set up, " << stats.binned << " tile bins), " << stats.fragments
+              << " fragments on " << stats.threads << " threads: vertex " << stats.vertexMs << " ms, bin " << stats.binMs << " ms, raster "
+              << stats.rasterMs << " ms, total " << stats.totalMs << " ms";
+}
+
+inline Rasterizer rasterizer;
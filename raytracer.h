@@ -0,0 +1,376 @@
+#pragma once
+
+// CPU reference renderer for the curved modes. Every pixel follows the
+// geodesic leaving the eye (a great circle in S3, a hyperbola branch in H3)
+// and intersects it with each instance's MeshBvh, so the image shows what
+// the rasterizer approximates with port() and a projective divide. Hits are
+// shaded with the model texture sampled bilinearly at the interpolated UVs,
+// the way the textured fragment shader does.
+//
+// The image is cut into tiles. Each worker owns a contiguous run of them and
+// takes from its front; a worker that runs dry steals from the back of the
+// others' runs. A run is one 64-bit atomic (begin, end), so taking and
+// stealing are single compare-and-swaps.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mesh_bvh.h"
+#ifndef STBI_INCLUDE_STB_IMAGE_H // main.cpp includes it first with the implementation
+#include "stb_image.h"
+#endif
+
+#define RAYTRACER_TILE 16
+
+// RGBA8 image sampled like GL_LINEAR with GL_REPEAT
+class RayTexture
+{
+    int width = 0, height = 0;
+    std::vector<unsigned char> texels;
+
+    glm::vec4 texel(int x, int y) const
+    {
+        x %= width;
+        y %= height;
+        const unsigned char* p = &texels[(size_t(y < 0 ? y + height : y) * width + (x < 0 ? x + width : x)) * 4];
+        return glm::vec4(p[0], p[1], p[2], p[3]) * (1.0f / 255.0f);
+    }
+
+public:
+    // Uses stbi's global flip setting, so rows match the GL upload
+    bool load(const std::string& path)
+    {
+        int channels;
+        unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if (!data)
+            return false;
+        texels.assign(data, data + size_t(width) * height * 4);
+        stbi_image_free(data);
+        return true;
+    }
+
+    // From decoded RGBA8 rows, bottom-up like the GL upload
+    void assign(int _width, int _height, std::vector<unsigned char> _texels)
+    {
+        width = _width;
+        height = _height;
+        texels = std::move(_texels);
+    }
+
+    glm::vec4 sample(const glm::vec2& uv) const
+    {
+        if (texels.empty())
+            return glm::vec4(1.0f);
+        float x = uv.x * width - 0.5f, y = uv.y * height - 0.5f;
+        float fx = std::floor(x), fy = std::floor(y);
+        int ix = int(fx), iy = int(fy);
+        float sx = x - fx, sy = y - fy;
+        glm::vec4 top = texel(ix, iy) * (1.0f - sx) + texel(ix + 1, iy) * sx;
+        glm::vec4 bottom = texel(ix, iy + 1) * (1.0f - sx) + texel(ix + 1, iy + 1) * sx;
+        return top * (1.0f - sy) + bottom * sy;
+    }
+};
+
+class RayTracer
+{
+public:
+    struct Instance
+    {
+        const MeshBvh* mesh;
+        const std::vector<float>* vertices; // stride floats per vertex, u v at offset 3
+        const std::vector<unsigned int>* indices;
+        size_t stride;
+        const RayTexture* texture;
+        MeshBvh::Placement placement;
+    };
+
+    struct Hit
+    {
+        float t;
+        uint32_t instance, triangle, copy;
+        glm::vec3 barycentric;
+    };
+
+    struct Stats
+    {
+        double ms = 0.0;
+        size_t rays = 0, hits = 0, tiles = 0, steals = 0;
+        unsigned threads = 0;
+    };
+
+private:
+    std::vector<Instance> instances;
+    std::vector<glm::mat4x4> toCopies; // inverses of the isometries the scene is repeated under
+    std::map<std::string, RayTexture> textures;
+
+    static uint64_t pack(uint32_t begin, uint32_t end)
+    {
+        return uint64_t(end) << 32 | begin;
+    }
+
+    static bool take(std::atomic<uint64_t>& run, bool back, uint32_t& tile)
+    {
+        uint64_t value = run.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint32_t begin = uint32_t(value), end = uint32_t(value >> 32);
+            if (begin >= end)
+                return false;
+            uint64_t next = back ? pack(begin, end - 1) : pack(begin + 1, end);
+            if (run.compare_exchange_weak(value, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                tile = back ? end - 1 : begin;
+                return true;
+            }
+        }
+    }
+
+public:
+    void clear()
+    {
+        instances.clear();
+        toCopies.assign(1, glm::mat4x4(1.0f));
+    }
+
+    // Texture loaded once per path and kept; nullptr if it cannot be read
+    const RayTexture* texture(const std::string& path)
+    {
+        return texture(path, [&](RayTexture& texture) { return texture.load(path); });
+    }
+
+    // Same, filled by load(RayTexture&) -> bool the first time key is seen
+    template <class Load>
+    const RayTexture* texture(const std::string& key, Load load)
+    {
+        auto found = textures.find(key);
+        if (found == textures.end())
+        {
+            RayTexture texture;
+            if (!load(texture))
+                return nullptr;
+            found = textures.emplace(key, std::move(texture)).first;
+        }
+        return &found->second;
+    }
+
+    // Placement from MeshBvh::place() for the geometry traced
+    void add(Instance instance)
+    {
+        instances.push_back(std::move(instance));
+    }
+
+    // The scene is drawn once under each isometry (H3: the honeycomb cells)
+    void setCopies(const std::vector<glm::mat4x4>& copies)
+    {
+        toCopies.clear();
+        for (const glm::mat4x4& copy : copies)
+            toCopies.push_back(glm::inverse(copy));
+    }
+
+    // Closest hit along the geodesic from eye with unit tangent direction,
+    // t in radians; hit.instance is UINT32_MAX if nothing is hit before tMax
+    template <class Geometry>
+    Hit trace(const glm::vec4& eye, const glm::vec4& direction, float tMax) const
+    {
+        Hit hit = { tMax, UINT32_MAX, UINT32_MAX, 0, glm::vec3(0.0f) };
+        for (size_t c = 0; c < toCopies.size(); c++)
+        {
+            glm::vec4 localEye = toCopies[c] * eye, localDirection = toCopies[c] * direction;
+            for (size_t i = 0; i < instances.size(); i++)
+            {
+                uint32_t triangle;
+                glm::vec3 barycentric;
+                float t = instances[i].mesh->template geodesicRay<Geometry>(instances[i].placement, localEye, localDirection, hit.t, &triangle,
+                                                                             &barycentric);
+                if (t < hit.t)
+                    hit = { t, uint32_t(i), triangle, uint32_t(c), barycentric };
+            }
+        }
+        return hit;
+    }
+
+    glm::vec4 shade(const Hit& hit) const
+    {
+        const Instance& instance = instances[hit.instance];
+        glm::vec2 uv(0.0f);
+        for (int k = 0; k < 3; k++)
+        {
+            const float* vertex = &(*instance.vertices)[(*instance.indices)[hit.triangle * 3 + k] * instance.stride];
+            uv += glm::vec2(vertex[3], vertex[4]) * hit.barycentric[k];
+        }
+        return instance.texture ? instance.texture->sample(uv) : glm::vec4(1.0f);
+    }
+
+    // Renders view/projection (as the camera builds them for Geometry) into
+    // rgb, top row first. threads 0: one per hardware thread.
+    template <class Geometry>
+    Stats render(const glm::mat4x4& view, const glm::mat4x4& projection, float tMax, const glm::vec4& background, int width, int height,
+                 unsigned threads, std::vector<unsigned char>& rgb) const
+    {
+        auto start = std::chrono::steady_clock::now();
+        Stats stats;
+        stats.threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        rgb.assign(size_t(width) * height * 3, 0);
+
+        // The view matrix is an isometry of R^4: its inverse takes the view
+        // space eye (0, 0, 0, 1) and pixel directions to the world
+        glm::mat4x4 toWorld = glm::inverse(view);
+        glm::vec4 eye = toWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        int tilesX = (width + RAYTRACER_TILE - 1) / RAYTRACER_TILE, tilesY = (height + RAYTRACER_TILE - 1) / RAYTRACER_TILE;
+        stats.tiles = size_t(tilesX) * tilesY;
+
+        std::vector<std::atomic<uint64_t>> runs(stats.threads);
+        for (unsigned w = 0; w < stats.threads; w++)
+            runs[w] = pack(uint32_t(stats.tiles * w / stats.threads), uint32_t(stats.tiles * (w + 1) / stats.threads));
+        std::atomic<size_t> steals(0), hits(0);
+
+        auto renderTile = [&](uint32_t tile) {
+            int x0 = int(tile % tilesX) * RAYTRACER_TILE, y0 = int(tile / tilesX) * RAYTRACER_TILE;
+            size_t tileHits = 0;
+            for (int y = y0; y < std::min(y0 + RAYTRACER_TILE, height); y++)
+            {
+                for (int x = x0; x < std::min(x0 + RAYTRACER_TILE, width); x++)
+                {
+                    glm::vec2 ndc(2.0f * (x + 0.5f) / width - 1.0f, 1.0f - 2.0f * (y + 0.5f) / height);
+                    glm::vec3 direction = glm::normalize(glm::vec3(ndc.x / projection[0][0], ndc.y / projection[1][1], -1.0f));
+                    Hit hit = trace<Geometry>(eye, toWorld * glm::vec4(direction, 0.0f), tMax);
+                    glm::vec4 color = background;
+                    if (hit.instance != UINT32_MAX)
+                    {
+                        glm::vec4 texel = shade(hit);
+                        color = texel * texel.w + background * (1.0f - texel.w);
+                        tileHits++;
+                    }
+                    unsigned char* out = &rgb[(size_t(y) * width + x) * 3];
+                    for (int k = 0; k < 3; k++)
+                        out[k] = (unsigned char)(std::clamp(color[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+            hits += tileHits;
+        };
+        auto work = [&](unsigned self) {
+            uint32_t tile;
+            while (take(runs[self], false, tile))
+                renderTile(tile);
+            for (unsigned k = 1; k < stats.threads; k++)
+            {
+                unsigned victim = (self + k) % stats.threads;
+                while (take(runs[victim], true, tile))
+                {
+                    steals++;
+                    renderTile(tile);
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned w = 1; w < stats.threads; w++)
+            workers.emplace_back(work, w);
+        work(0);
+        for (std::thread& worker : workers)
+            worker.join();
+
+        stats.rays = size_t(width) * height;
+        stats.hits = hits;
+        stats.steals = steals;
+        stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const RayTracer::Stats& stats)
+{
+    return os << stats.rays << " rays (" << 100.0 * stats.hits / std::max<size_t>(stats.rays, 1) << "% hit) in " << stats.ms << " ms, "
+              << stats.rays / (stats.ms * 1e-3) / 1e6 << " Mrays/s on " << stats.threads << " threads, " << stats.tiles << " tiles, "
+              << stats.steals << " stolen";
+}
+
+// 8-bit RGB PNG, rows top first. The zlib stream uses stored blocks: no
+// compression, but no dependency either.
+inline bool writePng(const std::string& path, int width, int height, const std::vector<unsigned char>& rgb)
+{
+    static uint32_t table[256];
+    if (!table[1])
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    auto crc = [](const unsigned char* data, size_t size, uint32_t c) {
+        for (size_t i = 0; i < size; i++)
+            c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+        return c;
+    };
+    auto put32 = [](std::vector<unsigned char>& out, uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((unsigned char)(v >> shift));
+    };
+
+    std::vector<unsigned char> raw;
+    raw.reserve((size_t(width) * 3 + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        raw.push_back(0); // filter: none
+        raw.insert(raw.end(), rgb.begin() + size_t(y) * width * 3, rgb.begin() + size_t(y + 1) * width * 3);
+    }
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535)
+    {
+        size_t size = std::min<size_t>(65535, raw.size() - offset);
+        zlib.push_back(offset + size >= raw.size() ? 1 : 0);
+        zlib.push_back((unsigned char)size);
+        zlib.push_back((unsigned char)(size >> 8));
+        zlib.push_back((unsigned char)~size);
+        zlib.push_back((unsigned char)(~size >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+        if (raw.empty())
+            break;
+    }
+    uint32_t a = 1, b = 0;
+    for (unsigned char byte : raw)
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(zlib, b << 16 | a);
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.write("\x89PNG\r\n\x1a\n", 8);
+    auto chunk = [&](const char* type, const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> head;
+        put32(head, uint32_t(data.size()));
+        head.insert(head.end(), type, type + 4);
+        uint32_t c = crc(head.data() + 4, 4, 0xffffffffu);
+        c = crc(data.data(), data.size(), c) ^ 0xffffffffu;
+        std::vector<unsigned char> tail;
+        put32(tail, c);
+        file.write((const char*)head.data(), head.size());
+        file.write((const char*)data.data(), data.size());
+        file.write((const char*)tail.data(), tail.size());
+    };
+    std::vector<unsigned char> header;
+    put32(header, uint32_t(width));
+    put32(header, uint32_t(height));
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8-bit RGB
+    chunk("IHDR", header);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+    return bool(file);
+}
+
+inline RayTracer rayTracer;
@@ -0,0 +1,207 @@
+#pragma once
+
+// Ownership of loaded assets. GL objects live in move-only wrappers that
+// delete them when they go away, so a Model or texture can be moved but never
+// copied into two owners of the same handle. AssetRegistry hands out
+// shared_ptr handles, stable however the caller stores them, and loads each
+// asset once: a name seen before returns the same object, and a new name
+// whose content hash matches a loaded asset (the same image under two
+// material slots or file names) shares it too. The bytes such hits avoided
+// duplicating are reported.
+//
+// Registries holding GL objects must be cleared while the context is still
+// current.
+
+#include <glad/gl.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Traits: static GLuint create(), static void destroy(GLuint)
+template <class Traits>
+class GlObject
+{
+    GLuint id = 0;
+
+public:
+    GlObject() = default;
+    explicit GlObject(GLuint _id) : id(_id) {}
+    GlObject(GlObject&& other) noexcept : id(std::exchange(other.id, 0)) {}
+    GlObject& operator=(GlObject&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            id = std::exchange(other.id, 0);
+        }
+        return *this;
+    }
+    GlObject(const GlObject&) = delete;
+    GlObject& operator=(const GlObject&) = delete;
+    ~GlObject() { reset(); }
+
+    static GlObject create() { return GlObject(Traits::create()); }
+
+    GLuint get() const { return id; }
+    explicit operator bool() const { return id != 0; }
+
+    void reset()
+    {
+        if (id)
+            Traits::destroy(id);
+        id = 0;
+    }
+};
+
+struct GlBufferTraits
+{
+    static GLuint create()
+    {
+        GLuint id;
+        glGenBuffers(1, &id);
+        return id;
+    }
+    static void destroy(GLuint id) { glDeleteBuffers(1, &id); }
+};
+
+struct GlVertexArrayTraits
+{
+    static GLuint create()
+    {
+        GLuint id;
+        glGenVertexArrays(1, &id);
+        return id;
+    }
+    static void destroy(GLuint id) { glDeleteVertexArrays(1, &id); }
+};
+
+struct GlTextureTraits
+{
+    static GLuint create()
+    {
+        GLuint id;
+        glGenTextures(1, &id);
+        return id;
+    }
+    static void destroy(GLuint id) { glDeleteTextures(1, &id); }
+};
+
+struct GlFramebufferTraits
+{
+    static GLuint create()
+    {
+        GLuint id;
+        glGenFramebuffers(1, &id);
+        return id;
+    }
+    static void destroy(GLuint id) { glDeleteFramebuffers(1, &id); }
+};
+
+struct GlRenderbufferTraits
+{
+    static GLuint create()
+    {
+        GLuint id;
+        glGenRenderbuffers(1, &id);
+        return id;
+    }
+    static void destroy(GLuint id) { glDeleteRenderbuffers(1, &id); }
+};
+
+typedef GlObject<GlBufferTraits> GlBuffer;
+typedef GlObject<GlVertexArrayTraits> GlVertexArray;
+typedef GlObject<GlTextureTraits> GlTexture;
+typedef GlObject<GlFramebufferTraits> GlFramebuffer;
+typedef GlObject<GlRenderbufferTraits> GlRenderbuffer;
+
+struct RegistryStats
+{
+    size_t assets = 0, nameHits = 0, contentHits = 0;
+    uint64_t bytes = 0, savedBytes = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const RegistryStats& stats)
+{
+    return os << stats.assets << " loaded (" << stats.bytes / 1024 << " KiB), " << stats.nameHits << " reused by name, " << stats.contentHits
+              << " by content, " << stats.savedBytes / 1024 << " KiB not duplicated";
+}
+
+template <class T>
+class AssetRegistry
+{
+    struct Entry
+    {
+        std::shared_ptr<T> asset;
+        uint64_t content;
+        size_t bytes;
+    };
+
+    std::unordered_map<std::string, Entry> byName;
+    std::unordered_map<uint64_t, std::string> byContent; // first name loaded with that content
+    RegistryStats stats;
+    mutable std::mutex lock;
+
+public:
+    // Asset already registered under name, or nullptr
+    std::shared_ptr<T> find(const std::string& name)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = byName.find(name);
+        if (found == byName.end())
+            return nullptr;
+        stats.nameHits++;
+        stats.savedBytes += found->second.bytes;
+        return found->second.asset;
+    }
+
+    // Registers name for an asset with this content hash and size; make() ->
+    // shared_ptr<T> builds it only if neither name nor content is known yet
+    template <class Make>
+    std::shared_ptr<T> add(const std::string& name, uint64_t content, size_t bytes, Make make)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto named = byName.find(name);
+        if (named != byName.end())
+        {
+            stats.nameHits++;
+            stats.savedBytes += named->second.bytes;
+            return named->second.asset;
+        }
+        auto same = byContent.find(content);
+        if (same != byContent.end())
+        {
+            Entry entry = byName.at(same->second);
+            byName.emplace(name, entry);
+            stats.contentHits++;
+            stats.savedBytes += entry.bytes;
+            return entry.asset;
+        }
+        std::shared_ptr<T> asset = make();
+        byName.emplace(name, Entry{ asset, content, bytes });
+        byContent.emplace(content, name);
+        stats.assets++;
+        stats.bytes += bytes;
+        return asset;
+    }
+
+    // Drops the registry's references; assets go away with their last handle
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        byName.clear();
+        byContent.clear();
+        stats.assets = 0;
+        stats.bytes = 0;
+    }
+
+    RegistryStats getStats() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return stats;
+    }
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+// GPU memory budget for loaded assets. Every uploaded mesh and texture is a
+// Resident: it reports the CPU and GPU bytes it holds and the GPU bytes it
+// wants at the detail it is drawn with, and knows how to give some of the GPU
+// memory back (demote: drop its finest mip or LOD), all of it (evict), and
+// how to read more of itself back from the asset pack or derived cache
+// (restore, a coroutine). Drawing an asset marks it used; at the end of each
+// frame the manager first trims detail nothing asks for any more, then
+// demotes and evicts the least recently drawn assets until the total fits the
+// budget, never touching what was drawn in the last RESIDENCY_KEEP_FRAMES
+// frames, and finally starts restores for drawn assets short of what they
+// want, as far as the budget allows.
+//
+// Render thread only: assets are used while drawing and demoted or evicted
+// with GL calls. Restores run through the usual asset tasks and finish their
+// uploads in renderThread.pump().
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "assets.h"
+
+#define RESIDENCY_BUDGET (256ull << 20) // GPU bytes
+#define RESIDENCY_KEEP_FRAMES 2 // drawn this recently: never demoted
+#define RESIDENCY_MAX_RESTORES 2 // in flight at once
+
+class ResidencyManager;
+
+class Resident
+{
+    friend class ResidencyManager;
+
+    ResidencyManager* manager = nullptr;
+    uint64_t lastUse = 0; // frame
+    bool loading = false;
+    Task<bool> reload; // restore() while loading
+
+protected:
+    size_t cpuBytes = 0, gpuBytes = 0;
+    size_t wantedBytes = 0; // GPU bytes at the detail it is drawn with
+
+    // Leaves the manager, waiting for a restore in flight; called by the
+    // destructor of the derived class, while the restore can still use it
+    void release();
+
+public:
+    Resident() = default;
+    // Only before being added to a manager
+    Resident(Resident&& other) noexcept : cpuBytes(other.cpuBytes), gpuBytes(other.gpuBytes), wantedBytes(other.wantedBytes) {}
+    Resident& operator=(const Resident&) = delete;
+    virtual ~Resident()
+    {
+        release();
+    }
+
+    // Once per frame, before the budget is applied: settle wantedBytes
+    virtual void update() {}
+    // Frees the finest level still resident; false if only the coarsest is
+    // left
+    virtual bool demote() = 0;
+    // Frees all GPU memory; drawing is skipped until restored
+    virtual void evict() = 0;
+    // Reads the asset again and uploads more of it, towards wantedBytes;
+    // false on failure
+    virtual Task<bool> restore() = 0;
+
+    bool isResident() const
+    {
+        return gpuBytes > 0;
+    }
+
+    bool isComplete() const
+    {
+        return gpuBytes >= wantedBytes;
+    }
+
+    size_t getCpuBytes() const
+    {
+        return cpuBytes;
+    }
+
+    size_t getGpuBytes() const
+    {
+        return gpuBytes;
+    }
+};
+
+class ResidencyManager
+{
+public:
+    struct Stats
+    {
+        size_t assets = 0, degraded = 0, evicted = 0;
+        uint64_t cpuBytes = 0, gpuBytes = 0, budget = 0;
+        size_t trims = 0, demotions = 0, evictions = 0, restores = 0, failures = 0; // since start
+    };
+
+private:
+    std::vector<Resident*> residents;
+    uint64_t budget = RESIDENCY_BUDGET;
+    uint64_t frame = 0;
+    size_t trims = 0, demotions = 0, evictions = 0, restores = 0, failures = 0;
+
+    // Bytes the assets take, counting those being restored as complete
+    uint64_t projectedBytes() const
+    {
+        uint64_t total = 0;
+        for (const Resident* resident : residents)
+            total += resident->loading ? std::max(resident->wantedBytes, resident->gpuBytes) : resident->gpuBytes;
+        return total;
+    }
+
+    // Collects finished restores
+    void poll(Resident& resident)
+    {
+        if (!resident.loading || !resident.reload.done())
+            return;
+        resident.loading = false;
+        if (resident.reload.result())
+            restores++;
+        else
+            failures++;
+        resident.reload = Task<bool>();
+    }
+
+public:
+    void setBudget(uint64_t _budget)
+    {
+        budget = _budget;
+    }
+
+    void add(Resident& resident)
+    {
+        resident.manager = this;
+        resident.lastUse = frame;
+        residents.push_back(&resident);
+    }
+
+    // Waits for a restore in flight, which refers to the asset
+    void remove(Resident& resident)
+    {
+        while (resident.loading && !resident.reload.done())
+            if (!renderThread.pump() && !jobSystem.help())
+                std::this_thread::yield();
+        poll(resident);
+        resident.manager = nullptr;
+        residents.erase(std::remove(residents.begin(), residents.end(), &resident), residents.end());
+    }
+
+    // Called for every asset drawn
+    void use(Resident& resident)
+    {
+        resident.lastUse = frame;
+    }
+
+    // Drops unwanted detail and brings the assets back under the budget, then
+    // restores what was drawn degraded while there is room for it
+    void endFrame()
+    {
+        for (Resident* resident : residents)
+        {
+            poll(*resident);
+            resident->update();
+            while (!resident->loading && resident->gpuBytes > resident->wantedBytes && resident->demote())
+                trims++;
+        }
+
+        uint64_t total = projectedBytes();
+        while (total > budget)
+        {
+            Resident* oldest = nullptr;
+            for (Resident* resident : residents)
+                if (resident->isResident() && !resident->loading && frame - resident->lastUse >= RESIDENCY_KEEP_FRAMES &&
+                    (!oldest || resident->lastUse < oldest->lastUse))
+                    oldest = resident;
+            if (!oldest)
+                break; // everything left is in view
+            size_t before = oldest->gpuBytes;
+            if (oldest->demote())
+                demotions++;
+            else
+            {
+                oldest->evict();
+                evictions++;
+            }
+            total -= before - oldest->gpuBytes;
+        }
+
+        size_t inFlight = 0;
+        for (const Resident* resident : residents)
+            inFlight += resident->loading;
+        for (Resident* resident : residents)
+        {
+            if (resident->loading || resident->isComplete() || frame - resident->lastUse >= RESIDENCY_KEEP_FRAMES ||
+                inFlight >= RESIDENCY_MAX_RESTORES)
+                continue;
+            if (total + (resident->wantedBytes - resident->gpuBytes) > budget)
+                continue;
+            resident->loading = true;
+            total += resident->wantedBytes - resident->gpuBytes;
+            inFlight++;
+            resident->reload = resident->restore();
+            resident->reload.start();
+        }
+        frame++;
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.assets = residents.size();
+        stats.budget = budget;
+        stats.trims = trims;
+        stats.demotions = demotions;
+        stats.evictions = evictions;
+        stats.restores = restores;
+        stats.failures = failures;
+        for (const Resident* resident : residents)
+        {
+            stats.cpuBytes += resident->cpuBytes;
+            stats.gpuBytes += resident->gpuBytes;
+            stats.degraded += resident->isResident() && !resident->isComplete();
+            stats.evicted += !resident->isResident();
+        }
+        return stats;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const ResidencyManager::Stats& stats)
+{
+    os << stats.assets << " assets, GPU " << stats.gpuBytes / 1024 << " / " << stats.budget / 1024 << " KiB, CPU " << stats.cpuBytes / 1024
+       << " KiB; " << stats.degraded << " degraded, " << stats.evicted << " evicted";
+    os << "; " << stats.trims << " trims, " << stats.demotions << " demotions, " << stats.evictions << " evictions, " << stats.restores << " restores";
+    if (stats.failures)
+        os << " (" << stats.failures << " failed)";
+    return os;
+}
+
+inline void Resident::release()
+{
+    if (manager)
+        manager->remove(*this);
+}
+
+inline ResidencyManager residency;
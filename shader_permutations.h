@@ -0,0 +1,281 @@
+#pragma once
+
+// Shader permutations. One vertex and one fragment template are specialized
+// by injecting #defines after the #version line, so every variant contains
+// only the code for its geometry and features: no curvature uniform, no dead
+// branches. port() is injected from the geometry policies (geometry.h).
+// VIRTUAL_TEXTURE variants sample through a page table (virtual_texture.h);
+// FEEDBACK variants write the virtual texture page each pixel needs instead
+// of a colour, or nothing for other objects.
+// Variants are built through the program cache, either lazily on first use or
+// up front in parallel when GL_KHR_parallel_shader_compile is available.
+
+#include <glad/gl.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "baked.h"
+#include "geometry.h"
+#include "program_cache.h"
+
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+
+struct ShaderKey
+{
+    ShaderGeometry geometry;
+    bool textured = true;
+    bool instanced = false;
+    bool baked = false; // positions already in curved space (static objects)
+    bool virtualTexture = false; // textured through a page table
+    bool feedback = false; // writes virtual texture pages, not colours
+
+    int index() const
+    {
+        return ((((int(geometry) * 2 + textured) * 2 + instanced) * 2 + baked) * 2 + virtualTexture) * 2 + feedback;
+    }
+
+    // Baking replaces port(model * aPos), so it needs a curved geometry and
+    // cannot be combined with per-instance offsets. Virtual textures and
+    // feedback are drawn one object at a time, unbaked.
+    bool valid() const
+    {
+        if ((virtualTexture || feedback) && (instanced || baked))
+            return false;
+        return (!baked || (geometry != SHADER_EUCLIDEAN && !instanced)) && (!virtualTexture || textured);
+    }
+};
+
+#define SHADER_PERMUTATION_COUNT (SHADER_GEOMETRY_COUNT * 32)
+
+inline const char* permutationVertexSource = R"glsl(
+#ifdef BAKED
+    layout (location = 3) in vec4 aCurvedPos; // port(model * aPos), baked on the CPU
+#else
+    layout (location = 0) in vec3 aPos;
+#endif
+    layout (location = 1) in vec2 aTexCoord;
+#ifdef INSTANCED
+    layout (location = 2) in vec3 aOffset; // per-instance world translation
+#endif
+
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
+#if !defined(GEOMETRY_EUCLIDEAN) && !defined(BAKED)
+    uniform float scale;
+#endif
+#if defined(GEOMETRY_SPHERICAL) || defined(GEOMETRY_ELLIPTIC)
+    uniform float anti; // 1 or -1: which of p and -p to draw
+#endif
+
+    out vec2 TexCoord;
+
+    void main()
+    {
+        TexCoord = aTexCoord;
+#ifdef BAKED
+        vec4 curvedPos = aCurvedPos;
+#else
+        vec4 worldPos = model * vec4(aPos, 1.0);
+#ifdef INSTANCED
+        worldPos.xyz += aOffset;
+#endif
+#ifndef GEOMETRY_EUCLIDEAN
+        vec4 curvedPos = port(worldPos.xyz, scale);
+#endif
+#endif
+
+#if defined(GEOMETRY_EUCLIDEAN)
+        gl_Position = projection * view * worldPos;
+#elif defined(GEOMETRY_HYPERBOLIC)
+        gl_Position = projection * view * curvedPos;
+#else
+        gl_Position = projection * view * (anti * curvedPos);
+#endif
+    }
+)glsl";
+
+inline const char* permutationFragmentSource = R"glsl(
+    out vec4 FragColor;
+    in vec2 TexCoord;
+#if defined(VIRTUAL_TEXTURE)
+    uniform sampler2D pageCache; // slots of PAGE_SIZE texels plus a border of PAGE_BORDER
+    uniform sampler2D pageTable; // per page and level: slot x, y and the level resident there, over 255
+    uniform float virtualPages; // along a side of level 0
+    uniform float virtualLevels;
+    uniform float cacheSlots; // along a side of the cache
+#ifdef FEEDBACK
+    uniform float feedbackBias; // log2 of how much smaller the feedback target is
+#endif
+
+    // Level whose texels are closest to a pixel, from level 0 texel
+    // coordinates, before clamping
+    float virtualLevel(vec2 texel)
+    {
+        vec2 dx = dFdx(texel), dy = dFdy(texel);
+        return 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    }
+#elif defined(TEXTURED)
+    uniform sampler2D texture1;
+#endif
+#if !defined(TEXTURED) && !defined(FEEDBACK)
+    uniform vec4 color;
+#endif
+
+    void main()
+    {
+#if defined(VIRTUAL_TEXTURE)
+        vec2 texel = TexCoord * virtualPages * PAGE_SIZE;
+#ifdef FEEDBACK
+        float level = clamp(floor(virtualLevel(texel) - feedbackBias), 0.0, virtualLevels - 1.0);
+        FragColor = vec4(floor(fract(TexCoord) * virtualPages / exp2(level)), level, 255.0) / 255.0;
+#else
+        float level = clamp(floor(virtualLevel(texel)), 0.0, virtualLevels - 1.0);
+        vec4 entry = texelFetch(pageTable, ivec2(fract(TexCoord) * virtualPages / exp2(level)), int(level)) * 255.0;
+        vec2 inPage = fract(fract(TexCoord) * virtualPages / exp2(entry.b)) * PAGE_SIZE;
+        float slot = PAGE_SIZE + 2.0 * PAGE_BORDER;
+        FragColor = textureLod(pageCache, (entry.rg * slot + PAGE_BORDER + inPage) / (cacheSlots * slot), 0.0);
+#endif
+#elif defined(FEEDBACK)
+        FragColor = vec4(0.0); // hides what is behind it, needs no page
+#elif defined(TEXTURED)
+        FragColor = texture(texture1, TexCoord);
+#else
+        FragColor = color;
+#endif
+    }
+)glsl";
+
+class ShaderPermutations
+{
+    typedef void (GLAD_API_PTR* MaxShaderCompilerThreadsFn)(GLuint);
+
+    GLuint programs[SHADER_PERMUTATION_COUNT] = {};
+    ProgramCache::Pending pending[SHADER_PERMUTATION_COUNT] = {};
+    float scale = 1.0f;
+
+    static ShaderKey keyAt(int index)
+    {
+        ShaderKey key;
+        key.feedback = index & 1;
+        key.virtualTexture = (index >> 1) & 1;
+        key.baked = (index >> 2) & 1;
+        key.instanced = (index >> 3) & 1;
+        key.textured = (index >> 4) & 1;
+        key.geometry = ShaderGeometry(index >> 5);
+        return key;
+    }
+
+    static bool hasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+            if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+                return true;
+        return false;
+    }
+
+    void begin(int index)
+    {
+        std::string vertex = source(keyAt(index), permutationVertexSource, portSource(keyAt(index)));
+        std::string fragment = source(keyAt(index), permutationFragmentSource);
+        pending[index] = programCache.begin(vertex.c_str(), fragment.c_str());
+    }
+
+    void finish(int index)
+    {
+        GLuint program = programCache.finish(pending[index]);
+        pending[index].program = 0;
+        programs[index] = program;
+
+        if (keyAt(index).geometry != SHADER_EUCLIDEAN && !keyAt(index).baked)
+        {
+            glUseProgram(program);
+            glUniform1f(glGetUniformLocation(program, "scale"), scale);
+        }
+    }
+
+    // port() for the variant's geometry, from the same policy the CPU uses
+    static const char* portSource(const ShaderKey& key)
+    {
+        if (key.baked)
+            return "";
+        if (key.geometry == SHADER_HYPERBOLIC)
+            return Hyperbolic::glsl();
+        if (key.geometry == SHADER_SPHERICAL || key.geometry == SHADER_ELLIPTIC)
+            return Spherical::glsl();
+        return Euclidean::glsl();
+    }
+
+public:
+    // functions (e.g. port) go between the #defines and the body
+    static std::string source(const ShaderKey& key, const char* body, const char* functions = "")
+    {
+        static const char* geometries[SHADER_GEOMETRY_COUNT] = {
+            "GEOMETRY_EUCLIDEAN", "GEOMETRY_SPHERICAL", "GEOMETRY_HYPERBOLIC", "GEOMETRY_ELLIPTIC"
+        };
+        std::string text = "#version 330 core\n";
+        text += std::string("#define ") + geometries[key.geometry] + "\n";
+        if (key.textured)
+            text += "#define TEXTURED\n";
+        if (key.instanced)
+            text += "#define INSTANCED\n";
+        if (key.baked)
+            text += "#define BAKED\n";
+        if (key.virtualTexture)
+            text += "#define VIRTUAL_TEXTURE\n#define PAGE_SIZE " + std::to_string(VIRTUAL_PAGE_SIZE) + ".0\n#define PAGE_BORDER " +
+                    std::to_string(VIRTUAL_PAGE_BORDER) + ".0\n";
+        if (key.feedback)
+            text += "#define FEEDBACK\n";
+        return text + functions + "\n" + body;
+    }
+
+    // Starts every variant at once when the driver compiles in parallel; get()
+    // then only waits for the ones actually used. Otherwise nothing is built
+    // until first use.
+    void init(GLADloadfunc load, float _scale)
+    {
+        scale = _scale;
+        if (!hasExtension("GL_KHR_parallel_shader_compile"))
+            return;
+
+        MaxShaderCompilerThreadsFn maxThreads = (MaxShaderCompilerThreadsFn)load("glMaxShaderCompilerThreadsKHR");
+        if (maxThreads)
+            maxThreads(0xFFFFFFFF);
+        int count = 0;
+        for (int i = 0; i < SHADER_PERMUTATION_COUNT; i++)
+        {
+            if (keyAt(i).valid())
+            {
+                begin(i);
+                count++;
+            }
+        }
+        std::cout << "Compiling " << count << " shader variants in parallel\n";
+    }
+
+    GLuint get(const ShaderKey& key)
+    {
+        int index = key.index();
+        if (!key.valid())
+        {
+            std::cerr << "Invalid shader permutation " << index << std::endl;
+            return 0;
+        }
+        if (!programs[index])
+        {
+            if (!pending[index].program)
+                begin(index);
+            finish(index);
+        }
+        return programs[index];
+    }
+};
+
+inline ShaderPermutations shaderPermutations;
@@ -0,0 +1,920 @@
+// asset_baker: turns the OBJ and PNG/JPG files of a directory (Models/) into
+// the .mesh and .tex files the viewer loads (see baked.h). Assets are baked
+// in parallel on the job system. Each product is keyed by its source bytes,
+// the baking parameters and BAKED_VERSION: an output whose header already
+// carries its key is skipped, and one found in the derived data cache
+// (derived_cache.h) is copied out instead of baked again.
+// --virtual bakes an image repeated to a terrain-sized virtual texture (.vtex,
+// see baked.h); it is written page by page straight to the output, too large
+// for the derived data cache.
+// Uso: asset_baker <directorio> <salida> [--force] [--cache dir] [--cache-limit mb] [--virtual imagen lado]
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../tiny_obj_loader.h"
+
+#include "../baked.h"
+#include "../derived_cache.h"
+#include "../jobs.h"
+#include "../pack.h"
+
+#define BAKE_CACHE_SIZE 32 // vertex cache the triangle order is optimized for
+#define BAKE_LOD_GRID 64 // clustering cells along the longest axis for LOD 1
+#define BAKE_LOD_MIN_REDUCTION 0.8 // a LOD keeps at most this share of the previous triangles
+#define BAKE_LOD_MIN_TRIANGLES 32
+#define BAKE_VIRTUAL_BATCH 64 // pages encoded in parallel before they are written
+#define BAKE_TINT_CELLS 8 // noise cells across a virtual texture, coarsest octave
+
+namespace fs = std::filesystem;
+
+struct Bake
+{
+    fs::path source, output;
+    bool mesh;
+    uint32_t virtualSize = 0; // texels along a side of a virtual texture, or 0
+    std::string status, detail;
+    double ms = 0.0;
+    uint64_t sourceSize = 0, outputSize = 0;
+};
+
+static bool readFile(const fs::path& path, std::vector<unsigned char>& bytes)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// The first size bytes, for the header of an output too large to read whole
+static bool readFileHead(const fs::path& path, size_t size, std::vector<unsigned char>& bytes)
+{
+    std::ifstream in(path, std::ios::binary);
+    bytes.resize(size);
+    return in && in.read((char*)bytes.data(), std::streamsize(size));
+}
+
+template <class T>
+static void append(std::vector<unsigned char>& out, const T* data, size_t count)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+// Average cache misses per triangle for a FIFO cache of BAKE_CACHE_SIZE / 2
+// entries, the smallest common hardware size
+static double acmr(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    const size_t size = BAKE_CACHE_SIZE / 2;
+    std::vector<uint32_t> fifo(size, UINT32_MAX);
+    std::vector<size_t> insertedAt(vertexCount, SIZE_MAX);
+    size_t misses = 0, next = 0;
+    for (uint32_t index : indices)
+    {
+        if (insertedAt[index] != SIZE_MAX && next - insertedAt[index] < size)
+            continue;
+        insertedAt[index] = next++;
+        misses++;
+    }
+    return indices.empty() ? 0.0 : double(misses) / double(indices.size() / 3);
+}
+
+// Tom Forsyth's linear-speed vertex cache optimization: greedily emits the
+// triangle whose vertices score best, the score favouring vertices in the
+// simulated LRU cache and vertices with few triangles left
+static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+    auto score = [](int cachePosition, uint32_t valence) {
+        if (valence == 0)
+            return -1.0f;
+        float value = 0.0f;
+        if (cachePosition >= 0)
+            value = cachePosition < 3 ? 0.75f : std::pow(1.0f - float(cachePosition - 3) / float(BAKE_CACHE_SIZE - 3), 1.5f);
+        return value + 2.0f / std::sqrt(float(valence));
+    };
+
+    std::vector<uint32_t> valence(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(indices.size());
+    for (uint32_t index : indices)
+        valence[index]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + valence[v];
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = uint32_t(t);
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScore[v] = score(-1, valence[v]);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            triangleScore[t] += vertexScore[indices[t * 3 + k]];
+
+    std::vector<uint32_t> cache, nextCache, output;
+    output.reserve(indices.size());
+    size_t cursor = 0;
+    uint32_t best = 0;
+    for (size_t t = 1; t < triangleCount; t++)
+        if (triangleScore[t] > triangleScore[best])
+            best = uint32_t(t);
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        if (best == UINT32_MAX)
+        {
+            // Nothing in the cache has triangles left: the next unemitted one
+            while (emitted[cursor])
+                cursor++;
+            best = uint32_t(cursor);
+        }
+        emitted[best] = true;
+        nextCache.clear();
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[best * 3 + k];
+            output.push_back(v);
+            nextCache.push_back(v);
+            // Remove the triangle from the vertex's live list
+            uint32_t* begin = &adjacency[offsets[v]];
+            uint32_t* end = begin + valence[v];
+            *std::find(begin, end, best) = *(end - 1);
+            valence[v]--;
+        }
+        for (uint32_t v : cache)
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+                nextCache.push_back(v);
+        for (size_t i = BAKE_CACHE_SIZE; i < nextCache.size(); i++)
+            cachePosition[nextCache[i]] = -1;
+        if (nextCache.size() > BAKE_CACHE_SIZE)
+        {
+            for (size_t i = BAKE_CACHE_SIZE; i < nextCache.size(); i++)
+            {
+                uint32_t v = nextCache[i];
+                float updated = score(-1, valence[v]);
+                for (uint32_t a = offsets[v]; a < offsets[v] + valence[v]; a++)
+                    triangleScore[adjacency[a]] += updated - vertexScore[v];
+                vertexScore[v] = updated;
+            }
+            nextCache.resize(BAKE_CACHE_SIZE);
+        }
+        cache.swap(nextCache);
+
+        best = UINT32_MAX;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            uint32_t v = cache[i];
+            cachePosition[v] = int(i);
+            float updated = score(int(i), valence[v]);
+            for (uint32_t a = offsets[v]; a < offsets[v] + valence[v]; a++)
+            {
+                uint32_t t = adjacency[a];
+                triangleScore[t] += updated - vertexScore[v];
+            }
+            vertexScore[v] = updated;
+        }
+        for (uint32_t v : cache)
+            for (uint32_t a = offsets[v]; a < offsets[v] + valence[v]; a++)
+                if (triangleScore[adjacency[a]] > bestScore)
+                {
+                    bestScore = triangleScore[adjacency[a]];
+                    best = adjacency[a];
+                }
+    }
+    indices.swap(output);
+}
+
+// LOD by vertex clustering: vertices falling in the same cell of a grid over
+// the bounding box (and of a grid over the texture coordinates, so seams stay
+// apart) collapse onto the first of them; degenerate and repeated triangles
+// are dropped
+static std::vector<uint32_t> clusterLod(const std::vector<uint32_t>& indices, const std::vector<BakedVertex>& vertices, int grid)
+{
+    auto cell = [grid](uint16_t value) { return uint64_t(value) * uint64_t(grid) / 65536u; };
+    std::unordered_map<uint64_t, uint32_t> clusters;
+    std::vector<uint32_t> representative(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        const BakedVertex& vertex = vertices[v];
+        uint64_t key = 0;
+        for (int a = 0; a < 3; a++)
+            key = key * uint64_t(grid) + cell(vertex.position[a]);
+        for (int a = 0; a < 2; a++)
+            key = key * uint64_t(grid) + cell(vertex.uv[a]);
+        representative[v] = clusters.emplace(key, uint32_t(v)).first->second;
+    }
+
+    std::vector<uint32_t> lod;
+    std::unordered_set<uint64_t> seen;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        uint32_t a = representative[indices[t]], b = representative[indices[t + 1]], c = representative[indices[t + 2]];
+        if (a == b || b == c || a == c)
+            continue;
+        // Same triangle, same winding, whatever vertex it starts at
+        uint32_t first = std::min(a, std::min(b, c));
+        uint32_t second = first == a ? b : first == b ? c : a;
+        uint32_t third = first == a ? c : first == b ? a : b;
+        uint64_t key = uint64_t(first) * 0x9E3779B97F4A7C15ull ^ uint64_t(second) << 21 ^ uint64_t(third) << 42 ^ third;
+        if (!seen.insert(key).second)
+            continue;
+        lod.push_back(a);
+        lod.push_back(b);
+        lod.push_back(c);
+    }
+    return lod;
+}
+
+static Expected<std::vector<unsigned char>> bakeMesh(const fs::path& source, uint64_t hash, std::string& detail)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+    std::string directory = source.parent_path().string() + "/";
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, source.string().c_str(), directory.c_str()))
+        return AssetError{ "Error al cargar/parsear el archivo .obj: " + warn + err };
+
+    // One corner per face vertex, as the viewer used to draw them
+    std::vector<float> corners;
+    for (const tinyobj::shape_t& shape : shapes)
+        for (const tinyobj::index_t& index : shape.mesh.indices)
+        {
+            for (int a = 0; a < 3; a++)
+                corners.push_back(attrib.vertices[3 * size_t(index.vertex_index) + a]);
+            for (int a = 0; a < 2; a++)
+                corners.push_back(index.texcoord_index >= 0 ? attrib.texcoords[2 * size_t(index.texcoord_index) + a] : 0.0f);
+        }
+    size_t cornerCount = corners.size() / 5;
+    if (cornerCount == 0)
+        return AssetError{ "Malla vacia: " + source.string() };
+
+    BakedMeshHeader header = {};
+    header.magic = BAKED_MESH_MAGIC;
+    header.version = BAKED_VERSION;
+    header.sourceHash = hash;
+    for (int a = 0; a < 3; a++)
+    {
+        header.low[a] = FLT_MAX;
+        header.high[a] = -FLT_MAX;
+    }
+    for (int a = 0; a < 2; a++)
+    {
+        header.uvLow[a] = FLT_MAX;
+        header.uvHigh[a] = -FLT_MAX;
+    }
+    for (size_t c = 0; c < cornerCount; c++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            header.low[a] = std::min(header.low[a], corners[c * 5 + a]);
+            header.high[a] = std::max(header.high[a], corners[c * 5 + a]);
+        }
+        for (int a = 0; a < 2; a++)
+        {
+            header.uvLow[a] = std::min(header.uvLow[a], corners[c * 5 + 3 + a]);
+            header.uvHigh[a] = std::max(header.uvHigh[a], corners[c * 5 + 3 + a]);
+        }
+    }
+
+    // Quantize, then weld corners that quantize to the same vertex
+    auto quantize = [](float value, float low, float high) {
+        return high > low ? uint16_t(std::lround((value - low) / (high - low) * 65535.0f)) : uint16_t(0);
+    };
+    std::vector<BakedVertex> vertices;
+    std::vector<uint32_t> indices(cornerCount);
+    std::unordered_map<uint64_t, std::vector<uint32_t>> welded;
+    for (size_t c = 0; c < cornerCount; c++)
+    {
+        BakedVertex vertex = {};
+        for (int a = 0; a < 3; a++)
+            vertex.position[a] = quantize(corners[c * 5 + a], header.low[a], header.high[a]);
+        for (int a = 0; a < 2; a++)
+            vertex.uv[a] = quantize(corners[c * 5 + 3 + a], header.uvLow[a], header.uvHigh[a]);
+        uint64_t key = fnv1a64(&vertex, sizeof(vertex));
+        std::vector<uint32_t>& bucket = welded[key];
+        auto same = std::find_if(bucket.begin(), bucket.end(), [&](uint32_t v) { return std::memcmp(&vertices[v], &vertex, sizeof(vertex)) == 0; });
+        if (same != bucket.end())
+            indices[c] = *same;
+        else
+        {
+            indices[c] = uint32_t(vertices.size());
+            bucket.push_back(indices[c]);
+            vertices.push_back(vertex);
+        }
+    }
+
+    // Quantization can collapse thin triangles
+    std::vector<uint32_t> lod0;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        if (indices[t] != indices[t + 1] && indices[t + 1] != indices[t + 2] && indices[t] != indices[t + 2])
+            lod0.insert(lod0.end(), { indices[t], indices[t + 1], indices[t + 2] });
+    double acmrBefore = acmr(lod0, vertices.size());
+    optimizeVertexCache(lod0, vertices.size());
+    double acmrAfter = acmr(lod0, vertices.size());
+
+    std::vector<std::vector<uint32_t>> lods = { lod0 };
+    std::vector<float> errors = { 0.0f };
+    float extent = std::max(header.high[0] - header.low[0], std::max(header.high[1] - header.low[1], header.high[2] - header.low[2]));
+    for (int grid = BAKE_LOD_GRID; grid >= 2 && lods.size() < BAKED_MAX_LODS && lods.back().size() / 3 > BAKE_LOD_MIN_TRIANGLES; grid /= 2)
+    {
+        std::vector<uint32_t> lod = clusterLod(lod0, vertices, grid);
+        if (lod.empty() || double(lod.size()) > BAKE_LOD_MIN_REDUCTION * double(lods.back().size()))
+            continue;
+        optimizeVertexCache(lod, vertices.size());
+        lods.push_back(std::move(lod));
+        errors.push_back(extent / float(grid) * std::sqrt(3.0f));
+    }
+
+    // Vertices in order of first use across the LODs, finest first
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<BakedVertex> ordered;
+    for (std::vector<uint32_t>& lod : lods)
+        for (uint32_t& index : lod)
+        {
+            if (remap[index] == UINT32_MAX)
+            {
+                remap[index] = uint32_t(ordered.size());
+                ordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+    size_t sourceCorners = cornerCount;
+    vertices.swap(ordered);
+
+    // Bounds as Model used to compute them, from what the viewer will see
+    float low[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, high[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (const BakedVertex& vertex : vertices)
+        for (int a = 0; a < 3; a++)
+        {
+            float value = dequantize(vertex.position[a], header.low[a], header.high[a]);
+            low[a] = std::min(low[a], value);
+            high[a] = std::max(high[a], value);
+        }
+    float radius = 0.0f;
+    for (int a = 0; a < 3; a++)
+        header.sphere[a] = (low[a] + high[a]) * 0.5f;
+    for (const BakedVertex& vertex : vertices)
+    {
+        float distance2 = 0.0f;
+        for (int a = 0; a < 3; a++)
+        {
+            float d = dequantize(vertex.position[a], header.low[a], header.high[a]) - header.sphere[a];
+            distance2 += d * d;
+        }
+        radius = std::max(radius, std::sqrt(distance2));
+    }
+    header.sphere[3] = radius;
+
+    header.vertexCount = uint32_t(vertices.size());
+    header.lodCount = uint32_t(lods.size());
+    header.indexSize = vertices.size() <= 65536 ? 2 : 4;
+    std::vector<BakedLod> table;
+    std::vector<uint32_t> allIndices;
+    for (size_t l = 0; l < lods.size(); l++)
+    {
+        table.push_back({ uint32_t(allIndices.size()), uint32_t(lods[l].size()), errors[l], 0 });
+        allIndices.insert(allIndices.end(), lods[l].begin(), lods[l].end());
+    }
+    header.indexCount = uint32_t(allIndices.size());
+
+    std::vector<unsigned char> out;
+    append(out, &header, 1);
+    append(out, table.data(), table.size());
+    append(out, vertices.data(), vertices.size());
+    if (header.indexSize == 2)
+    {
+        std::vector<uint16_t> narrow(allIndices.begin(), allIndices.end());
+        append(out, narrow.data(), narrow.size());
+    }
+    else
+        append(out, allIndices.data(), allIndices.size());
+
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2) << sourceCorners << " corners -> " << vertices.size() << " vertices, ACMR " << acmrBefore
+         << " -> " << acmrAfter << ", LOD triangles";
+    for (const std::vector<uint32_t>& lod : lods)
+        text << " " << lod.size() / 3;
+    detail = text.str();
+    return out;
+}
+
+// Principal-axis endpoints inset by 1/16 of their range, quantized to 5:6:5,
+// and the nearest of the four palette colors per texel
+static void encodeColorBlock(const unsigned char texels[16][4], unsigned char* block)
+{
+    float mean[3] = {};
+    for (int p = 0; p < 16; p++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += texels[p][c] / 16.0f;
+    float covariance[6] = {};
+    for (int p = 0; p < 16; p++)
+    {
+        float d[3] = { texels[p][0] - mean[0], texels[p][1] - mean[1], texels[p][2] - mean[2] };
+        covariance[0] += d[0] * d[0];
+        covariance[1] += d[0] * d[1];
+        covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1];
+        covariance[4] += d[1] * d[2];
+        covariance[5] += d[2] * d[2];
+    }
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = { covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                          covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                          covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2] };
+        float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+    float lowest = FLT_MAX, highest = -FLT_MAX;
+    for (int p = 0; p < 16; p++)
+    {
+        float t = (texels[p][0] - mean[0]) * axis[0] + (texels[p][1] - mean[1]) * axis[1] + (texels[p][2] - mean[2]) * axis[2];
+        lowest = std::min(lowest, t);
+        highest = std::max(highest, t);
+    }
+    float length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float inset = (highest - lowest) / 16.0f;
+    auto endpoint = [&](float t) {
+        int channel[3];
+        for (int c = 0; c < 3; c++)
+            channel[c] = std::clamp(int(std::lround(mean[c] + axis[c] * t / length2)), 0, 255);
+        return uint16_t((channel[0] * 31 + 127) / 255 << 11 | (channel[1] * 63 + 127) / 255 << 5 | (channel[2] * 31 + 127) / 255);
+    };
+    uint16_t c0 = endpoint(highest - inset), c1 = endpoint(lowest + inset);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t bits = 0;
+    if (c0 != c1)
+    {
+        unsigned char palette[4][3];
+        expand565(c0, palette[0]);
+        expand565(c1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (unsigned char)((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = (unsigned char)((palette[0][c] + 2 * palette[1][c]) / 3);
+        }
+        for (int p = 0; p < 16; p++)
+        {
+            int best = 0, bestError = INT32_MAX;
+            for (int k = 0; k < 4; k++)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; c++)
+                    error += (texels[p][c] - palette[k][c]) * (texels[p][c] - palette[k][c]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = k;
+                }
+            }
+            bits |= uint32_t(best) << (2 * p);
+        }
+    }
+    std::memcpy(block, &c0, 2);
+    std::memcpy(block + 2, &c1, 2);
+    std::memcpy(block + 4, &bits, 4);
+}
+
+static void encodeAlphaBlock(const unsigned char texels[16][4], unsigned char* block)
+{
+    unsigned a0 = 0, a1 = 255;
+    for (int p = 0; p < 16; p++)
+    {
+        a0 = std::max<unsigned>(a0, texels[p][3]);
+        a1 = std::min<unsigned>(a1, texels[p][3]);
+    }
+    uint64_t bits = 0;
+    if (a0 != a1)
+    {
+        unsigned palette[8] = { a0, a1 };
+        for (int k = 1; k < 7; k++)
+            palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+        for (int p = 0; p < 16; p++)
+        {
+            int best = 0;
+            for (int k = 1; k < 8; k++)
+                if (std::abs(int(palette[k]) - texels[p][3]) < std::abs(int(palette[best]) - texels[p][3]))
+                    best = k;
+            bits |= uint64_t(best) << (3 * p);
+        }
+    }
+    block[0] = (unsigned char)a0;
+    block[1] = (unsigned char)a1;
+    std::memcpy(block + 2, &bits, 6);
+}
+
+static std::vector<unsigned char> encodeLevel(const std::vector<unsigned char>& rgba, uint32_t width, uint32_t height, uint32_t format)
+{
+    size_t blockBytes = format == BAKED_BC1 ? 8 : 16;
+    uint32_t blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    std::vector<unsigned char> blocks(size_t(blocksWide) * blocksHigh * blockBytes);
+    jobSystem.parallelFor(blocksHigh, 4, [&](size_t begin, size_t end) {
+        for (size_t by = begin; by < end; by++)
+            for (uint32_t bx = 0; bx < blocksWide; bx++)
+            {
+                unsigned char texels[16][4];
+                for (int p = 0; p < 16; p++)
+                {
+                    // Edge blocks repeat the last row and column
+                    uint32_t x = std::min(width - 1, bx * 4 + uint32_t(p % 4)), y = std::min(height - 1, uint32_t(by) * 4 + uint32_t(p / 4));
+                    std::memcpy(texels[p], &rgba[(size_t(y) * width + x) * 4], 4);
+                }
+                unsigned char* block = &blocks[(by * blocksWide + bx) * blockBytes];
+                if (format == BAKED_BC3)
+                {
+                    encodeAlphaBlock(texels, block);
+                    block += 8;
+                }
+                encodeColorBlock(texels, block);
+            }
+    });
+    return blocks;
+}
+
+// Next level of a box-filtered mip chain, like glGenerateMipmap
+static std::vector<unsigned char> halve(const std::vector<unsigned char>& rgba, uint32_t w, uint32_t h)
+{
+    uint32_t nextW = std::max(1u, w / 2), nextH = std::max(1u, h / 2);
+    std::vector<unsigned char> next(size_t(nextW) * nextH * 4);
+    for (uint32_t y = 0; y < nextH; y++)
+        for (uint32_t x = 0; x < nextW; x++)
+            for (int c = 0; c < 4; c++)
+            {
+                uint32_t x0 = std::min(w - 1, x * 2), x1 = std::min(w - 1, x * 2 + 1);
+                uint32_t y0 = std::min(h - 1, y * 2), y1 = std::min(h - 1, y * 2 + 1);
+                unsigned sum = rgba[(size_t(y0) * w + x0) * 4 + c] + rgba[(size_t(y0) * w + x1) * 4 + c] +
+                               rgba[(size_t(y1) * w + x0) * 4 + c] + rgba[(size_t(y1) * w + x1) * 4 + c];
+                next[(size_t(y) * nextW + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+            }
+    return next;
+}
+
+static Expected<std::vector<unsigned char>> bakeTexture(const fs::path& source, const std::vector<unsigned char>& bytes, uint64_t hash,
+                                                         std::string& detail)
+{
+    int width, height, channels;
+    unsigned char* data = stbi_load_from_memory(bytes.data(), int(bytes.size()), &width, &height, &channels, 4);
+    if (!data)
+        return AssetError{ "Error al cargar la textura: " + source.string() + ": " + stbi_failure_reason() };
+    std::vector<unsigned char> rgba(data, data + size_t(width) * height * 4);
+    stbi_image_free(data);
+
+    bool opaque = true;
+    for (size_t i = 3; i < rgba.size() && opaque; i += 4)
+        opaque = rgba[i] == 255;
+    BakedTextureHeader header = { BAKED_TEXTURE_MAGIC, BAKED_VERSION, hash, uint32_t(width), uint32_t(height), 0,
+                                  opaque ? uint32_t(BAKED_BC1) : uint32_t(BAKED_BC3) };
+
+    // Box-filtered mip chain down to 1x1, like glGenerateMipmap
+    std::vector<TextureLevel> levels;
+    uint32_t w = header.width, h = header.height;
+    for (;;)
+    {
+        levels.push_back({ w, h, encodeLevel(rgba, w, h, header.format) });
+        if (w == 1 && h == 1)
+            break;
+        rgba = halve(rgba, w, h);
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+    header.levels = uint32_t(levels.size());
+
+    std::vector<unsigned char> out;
+    append(out, &header, 1);
+    uint64_t offset = sizeof(header) + levels.size() * sizeof(BakedLevel);
+    for (const TextureLevel& level : levels)
+    {
+        BakedLevel entry = { level.width, level.height, offset, level.data.size() };
+        append(out, &entry, 1);
+        offset += level.data.size();
+    }
+    for (const TextureLevel& level : levels)
+        out.insert(out.end(), level.data.begin(), level.data.end());
+
+    std::ostringstream text;
+    text << width << "x" << height << ", " << levels.size() << " levels, " << (opaque ? "BC1" : "BC3");
+    detail = text.str();
+    return out;
+}
+
+// Smooth noise in [0, 1) on a lattice of cells x cells that wraps around, so
+// what it tints stays seamless; u, v in [0, 1)
+static float valueNoise(float u, float v, uint32_t cells, uint32_t seed)
+{
+    auto lattice = [&](uint32_t x, uint32_t y) {
+        uint32_t h = (x % cells) * 73856093u ^ (y % cells) * 19349663u ^ seed * 83492791u;
+        h ^= h >> 13;
+        h *= 0x5BD1E995u;
+        h ^= h >> 15;
+        return float(h & 0xFFFF) / 65536.0f;
+    };
+    float x = u * float(cells), y = v * float(cells);
+    uint32_t x0 = uint32_t(x), y0 = uint32_t(y);
+    float fx = x - float(x0), fy = y - float(y0);
+    fx = fx * fx * (3.0f - 2.0f * fx);
+    fy = fy * fy * (3.0f - 2.0f * fy);
+    float bottom = lattice(x0, y0) + (lattice(x0 + 1, y0) - lattice(x0, y0)) * fx;
+    float top = lattice(x0, y0 + 1) + (lattice(x0 + 1, y0 + 1) - lattice(x0, y0 + 1)) * fx;
+    return bottom + (top - bottom) * fy;
+}
+
+// Terrain-sized virtual texture from a tile of it: the source repeated to
+// size x size texels and tinted by low-frequency noise so the repeats do not
+// show, cut into bordered pages (baked.h) and written BAKE_VIRTUAL_BATCH
+// pages at a time, never whole. The source must be a power-of-two square.
+static Expected<uint64_t> bakeVirtualTexture(const fs::path& source, const std::vector<unsigned char>& bytes, uint64_t hash, uint32_t size,
+                                             const fs::path& output, std::string& detail)
+{
+    int width, height, channels;
+    unsigned char* data = stbi_load_from_memory(bytes.data(), int(bytes.size()), &width, &height, &channels, 4);
+    if (!data)
+        return AssetError{ "Error al cargar la textura: " + source.string() + ": " + stbi_failure_reason() };
+    std::vector<unsigned char> rgba(data, data + size_t(width) * height * 4);
+    stbi_image_free(data);
+    if (width != height || (width & (width - 1)) != 0 || (size & (size - 1)) != 0 || size < VIRTUAL_PAGE_SIZE ||
+        size / VIRTUAL_PAGE_SIZE > VIRTUAL_MAX_PAGES)
+        return AssetError{ "La textura virtual necesita un origen cuadrado de lado potencia de dos y un lado potencia de dos de " +
+                           std::to_string(VIRTUAL_PAGE_SIZE) + " a " + std::to_string(VIRTUAL_PAGE_SIZE * VIRTUAL_MAX_PAGES) + ": " +
+                           source.string() };
+
+    bool opaque = true;
+    for (size_t i = 3; i < rgba.size() && opaque; i += 4)
+        opaque = rgba[i] == 255;
+    VirtualTextureHeader header = { VIRTUAL_TEXTURE_MAGIC, BAKED_VERSION, hash, size, 1, opaque ? uint32_t(BAKED_BC1) : uint32_t(BAKED_BC3),
+                                    VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_BORDER, 0 };
+    while (virtualPages(header, header.levels - 1) > 1)
+        header.levels++;
+    for (uint32_t l = 0; l < header.levels; l++)
+        header.tileCount += virtualPages(header, l) * virtualPages(header, l);
+
+    // Level l of the virtual texture repeats level l of the source
+    std::vector<std::vector<unsigned char>> mips = { rgba };
+    for (uint32_t w = uint32_t(width); w > 1; w /= 2)
+        mips.push_back(halve(mips.back(), w, w));
+
+    std::ofstream out(output, std::ios::binary);
+    std::vector<VirtualTile> tiles(header.tileCount);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)tiles.data(), std::streamsize(tiles.size() * sizeof(VirtualTile)));
+    uint64_t offset = sizeof(header) + tiles.size() * sizeof(VirtualTile);
+    const uint32_t span = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+    size_t tile = 0, compressed = 0;
+    for (uint32_t level = 0; level < header.levels; level++)
+    {
+        const std::vector<unsigned char>& mip = mips[std::min<size_t>(level, mips.size() - 1)];
+        uint32_t mipSize = std::max(1u, uint32_t(width) >> level), levelSize = size >> level, pages = virtualPages(header, level);
+        float texelSize = 1.0f / float(levelSize);
+        for (uint32_t first = 0; first < pages * pages; first += BAKE_VIRTUAL_BATCH)
+        {
+            uint32_t count = std::min<uint32_t>(BAKE_VIRTUAL_BATCH, pages * pages - first);
+            std::vector<std::vector<unsigned char>> stored(count);
+            std::vector<char> packed(count);
+            jobSystem.parallelFor(count, 1, [&](size_t begin, size_t end) {
+                std::vector<unsigned char> texels(size_t(span) * span * 4);
+                for (size_t k = begin; k < end; k++)
+                {
+                    uint32_t px = (first + uint32_t(k)) % pages, py = (first + uint32_t(k)) / pages;
+                    for (uint32_t y = 0; y < span; y++)
+                        for (uint32_t x = 0; x < span; x++)
+                        {
+                            // Wrapping: the border of an edge page comes from the opposite edge
+                            uint32_t vx = (px * VIRTUAL_PAGE_SIZE + x + levelSize - VIRTUAL_PAGE_BORDER) % levelSize;
+                            uint32_t vy = (py * VIRTUAL_PAGE_SIZE + y + levelSize - VIRTUAL_PAGE_BORDER) % levelSize;
+                            const unsigned char* texel = &mip[(size_t(vy % mipSize) * mipSize + vx % mipSize) * 4];
+                            float u = (float(vx) + 0.5f) * texelSize, v = (float(vy) + 0.5f) * texelSize;
+                            float shade = 0.7f + 0.6f * (0.6f * valueNoise(u, v, BAKE_TINT_CELLS, 1) + 0.4f * valueNoise(u, v, BAKE_TINT_CELLS * 4, 2));
+                            float dry = valueNoise(u, v, BAKE_TINT_CELLS * 2, 3) - 0.5f;
+                            float tint[3] = { shade * (1.0f + 0.4f * dry), shade, shade * (1.0f - 0.4f * dry) };
+                            unsigned char* to = &texels[(size_t(y) * span + x) * 4];
+                            for (int c = 0; c < 3; c++)
+                                to[c] = (unsigned char)std::clamp(int(std::lround(float(texel[c]) * tint[c])), 0, 255);
+                            to[3] = texel[3];
+                        }
+                    std::vector<unsigned char> blocks = encodeLevel(texels, span, span, header.format);
+                    lz4::compress(blocks.data(), blocks.size(), stored[k]);
+                    packed[k] = stored[k].size() * 100 <= blocks.size() * (100 - PACK_MIN_SAVING);
+                    if (!packed[k])
+                        stored[k] = std::move(blocks);
+                }
+            });
+            for (uint32_t k = 0; k < count; k++)
+            {
+                tiles[tile++] = { offset, uint32_t(stored[k].size()), uint32_t(packed[k]) };
+                out.write((const char*)stored[k].data(), std::streamsize(stored[k].size()));
+                offset += stored[k].size();
+                compressed += size_t(packed[k]);
+            }
+        }
+    }
+    out.seekp(sizeof(header));
+    out.write((const char*)tiles.data(), std::streamsize(tiles.size() * sizeof(VirtualTile)));
+    if (!out)
+        return AssetError{ "Error al escribir el archivo: " + output.string() };
+
+    std::ostringstream text;
+    text << size << "x" << size << " from " << width << "x" << height << ", " << header.levels << " levels, " << header.tileCount << " pages ("
+         << compressed << " LZ4), " << (opaque ? "BC1" : "BC3");
+    detail = text.str();
+    return offset;
+}
+
+// Everything besides the source that changes what a bake produces
+static std::string bakeParameters(const Bake& bake)
+{
+    std::ostringstream text;
+    if (bake.virtualSize)
+        text << "virtual " << bake.virtualSize << " page " << VIRTUAL_PAGE_SIZE << " border " << VIRTUAL_PAGE_BORDER << " tint " << BAKE_TINT_CELLS
+             << " box mips, bc1 opaque else bc3, lz4";
+    else if (bake.mesh)
+        text << "cache " << BAKE_CACHE_SIZE << " grid " << BAKE_LOD_GRID << " reduction " << BAKE_LOD_MIN_REDUCTION << " min "
+             << BAKE_LOD_MIN_TRIANGLES << " lods " << BAKED_MAX_LODS;
+    else
+        text << "box mips, bc1 opaque else bc3";
+    return text.str();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Uso: asset_baker <directorio> <salida> [--force] [--cache dir] [--cache-limit mb] [--virtual imagen lado]" << std::endl;
+        return 1;
+    }
+    fs::path directory = argv[1], outputDirectory = argv[2];
+    bool force = false;
+    std::string cachePath = "derived_cache";
+    uint64_t cacheLimit = DERIVED_CACHE_LIMIT;
+    std::vector<Bake> virtualBakes;
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--force")
+            force = true;
+        else if (arg == "--cache" && i + 1 < argc)
+            cachePath = argv[++i];
+        else if (arg == "--cache-limit" && i + 1 < argc)
+            cacheLimit = uint64_t(std::atof(argv[++i]) * 1024.0 * 1024.0);
+        else if (arg == "--virtual" && i + 2 < argc)
+        {
+            Bake bake;
+            bake.source = argv[++i];
+            bake.output = outputDirectory / bake.source.stem();
+            bake.output += ".vtex";
+            bake.mesh = false;
+            bake.virtualSize = uint32_t(std::atoi(argv[++i]));
+            virtualBakes.push_back(bake);
+        }
+        else
+            std::cerr << "Opcion desconocida: " << arg << std::endl;
+    }
+    auto start = std::chrono::steady_clock::now();
+    DerivedCache cache;
+    cache.open(cachePath, cacheLimit);
+
+    // Same orientation as the viewer's former stbi loads: rows bottom-up
+    stbi_set_flip_vertically_on_load(true);
+
+    std::error_code error;
+    fs::create_directories(outputDirectory, error);
+    std::vector<Bake> bakes;
+    for (const auto& item : fs::directory_iterator(directory, error))
+    {
+        std::string extension = item.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+        bool mesh = extension == ".obj";
+        if (!item.is_regular_file() || !(mesh || extension == ".png" || extension == ".jpg" || extension == ".jpeg"))
+            continue;
+        Bake bake;
+        bake.source = item.path();
+        bake.output = outputDirectory / item.path().stem();
+        bake.output += mesh ? ".mesh" : ".tex";
+        bake.mesh = mesh;
+        bakes.push_back(bake);
+    }
+    if (error)
+    {
+        std::cerr << "Error al recorrer el directorio: " << directory.string() << std::endl;
+        return 1;
+    }
+    std::sort(bakes.begin(), bakes.end(), [](const Bake& a, const Bake& b) { return a.source < b.source; });
+    bakes.insert(bakes.end(), virtualBakes.begin(), virtualBakes.end());
+
+    std::atomic<int> failures{ 0 };
+    jobSystem.parallelFor(bakes.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++)
+        {
+            Bake& bake = bakes[b];
+            auto bakeStart = std::chrono::steady_clock::now();
+            std::vector<unsigned char> bytes, existing;
+            if (!readFile(bake.source, bytes))
+            {
+                bake.status = "Error al leer el archivo: " + bake.source.string();
+                failures++;
+                continue;
+            }
+            bake.sourceSize = bytes.size();
+            DerivedKey key = DerivedKey(bake.virtualSize ? "vtex" : bake.mesh ? "mesh" : "tex", BAKED_VERSION).add(bytes).add(bakeParameters(bake));
+            uint64_t stored;
+            auto finish = [&](const char* status, size_t size) {
+                bake.status = status;
+                bake.outputSize = size;
+                bake.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bakeStart).count();
+            };
+            if (bake.virtualSize)
+            {
+                if (!force && readFileHead(bake.output, sizeof(VirtualTextureHeader), existing) &&
+                    readBakedHash(existing, VIRTUAL_TEXTURE_MAGIC, stored) && stored == key.value())
+                {
+                    std::error_code sizeError;
+                    finish("up to date", size_t(fs::file_size(bake.output, sizeError)));
+                    continue;
+                }
+                Expected<uint64_t> written = bakeVirtualTexture(bake.source, bytes, key.value(), bake.virtualSize, bake.output, bake.detail);
+                if (!written)
+                {
+                    bake.status = written.error();
+                    failures++;
+                    continue;
+                }
+                finish("baked", size_t(*written));
+                continue;
+            }
+            if (!force && readFile(bake.output, existing) && readBakedHash(existing, bake.mesh ? BAKED_MESH_MAGIC : BAKED_TEXTURE_MAGIC, stored) &&
+                stored == key.value())
+            {
+                finish("up to date", existing.size());
+                continue;
+            }
+
+            std::vector<unsigned char> output;
+            const char* status = "cached";
+            if (force || !cache.get(key, output))
+            {
+                Expected<std::vector<unsigned char>> baked = bake.mesh ? bakeMesh(bake.source, key.value(), bake.detail)
+                                                                       : bakeTexture(bake.source, bytes, key.value(), bake.detail);
+                if (!baked)
+                {
+                    bake.status = baked.error();
+                    failures++;
+                    continue;
+                }
+                output = std::move(*baked);
+                cache.put(key, output);
+                status = "baked";
+            }
+            std::ofstream out(bake.output, std::ios::binary);
+            out.write((const char*)output.data(), std::streamsize(output.size()));
+            if (!out)
+            {
+                bake.status = "Error al escribir el archivo: " + bake.output.string();
+                failures++;
+                continue;
+            }
+            finish(status, output.size());
+        }
+    });
+
+    uint64_t sourceTotal = 0, outputTotal = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Bake& bake : bakes)
+    {
+        sourceTotal += bake.sourceSize;
+        outputTotal += bake.outputSize;
+        std::cout << std::left << std::setw(48) << bake.output.filename().string() << std::right << std::setw(11) << bake.status
+                  << std::setw(9) << bake.ms << " ms " << std::setw(10) << bake.sourceSize << " -> " << std::setw(10) << bake.outputSize
+                  << "  " << bake.detail << "\n";
+    }
+    std::cout << bakes.size() << " assets, " << sourceTotal << " -> " << outputTotal << " bytes in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms on "
+              << jobSystem.size() << " threads\n";
+    std::cout << "Derived cache: " << cache.getStats() << "\n";
+    return failures ? 1 : 0;
+}
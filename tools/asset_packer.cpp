@@ -0,0 +1,78 @@
+// asset_packer: packs every file under a directory (Models/) into the single
+// archive the viewer maps at startup (see pack.h).
+// Uso: asset_packer <directorio> <salida.pack> [--store]
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+#include "../pack.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Uso: asset_packer <directorio> <salida.pack> [--store]" << std::endl;
+        return 1;
+    }
+    std::filesystem::path directory = argv[1], output = argv[2];
+    bool compress = !(argc > 3 && std::string(argv[3]) == "--store");
+    auto start = std::chrono::steady_clock::now();
+
+    std::error_code error;
+    std::vector<std::filesystem::path> paths;
+    for (const auto& item : std::filesystem::recursive_directory_iterator(directory, error))
+        if (item.is_regular_file() && !std::filesystem::equivalent(item.path(), output, error))
+            paths.push_back(item.path());
+    if (error)
+    {
+        std::cerr << "Error al recorrer el directorio: " << directory.string() << std::endl;
+        return 1;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    PackWriter writer;
+    for (const std::filesystem::path& path : paths)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!in && !in.eof())
+        {
+            std::cerr << "Error al leer el archivo: " << path.string() << std::endl;
+            return 1;
+        }
+        // Names as the viewer asks for them: relative, with forward slashes
+        writer.add(std::filesystem::relative(path, directory).generic_string(), std::move(data));
+    }
+
+    std::vector<PackWriter::Report> reports;
+    std::vector<unsigned char> pack = writer.build(compress, reports);
+    std::ofstream out(output, std::ios::binary);
+    out.write((const char*)pack.data(), std::streamsize(pack.size()));
+    if (!out)
+    {
+        std::cerr << "Error al escribir el paquete: " << output.string() << std::endl;
+        return 1;
+    }
+
+    uint64_t total = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const PackWriter::Report& report : reports)
+    {
+        total += report.size;
+        std::cout << std::setw(52) << std::left << report.name << std::right << std::setw(10) << report.size << " -> "
+                  << std::setw(10) << report.storedSize << "  " << std::setw(5) << 100.0 * double(report.storedSize) / double(std::max<uint64_t>(report.size, 1))
+                  << "%\n";
+    }
+    std::cout << reports.size() << " files, " << total << " -> " << pack.size() << " bytes in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms on "
+              << jobSystem.size() << " threads: " << output.string() << "\n";
+    return 0;
+}
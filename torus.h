@@ -0,0 +1,107 @@
+#pragma once
+
+// Flat 3-torus: the scene in the box [-size/2, size/2]^3 repeats in every
+// direction. Each frame collects the translations of the box copies that can
+// be seen: the scene's bounding sphere, moved into a copy, must lie within the
+// distance budget of the eye and intersect the view frustum. The result is
+// one offset table, uploaded to a single instance buffer, so every object is
+// drawn once with instancing however many copies are visible. At most
+// TORUS_MAX_RANGE copies are examined in each direction from the eye's box.
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "frustum.h"
+#include "registry.h"
+
+#define TORUS_MAX_RANGE 10 // boxes tested per frame at most (2 * range + 1)^3
+
+class TorusSpace
+{
+    float size = 120.0f;
+    float budget = 600.0f; // world units from the eye
+    size_t maxCopies = 512;
+    std::vector<glm::vec3> offsets;
+    GlBuffer buffer;
+    size_t tested = 0;
+
+public:
+    // False, keeping the previous configuration, unless size > 0 and
+    // budget >= 0
+    bool configure(float _size, float _budget, size_t _maxCopies)
+    {
+        if (!(_size > 0.0f) || !(_budget >= 0.0f))
+            return false;
+        size = _size;
+        budget = _budget;
+        maxCopies = _maxCopies;
+        return true;
+    }
+
+    float getSize() const
+    {
+        return size;
+    }
+
+    // sceneSphere: bounding sphere (center xyz, radius w) of the objects in
+    // the fundamental box. Copies are returned nearest first.
+    const std::vector<glm::vec3>& update(const glm::vec3& eye, const glm::mat4x4& viewProjection, const glm::vec4& sceneSphere)
+    {
+        Frustum frustum(viewProjection);
+        glm::vec3 center(sceneSphere);
+        float radius = sceneSphere.w;
+
+        glm::vec3 eyeCell = glm::floor((eye - center) / size + 0.5f);
+        int range = int(std::min(std::ceil((budget + radius) / size), float(TORUS_MAX_RANGE)));
+        offsets.clear();
+        tested = 0;
+        for (int x = -range; x <= range; x++)
+            for (int y = -range; y <= range; y++)
+                for (int z = -range; z <= range; z++)
+                {
+                    glm::vec3 offset = (eyeCell + glm::vec3(float(x), float(y), float(z))) * size;
+                    glm::vec3 copy = center + offset;
+                    tested++;
+                    if (glm::length(copy - eye) - radius > budget)
+                        continue;
+                    if (frustum.intersects(glm::vec4(copy, radius)))
+                        offsets.push_back(offset);
+                }
+
+        std::sort(offsets.begin(), offsets.end(), [&](const glm::vec3& a, const glm::vec3& b) {
+            return glm::dot(center + a - eye, center + a - eye) < glm::dot(center + b - eye, center + b - eye);
+        });
+        if (offsets.size() > maxCopies)
+            offsets.resize(maxCopies);
+        return offsets;
+    }
+
+    // Uploads the last update() into the instance buffer (vec3 per copy)
+    GLuint upload()
+    {
+        if (!buffer)
+            buffer = GlBuffer::create();
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.get());
+        glBufferData(GL_ARRAY_BUFFER, offsets.size() * sizeof(glm::vec3), offsets.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return buffer.get();
+    }
+
+    // Frees the instance buffer; while the context is current
+    void release()
+    {
+        buffer.reset();
+    }
+
+    // Box copies examined by the last update()
+    size_t getTested() const
+    {
+        return tested;
+    }
+};
+
+inline TorusSpace torusSpace;
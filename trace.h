@@ -0,0 +1,225 @@
+#pragma once
+
+// Chrome trace event instrumentation (chrome://tracing, ui.perfetto.dev).
+// Each thread appends complete ("X") events to its own chain of fixed-size
+// chunks; only the owning thread writes a chunk and publishes the count with a
+// release store, so recording takes no locks. Chunks are registered on a
+// lock-free list and walked when the trace is written.
+//
+// TRACE_SCOPE compiles to nothing unless ENABLE_TRACING is defined; when
+// compiled in, recording is off until Tracer::start().
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_CALIBRATION_EVENTS 100000
+#define TRACE_FRAME_SCOPE "renderFrame" // overhead is reported against these spans
+
+struct TraceEvent
+{
+    const char* name;
+    int64_t start; // ns since tracer epoch
+    int64_t duration;
+};
+
+struct TraceChunk
+{
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    std::atomic<uint32_t> count{0};
+    uint32_t thread;
+    TraceChunk* nextAll = nullptr; // registration list, all threads
+};
+
+class Tracer
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::atomic<TraceChunk*> chunks{nullptr};
+    std::atomic<uint32_t> nextThread{1};
+    std::atomic<bool> enabled{false};
+    Clock::time_point epoch = Clock::now();
+    double nsPerEvent = 0.0;
+
+    struct ThreadState
+    {
+        TraceChunk* chunk = nullptr;
+        uint32_t thread = 0;
+    };
+
+    static ThreadState& threadState()
+    {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    TraceChunk* newChunk(uint32_t thread)
+    {
+        TraceChunk* chunk = new TraceChunk();
+        chunk->thread = thread;
+        chunk->nextAll = chunks.load(std::memory_order_relaxed);
+        while (!chunks.compare_exchange_weak(chunk->nextAll, chunk, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        return chunk;
+    }
+
+    static void append(TraceChunk* chunk, const char* name, int64_t start, int64_t end)
+    {
+        uint32_t n = chunk->count.load(std::memory_order_relaxed);
+        chunk->events[n] = { name, start, end - start };
+        chunk->count.store(n + 1, std::memory_order_release);
+    }
+
+public:
+    ~Tracer()
+    {
+        TraceChunk* chunk = chunks.load();
+        while (chunk)
+        {
+            TraceChunk* next = chunk->nextAll;
+            delete chunk;
+            chunk = next;
+        }
+    }
+
+    bool isEnabled() const
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+    }
+
+    void record(const char* name, int64_t start, int64_t end)
+    {
+        ThreadState& state = threadState();
+        if (!state.chunk || state.chunk->count.load(std::memory_order_relaxed) == TRACE_CHUNK_EVENTS)
+        {
+            if (!state.thread)
+                state.thread = nextThread.fetch_add(1);
+            state.chunk = newChunk(state.thread);
+        }
+        append(state.chunk, name, start, end);
+    }
+
+    // Measures the cost of one scope (two clock reads + append) on a private
+    // chunk so the result can be reported against the traced frame time.
+    void start()
+    {
+        TraceChunk scratch;
+        scratch.thread = 0;
+        int64_t begin = now();
+        for (int i = 0; i < TRACE_CALIBRATION_EVENTS; i++)
+        {
+            if (scratch.count.load(std::memory_order_relaxed) == TRACE_CHUNK_EVENTS)
+                scratch.count.store(0, std::memory_order_relaxed);
+            int64_t s = now();
+            append(&scratch, "calibration", s, now());
+        }
+        nsPerEvent = double(now() - begin) / TRACE_CALIBRATION_EVENTS;
+        enabled.store(true);
+    }
+
+    // Overhead is reported per frame: the events recorded during the
+    // TRACE_FRAME_SCOPE spans, on any thread, against the time those spans took
+    bool write(const std::string& fileName)
+    {
+        enabled.store(false);
+        std::ofstream file(fileName);
+        if (!file)
+        {
+            std::cerr << "Error al escribir la traza: " << fileName << std::endl;
+            return false;
+        }
+
+        size_t total = 0;
+        std::vector<std::pair<int64_t, int64_t>> frames; // start, end
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"NonEuclidean3DScene\"}}";
+        for (TraceChunk* chunk = chunks.load(std::memory_order_acquire); chunk; chunk = chunk->nextAll)
+        {
+            uint32_t n = chunk->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                const TraceEvent& e = chunk->events[i];
+                file << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"engine\",\"ph\":\"X\",\"pid\":1,\"tid\":" << chunk->thread
+                     << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0 << "}";
+                if (std::strcmp(e.name, TRACE_FRAME_SCOPE) == 0)
+                    frames.push_back({ e.start, e.start + e.duration });
+            }
+            total += n;
+        }
+        file << "\n]}\n";
+
+        // Frames do not overlap: each event falls in at most one
+        std::sort(frames.begin(), frames.end());
+        size_t inFrames = 0;
+        int64_t frameNs = 0;
+        for (const auto& frame : frames)
+            frameNs += frame.second - frame.first;
+        for (TraceChunk* chunk = chunks.load(std::memory_order_acquire); chunk; chunk = chunk->nextAll)
+        {
+            uint32_t n = chunk->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                int64_t start = chunk->events[i].start;
+                auto after = std::upper_bound(frames.begin(), frames.end(), std::make_pair(start, INT64_MAX));
+                inFrames += after != frames.begin() && start < std::prev(after)->second;
+            }
+        }
+
+        std::cout << "Trace written to " << fileName << ": " << total << " events, " << nsPerEvent << " ns/event";
+        if (!frames.empty() && frameNs > 0)
+        {
+            double overheadMs = inFrames * nsPerEvent / 1.0e6;
+            double percent = 100.0 * overheadMs / (frameNs / 1.0e6);
+            std::cout << ", ~" << overheadMs / frames.size() << " ms/frame overhead (" << percent << "% of " << frames.size() << " frames)";
+            if (percent > 1.0)
+                std::cout << " WARNING: above the 1% budget";
+        }
+        std::cout << "\n";
+        return true;
+    }
+};
+
+inline Tracer tracer;
+
+class TraceScope
+{
+    const char* name;
+    int64_t start;
+
+public:
+    TraceScope(const char* _name) :
+        name(_name), start(tracer.isEnabled() ? tracer.now() : -1)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (start >= 0)
+            tracer.record(name, start, tracer.now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef ENABLE_TRACING
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#endif
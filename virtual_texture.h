@@ -0,0 +1,592 @@
+#pragma once
+
+// Sparse virtual texturing, for textures far larger than the GPU memory they
+// may take (a 16k x 16k terrain albedo baked to .vtex, see baked.h). Only the
+// pages the view samples are on the GPU, in the slots of a page cache texture
+// of VIRTUAL_CACHE_SLOTS x VIRTUAL_CACHE_SLOTS pages. The page table texture
+// has a texel per page, a mip level per level of the virtual texture, holding
+// the slot the page is in and the level it comes from: while a page is
+// missing its entry points at its nearest resident ancestor, so the view
+// shows a blurrier version instead of a hole. The coarsest level is a single
+// page that never leaves the cache.
+//
+// What the view needs comes from a feedback pass: the scene is drawn again at
+// 1 / VIRTUAL_FEEDBACK_DIVISOR of the window with the FEEDBACK shader
+// variants, which write the page and level each pixel samples instead of its
+// colour; other objects write zero, so the ground they hide asks for nothing.
+// The target is read back through two pixel buffers a frame late, so reading
+// it does not stall. Missing pages are read with ranged reads, from the asset
+// pack or the loose file, and decompressed on the job system, at most
+// VIRTUAL_MAX_LOADS at a time and coarser levels first; at most
+// VIRTUAL_MAX_UPLOADS a frame replace the pages least recently asked for.
+// getStats() reports the hit rate and upload bandwidth of the last frame and
+// averaged over VIRTUAL_STATS_FRAMES.
+//
+// The cache is a fixed allocation, outside the residency budget. Render
+// thread only, like the GL objects it owns; one virtual texture per feedback
+// pass.
+
+#include <glad/gl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "assets.h"
+#include "baked.h"
+#include "pack.h"
+#include "registry.h"
+
+#define VIRTUAL_CACHE_SLOTS 16 // pages along each side of the page cache texture
+#define VIRTUAL_FEEDBACK_DIVISOR 8 // the feedback target is the window divided by this
+#define VIRTUAL_MAX_LOADS 8 // page reads in flight
+#define VIRTUAL_MAX_UPLOADS 8 // pages copied into the cache per frame
+#define VIRTUAL_STATS_FRAMES 120 // frames the reported rates are averaged over
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+class VirtualTexture
+{
+public:
+    struct Stats
+    {
+        size_t requested = 0, hits = 0, uploads = 0; // last frame
+        uint64_t uploadBytes = 0;
+        size_t frames = 0; // in the averages
+        double hitRate = 1.0, uploadsPerFrame = 0.0, bytesPerFrame = 0.0, bytesPerSecond = 0.0;
+        size_t resident = 0, slots = 0, loading = 0, failures = 0;
+        uint64_t cacheBytes = 0;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Load
+    {
+        uint32_t page;
+        Task<Expected<std::vector<unsigned char>>> task;
+    };
+
+    struct Frame
+    {
+        size_t requested = 0, hits = 0, uploads = 0;
+        uint64_t bytes = 0;
+        Clock::time_point end;
+    };
+
+    std::string directory, name;
+    VirtualTextureHeader header = {};
+    std::vector<VirtualTile> tiles;
+    std::vector<uint32_t> levelStart; // first page of each level
+    bool compressed = false; // S3TC: pages stay BC blocks on the GPU
+    uint32_t span = 0; // texels along a cache slot, border included
+    GlTexture cache, table;
+    uint64_t cacheBytes = 0;
+
+    std::vector<int32_t> slotOf; // per page, -1 when not resident
+    std::vector<uint32_t> pageIn; // per slot, UINT32_MAX when free
+    std::vector<uint64_t> slotUse; // per slot: frame its page was last wanted, UINT64_MAX for the pinned one
+    std::vector<uint64_t> wanted; // per page: frame it was last wanted
+    std::vector<char> loading; // per page: being read or waiting for a slot
+    std::vector<Load> loads;
+    std::vector<std::pair<uint32_t, std::vector<unsigned char>>> ready; // read, waiting for an upload
+    std::vector<std::vector<unsigned char>> entries; // page table levels, RGBA8
+    std::vector<uint32_t> requests, missing;
+    size_t failures = 0;
+
+    GlFramebuffer feedback;
+    GlRenderbuffer feedbackColor, feedbackDepth;
+    GlBuffer readback[2];
+    bool readbackPending[2] = {};
+    int feedbackWidth = 0, feedbackHeight = 0;
+    GLint savedViewport[4] = {};
+    GLfloat savedClear[4] = {};
+    GLboolean savedBlend = GL_FALSE;
+
+    uint64_t frame = 1;
+    Frame current;
+    std::vector<Frame> history; // ring of VIRTUAL_STATS_FRAMES
+
+    uint32_t pageId(uint32_t level, uint32_t x, uint32_t y) const
+    {
+        return levelStart[level] + y * virtualPages(header, level) + x;
+    }
+
+    uint32_t levelOf(uint32_t page) const
+    {
+        return uint32_t(std::upper_bound(levelStart.begin(), levelStart.end(), page) - levelStart.begin()) - 1;
+    }
+
+    // One page's blocks, or RGBA8 texels without S3TC; decoded on the job
+    // system worker readAsset() resumes on. Only reads what does not change
+    // after load().
+    Task<Expected<std::vector<unsigned char>>> readPage(uint32_t page)
+    {
+        VirtualTile tile = tiles[page];
+        Expected<std::vector<unsigned char>> stored = co_await readAsset(directory, name, tile.offset, tile.size);
+        if (!stored)
+            co_return AssetError{ stored.error() };
+        TextureData data = { header.format, { { span, span, {} } }, header.sourceHash };
+        if (tile.compressed)
+        {
+            data.levels[0].data.resize(virtualTileBytes(header));
+            if (!lz4::decompress(stored->data(), stored->size(), data.levels[0].data.data(), data.levels[0].data.size()))
+                co_return AssetError{ "Pagina de textura virtual danada: " + name };
+        }
+        else
+            data.levels[0].data = std::move(*stored);
+        if (!compressed)
+            decodeTexture(data);
+        co_return std::move(data.levels[0].data);
+    }
+
+    // Cache, page table and bookkeeping; on the render thread
+    void create()
+    {
+        span = header.pageSize + 2 * header.border;
+        GLsizei side = GLsizei(VIRTUAL_CACHE_SLOTS * span);
+        cache = GlTexture::create();
+        glBindTexture(GL_TEXTURE_2D, cache.get());
+        if (compressed)
+        {
+            std::vector<unsigned char> empty(size_t(side / 4) * (side / 4) * (header.format == BAKED_BC1 ? 8 : 16));
+            glCompressedTexImage2D(GL_TEXTURE_2D, 0, header.format == BAKED_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+                                   side, side, 0, GLsizei(empty.size()), empty.data());
+            cacheBytes = empty.size();
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            cacheBytes = uint64_t(side) * side * 4;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        table = GlTexture::create();
+        glBindTexture(GL_TEXTURE_2D, table.get());
+        for (uint32_t l = 0; l < header.levels; l++)
+        {
+            GLsizei pages = GLsizei(virtualPages(header, l));
+            entries.emplace_back(size_t(pages) * pages * 4, (unsigned char)0);
+            glTexImage2D(GL_TEXTURE_2D, GLint(l), GL_RGBA8, pages, pages, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            cacheBytes += entries.back().size();
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(header.levels) - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        slotOf.assign(header.tileCount, -1);
+        wanted.assign(header.tileCount, 0);
+        loading.assign(header.tileCount, 0);
+        pageIn.assign(VIRTUAL_CACHE_SLOTS * VIRTUAL_CACHE_SLOTS, UINT32_MAX);
+        slotUse.assign(pageIn.size(), 0);
+        history.resize(VIRTUAL_STATS_FRAMES);
+    }
+
+    void upload(uint32_t slot, uint32_t page, const std::vector<unsigned char>& data)
+    {
+        if (pageIn[slot] != UINT32_MAX)
+            slotOf[pageIn[slot]] = -1;
+        pageIn[slot] = page;
+        slotOf[page] = int32_t(slot);
+        slotUse[slot] = wanted[page];
+
+        GLint x = GLint(slot % VIRTUAL_CACHE_SLOTS * span), y = GLint(slot / VIRTUAL_CACHE_SLOTS * span);
+        glBindTexture(GL_TEXTURE_2D, cache.get());
+        if (compressed)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, GLsizei(span), GLsizei(span),
+                                      header.format == BAKED_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+                                      GLsizei(data.size()), data.data());
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, GLsizei(span), GLsizei(span), GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        current.uploads++;
+        current.bytes += data.size();
+    }
+
+    // A free slot, else the one whose page was wanted longest ago but not
+    // this frame; UINT32_MAX if every page in the cache is in view
+    uint32_t victim() const
+    {
+        uint32_t best = UINT32_MAX;
+        for (uint32_t slot = 0; slot < pageIn.size(); slot++)
+        {
+            if (pageIn[slot] == UINT32_MAX)
+                return slot;
+            if (slotUse[slot] < frame && (best == UINT32_MAX || slotUse[slot] < slotUse[best]))
+                best = slot;
+        }
+        return best;
+    }
+
+    // Each entry holds its page's slot and level, or its parent's entry
+    void updateTable()
+    {
+        glBindTexture(GL_TEXTURE_2D, table.get());
+        for (uint32_t l = header.levels; l-- > 0;)
+        {
+            uint32_t pages = virtualPages(header, l), parentPages = virtualPages(header, l + 1);
+            for (uint32_t y = 0; y < pages; y++)
+                for (uint32_t x = 0; x < pages; x++)
+                {
+                    unsigned char* entry = &entries[l][(size_t(y) * pages + x) * 4];
+                    int32_t slot = slotOf[pageId(l, x, y)];
+                    if (slot >= 0)
+                    {
+                        entry[0] = (unsigned char)(slot % VIRTUAL_CACHE_SLOTS);
+                        entry[1] = (unsigned char)(slot / VIRTUAL_CACHE_SLOTS);
+                        entry[2] = (unsigned char)l;
+                        entry[3] = 255;
+                    }
+                    else if (l + 1 < header.levels)
+                        std::memcpy(entry, &entries[l + 1][(size_t(y / 2) * parentPages + x / 2) * 4], 4);
+                }
+            glTexSubImage2D(GL_TEXTURE_2D, GLint(l), 0, 0, GLsizei(pages), GLsizei(pages), GL_RGBA, GL_UNSIGNED_BYTE, entries[l].data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Pages in a feedback image, each once
+    void collect(const unsigned char* pixels, size_t count)
+    {
+        requests.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            const unsigned char* pixel = pixels + i * 4;
+            if (pixel[3] == 0 || pixel[2] >= header.levels)
+                continue; // background or another object
+            uint32_t pages = virtualPages(header, pixel[2]);
+            if (pixel[0] >= pages || pixel[1] >= pages)
+                continue;
+            uint32_t page = pageId(pixel[2], pixel[0], pixel[1]);
+            if (wanted[page] == frame)
+                continue;
+            wanted[page] = frame;
+            requests.push_back(page);
+        }
+    }
+
+public:
+    VirtualTexture(const std::string& _directory, const std::string& _name, bool _compressed) :
+        directory(_directory), name(_name), compressed(_compressed)
+    {
+    }
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    // Reads in flight refer to the texture
+    ~VirtualTexture()
+    {
+        for (Load& load : loads)
+            while (!load.task.done())
+                if (!renderThread.pump() && !jobSystem.help())
+                    std::this_thread::yield();
+    }
+
+    // Reads the header and page table of a .vtex with ranged reads, then
+    // creates the cache on the render thread with the coarsest page in it;
+    // compressed: S3TC is available
+    static Task<Expected<std::unique_ptr<VirtualTexture>>> load(std::string directory, std::string name, bool compressed)
+    {
+        Expected<std::vector<unsigned char>> head = co_await readAsset(directory, name, 0, sizeof(VirtualTextureHeader));
+        if (!head)
+            co_return AssetError{ head.error() };
+        Expected<VirtualTextureHeader> header = readVirtualTextureHeader(*head, name);
+        if (!header)
+            co_return AssetError{ header.error() };
+        Expected<std::vector<unsigned char>> table =
+            co_await readAsset(directory, name, sizeof(VirtualTextureHeader), size_t(header->tileCount) * sizeof(VirtualTile));
+        if (!table)
+            co_return AssetError{ table.error() };
+
+        std::unique_ptr<VirtualTexture> texture = std::make_unique<VirtualTexture>(directory, name, compressed);
+        texture->header = *header;
+        texture->tiles.resize(header->tileCount);
+        std::memcpy(texture->tiles.data(), table->data(), table->size());
+        for (const VirtualTile& tile : texture->tiles)
+            if (tile.compressed ? tile.size > virtualTileBytes(*header) : tile.size != virtualTileBytes(*header))
+                co_return AssetError{ "Textura virtual no valida: " + name };
+        for (uint32_t l = 0, first = 0; l < header->levels; l++)
+        {
+            texture->levelStart.push_back(first);
+            first += virtualPages(*header, l) * virtualPages(*header, l);
+        }
+
+        co_await renderThread.resume();
+        texture->create();
+        uint32_t coarsest = header->tileCount - 1;
+        Expected<std::vector<unsigned char>> page = co_await texture->readPage(coarsest);
+        if (!page)
+            co_return AssetError{ page.error() };
+        co_await renderThread.resume();
+        texture->upload(0, coarsest, *page);
+        texture->slotUse[0] = UINT64_MAX; // pinned: the fallback of every page
+        texture->updateTable();
+        texture->current = Frame(); // not a streaming upload
+        co_return std::move(texture);
+    }
+
+    // Binds the feedback target, sized after the current viewport, and
+    // clears it; draw with FEEDBACK programs, then call endFeedback()
+    void beginFeedback()
+    {
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        int w = std::max(1, savedViewport[2] / VIRTUAL_FEEDBACK_DIVISOR), h = std::max(1, savedViewport[3] / VIRTUAL_FEEDBACK_DIVISOR);
+        if (!feedback || w != feedbackWidth || h != feedbackHeight)
+        {
+            feedback = GlFramebuffer::create();
+            feedbackColor = GlRenderbuffer::create();
+            feedbackDepth = GlRenderbuffer::create();
+            glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor.get());
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+            glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth.get());
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, feedback.get());
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor.get());
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth.get());
+            for (int i = 0; i < 2; i++)
+            {
+                readback[i] = GlBuffer::create();
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[i].get());
+                glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(w) * h * 4, nullptr, GL_STREAM_READ);
+                readbackPending[i] = false;
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            feedbackWidth = w;
+            feedbackHeight = h;
+        }
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, savedClear);
+        savedBlend = glIsEnabled(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedback.get());
+        glViewport(0, 0, w, h);
+        glDisable(GL_BLEND); // page ids are not colours
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // Starts reading this frame's feedback back and takes in the last one's
+    void endFeedback()
+    {
+        int write = int(frame % 2), read = 1 - write;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[write].get());
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        readbackPending[write] = true;
+        if (readbackPending[read])
+        {
+            size_t count = size_t(feedbackWidth) * feedbackHeight;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[read].get());
+            if (const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(count * 4), GL_MAP_READ_BIT))
+            {
+                collect((const unsigned char*)pixels, count);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            readbackPending[read] = false;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        glClearColor(savedClear[0], savedClear[1], savedClear[2], savedClear[3]);
+        if (savedBlend)
+            glEnable(GL_BLEND);
+    }
+
+    // Once per frame, after endFeedback(): takes in finished reads, uploads
+    // what fits, points the page table at the best resident pages and starts
+    // reads for the missing ones
+    void update()
+    {
+        for (size_t i = 0; i < loads.size();)
+        {
+            if (!loads[i].task.done())
+            {
+                i++;
+                continue;
+            }
+            Expected<std::vector<unsigned char>> page = loads[i].task.result();
+            if (page)
+                ready.emplace_back(loads[i].page, std::move(*page));
+            else
+            {
+                if (failures++ == 0)
+                    std::cerr << page.error() << std::endl;
+                loading[loads[i].page] = 0;
+            }
+            std::swap(loads[i], loads.back());
+            loads.pop_back();
+        }
+
+        // The pages asked for and their ancestors, which stand in for them
+        missing.clear();
+        current.requested = requests.size();
+        for (uint32_t page : requests)
+        {
+            current.hits += slotOf[page] >= 0;
+            uint32_t level = levelOf(page), index = page - levelStart[level];
+            uint32_t x = index % virtualPages(header, level), y = index / virtualPages(header, level);
+            for (;;)
+            {
+                uint32_t id = pageId(level, x, y);
+                if (id != page && wanted[id] == frame)
+                    break; // its ancestors are in already
+                wanted[id] = frame;
+                if (slotOf[id] >= 0)
+                    slotUse[size_t(slotOf[id])] = std::max(slotUse[size_t(slotOf[id])], frame);
+                else if (!loading[id])
+                    missing.push_back(id);
+                if (++level == header.levels)
+                    break;
+                x /= 2;
+                y /= 2;
+            }
+        }
+
+        // Coarser pages first: they cover more of the view
+        bool changed = false;
+        std::stable_sort(ready.begin(), ready.end(), [&](const auto& a, const auto& b) { return levelOf(a.first) > levelOf(b.first); });
+        size_t uploaded = 0;
+        for (auto& [page, data] : ready)
+        {
+            if (wanted[page] != frame || uploaded == VIRTUAL_MAX_UPLOADS)
+            {
+                loading[page] = wanted[page] == frame; // out of view: dropped
+                continue;
+            }
+            uint32_t slot = victim();
+            if (slot == UINT32_MAX)
+            {
+                loading[page] = 0;
+                continue;
+            }
+            upload(slot, page, data);
+            loading[page] = 0;
+            data.clear();
+            uploaded++;
+            changed = true;
+        }
+        ready.erase(std::remove_if(ready.begin(), ready.end(), [&](const auto& entry) { return !loading[entry.first]; }), ready.end());
+        if (changed)
+            updateTable();
+
+        std::stable_sort(missing.begin(), missing.end(), [&](uint32_t a, uint32_t b) { return levelOf(a) > levelOf(b); });
+        for (uint32_t page : missing)
+        {
+            if (loads.size() >= VIRTUAL_MAX_LOADS)
+                break;
+            if (loading[page])
+                continue; // listed twice: asked for and an ancestor of another
+            loading[page] = 1;
+            loads.push_back({ page, readPage(page) });
+            loads.back().task.start();
+        }
+
+        current.end = Clock::now();
+        history[frame % VIRTUAL_STATS_FRAMES] = current;
+        current = Frame();
+        frame++;
+    }
+
+    // Binds the cache to texture unit 0 and the page table to unit 1 and
+    // sets the uniforms of the current VIRTUAL_TEXTURE program
+    void bind(GLuint program) const
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, table.get());
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, cache.get());
+        glUniform1i(glGetUniformLocation(program, "pageCache"), 0);
+        glUniform1i(glGetUniformLocation(program, "pageTable"), 1);
+        glUniform1f(glGetUniformLocation(program, "virtualPages"), float(virtualPages(header, 0)));
+        glUniform1f(glGetUniformLocation(program, "virtualLevels"), float(header.levels));
+        glUniform1f(glGetUniformLocation(program, "cacheSlots"), float(VIRTUAL_CACHE_SLOTS));
+        glUniform1f(glGetUniformLocation(program, "feedbackBias"), std::log2(float(VIRTUAL_FEEDBACK_DIVISOR)));
+    }
+
+    void unbind() const
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    uint32_t getSize() const
+    {
+        return header.size;
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        const Frame& last = history[(frame - 1) % VIRTUAL_STATS_FRAMES];
+        stats.requested = last.requested;
+        stats.hits = last.hits;
+        stats.uploads = last.uploads;
+        stats.uploadBytes = last.bytes;
+
+        size_t requested = 0, hits = 0, uploads = 0;
+        uint64_t bytes = 0;
+        Clock::time_point first = last.end;
+        for (uint64_t f = frame - 1; f > 0 && frame - f <= VIRTUAL_STATS_FRAMES; f--)
+        {
+            const Frame& record = history[f % VIRTUAL_STATS_FRAMES];
+            requested += record.requested;
+            hits += record.hits;
+            uploads += record.uploads;
+            bytes += record.bytes;
+            first = record.end;
+            stats.frames++;
+        }
+        if (requested)
+            stats.hitRate = double(hits) / double(requested);
+        if (stats.frames > 1)
+        {
+            stats.uploadsPerFrame = double(uploads) / double(stats.frames);
+            stats.bytesPerFrame = double(bytes) / double(stats.frames);
+            double seconds = std::chrono::duration<double>(last.end - first).count();
+            if (seconds > 0.0)
+                stats.bytesPerSecond = double(bytes) / seconds;
+        }
+
+        stats.slots = pageIn.size();
+        for (uint32_t page : pageIn)
+            stats.resident += page != UINT32_MAX;
+        stats.loading = loads.size() + ready.size();
+        stats.failures = failures;
+        stats.cacheBytes = cacheBytes;
+        return stats;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const VirtualTexture::Stats& stats)
+{
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1);
+    text << "last frame " << stats.requested << " pages, " << (stats.requested ? 100.0 * double(stats.hits) / double(stats.requested) : 100.0)
+         << "% hit, " << stats.uploads << " uploads (" << stats.uploadBytes / 1024 << " KiB); over " << stats.frames << " frames "
+         << 100.0 * stats.hitRate << "% hit, " << stats.uploadsPerFrame << " uploads and " << stats.bytesPerFrame / 1024.0 << " KiB a frame ("
+         << stats.bytesPerSecond / (1024.0 * 1024.0) << " MiB/s); " << stats.resident << " / " << stats.slots << " slots, "
+         << stats.cacheBytes / 1024 << " KiB, " << stats.loading << " loading";
+    if (stats.failures)
+        text << " (" << stats.failures << " failed)";
+    return os << text.str();
+}